@@ -10,8 +10,329 @@
 #include <TFTLIB_SPI.h>
 #include "hw_drv.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 using namespace std;
 
+/* 1/sqrt(m) for m in [1, 4) split in 96 equal bins, Q16. Seed for fixedSqrt() */
+static const uint16_t RSqrtLUT[96] = {
+	0xFE0C, 0xFA39, 0xF692, 0xF312, 0xEFB8, 0xEC80, 0xE968, 0xE66F, 0xE392, 0xE0CF, 0xDE26, 0xDB94,
+	0xD919, 0xD6B3, 0xD460, 0xD221, 0xCFF4, 0xCDD7, 0xCBCB, 0xC9CD, 0xC7DF, 0xC5FE, 0xC42B, 0xC265,
+	0xC0AA, 0xBEFB, 0xBD58, 0xBBBF, 0xBA30, 0xB8AB, 0xB72F, 0xB5BC, 0xB452, 0xB2F0, 0xB196, 0xB044,
+	0xAEFA, 0xADB6, 0xAC7A, 0xAB44, 0xAA15, 0xA8EB, 0xA7C8, 0xA6AB, 0xA593, 0xA480, 0xA373, 0xA26B,
+	0xA168, 0xA06A, 0x9F70, 0x9E7B, 0x9D8A, 0x9C9E, 0x9BB5, 0x9AD1, 0x99F0, 0x9914, 0x983A, 0x9765,
+	0x9693, 0x95C4, 0x94F9, 0x9431, 0x936B, 0x92A9, 0x91EA, 0x912E, 0x9075, 0x8FBE, 0x8F0A, 0x8E59,
+	0x8DAA, 0x8CFE, 0x8C54, 0x8BAC, 0x8B07, 0x8A64, 0x89C4, 0x8925, 0x8889, 0x87EE, 0x8756, 0x86C0,
+	0x862B, 0x8599, 0x8508, 0x847A, 0x83ED, 0x8361, 0x82D8, 0x8250, 0x81CA, 0x8145, 0x80C2, 0x8040,
+};
+
+/* 4x4 Bayer ordered dither thresholds 0 - 15. Used by gradient fills */
+static const uint8_t Bayer4x4[16] = {
+	 0,  8,  2, 10,
+	12,  4, 14,  6,
+	 3, 11,  1,  9,
+	15,  7, 13,  5,
+};
+
+/* Blend of two RGB565 colours, same rounding as the original per channel alphaBlend().
+ * Channels are widened to 2c+1. On Cortex-M4 fg/bg pairs of one channel share a word and
+ * SMUAD gives fg*a + bg*(255-a) in one step. Elsewhere red and blue sit in 16 bit halves
+ * of one word and all lanes are blended with one multiply, green with a second one. */
+static inline uint16_t blend565(uint8_t alpha, uint16_t fgc, uint16_t bgc)
+{
+#if defined(__ARM_FEATURE_DSP)
+	uint32_t c = __PKHBT(bgc, fgc, 16);
+	uint32_t w = __PKHBT(255 - alpha, alpha, 16);
+
+	uint32_t r = __SMUAD(((c >> 10) & 0x003E003E) | 0x00010001, w) >> 9;
+	uint32_t g = __SMUAD(((c >>  4) & 0x007E007E) | 0x00010001, w) >> 9;
+	uint32_t b = __SMUAD(((c <<  1) & 0x003E003E) | 0x00010001, w) >> 9;
+
+	return (r << 11) | (g << 5) | b;
+#else
+	uint32_t rbf = ((fgc & 0xF800) << 6) | ((fgc & 0x001F) << 1) | 0x00010001;
+	uint32_t rbb = ((bgc & 0xF800) << 6) | ((bgc & 0x001F) << 1) | 0x00010001;
+	int32_t  gf  = ((fgc >> 4) & 0x7E) | 1;
+	int32_t  gb  = ((bgc >> 4) & 0x7E) | 1;
+
+	// bg*255 + (fg - bg)*a, lanes biased by 64 so they never go negative
+	uint32_t bias = ((uint32_t)alpha << 22) | ((uint32_t)alpha << 6);
+	uint32_t rb = (rbf - rbb + 0x00400040) * alpha + (rbb << 8) - rbb - bias;
+	uint32_t g  = (uint32_t)((gf - gb) * alpha + (gb << 8) - gb);
+
+	return ((rb >> 25) << 11) | ((g >> 9) << 5) | ((rb & 0xFFFF) >> 9);
+#endif
+}
+
+/* Eight pixels of blend565() at once for blendSpan() on hosts with 128 bit SIMD. Every
+ * channel stays in its own 16 bit lane, (2c+1)*255 fits so the rounding is the same. */
+#if defined(__SSE2__)
+#define BLEND565_X8
+typedef __m128i Pixel8;
+
+static inline Pixel8 load8(const uint16_t *p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline Pixel8 load8(const uint8_t *p)  { return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()); }
+static inline Pixel8 dup8(uint16_t v)         { return _mm_set1_epi16((int16_t)v); }
+static inline void store8(uint16_t *p, Pixel8 v) { _mm_storeu_si128((__m128i*)p, v); }
+
+static inline Pixel8 blend565x8(Pixel8 alpha, Pixel8 fgc, Pixel8 bgc)
+{
+	const __m128i m5 = _mm_set1_epi16(0x3E), m6 = _mm_set1_epi16(0x7E), one = _mm_set1_epi16(1);
+	__m128i na = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+
+	__m128i fr = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(fgc, 10), m5), one);
+	__m128i fg = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(fgc,  4), m6), one);
+	__m128i fb = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(fgc,  1), m5), one);
+	__m128i br = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(bgc, 10), m5), one);
+	__m128i bg = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(bgc,  4), m6), one);
+	__m128i bb = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(bgc,  1), m5), one);
+
+	__m128i r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(fr, alpha), _mm_mullo_epi16(br, na)), 9);
+	__m128i g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(fg, alpha), _mm_mullo_epi16(bg, na)), 9);
+	__m128i b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(fb, alpha), _mm_mullo_epi16(bb, na)), 9);
+
+	return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b);
+}
+#elif defined(__ARM_NEON)
+#define BLEND565_X8
+typedef uint16x8_t Pixel8;
+
+static inline Pixel8 load8(const uint16_t *p) { return vld1q_u16(p); }
+static inline Pixel8 load8(const uint8_t *p)  { return vmovl_u8(vld1_u8(p)); }
+static inline Pixel8 dup8(uint16_t v)         { return vdupq_n_u16(v); }
+static inline void store8(uint16_t *p, Pixel8 v) { vst1q_u16(p, v); }
+
+static inline Pixel8 blend565x8(Pixel8 alpha, Pixel8 fgc, Pixel8 bgc)
+{
+	const uint16x8_t m5 = vdupq_n_u16(0x3E), m6 = vdupq_n_u16(0x7E), one = vdupq_n_u16(1);
+	uint16x8_t na = vsubq_u16(vdupq_n_u16(255), alpha);
+
+	uint16x8_t fr = vorrq_u16(vandq_u16(vshrq_n_u16(fgc, 10), m5), one);
+	uint16x8_t fg = vorrq_u16(vandq_u16(vshrq_n_u16(fgc,  4), m6), one);
+	uint16x8_t fb = vorrq_u16(vandq_u16(vshlq_n_u16(fgc,  1), m5), one);
+	uint16x8_t br = vorrq_u16(vandq_u16(vshrq_n_u16(bgc, 10), m5), one);
+	uint16x8_t bg = vorrq_u16(vandq_u16(vshrq_n_u16(bgc,  4), m6), one);
+	uint16x8_t bb = vorrq_u16(vandq_u16(vshlq_n_u16(bgc,  1), m5), one);
+
+	uint16x8_t r = vshrq_n_u16(vmlaq_u16(vmulq_u16(br, na), fr, alpha), 9);
+	uint16x8_t g = vshrq_n_u16(vmlaq_u16(vmulq_u16(bg, na), fg, alpha), 9);
+	uint16x8_t b = vshrq_n_u16(vmlaq_u16(vmulq_u16(bb, na), fb, alpha), 9);
+
+	return vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g, 5)), b);
+}
+#endif
+
+/* Quarter wave sine table, 1 degree steps, Q15. Used through sinCosDeg() */
+static const uint16_t SinLUT[91] = {
+	    0,   572,  1144,  1715,  2286,  2856,  3425,  3993,  4560,  5126,  5690,  6252,
+	 6813,  7371,  7927,  8481,  9032,  9580, 10126, 10668, 11207, 11743, 12275, 12803,
+	13328, 13848, 14365, 14876, 15384, 15886, 16384, 16877, 17364, 17847, 18324, 18795,
+	19261, 19720, 20174, 20622, 21063, 21498, 21926, 22348, 22763, 23170, 23571, 23965,
+	24351, 24730, 25102, 25466, 25822, 26170, 26510, 26842, 27166, 27482, 27789, 28088,
+	28378, 28660, 28932, 29197, 29452, 29698, 29935, 30163, 30382, 30592, 30792, 30983,
+	31164, 31336, 31499, 31651, 31795, 31928, 32052, 32166, 32270, 32365, 32449, 32524,
+	32588, 32643, 32688, 32723, 32748, 32763, 32768,
+};
+
+/* Sine and cosine (Q16) of angle in degrees, table with linear interpolation of 1/256 deg */
+static inline void sinCosDeg(float deg, int32_t &s, int32_t &c)
+{
+	const int32_t quarter = 90 << 8;
+	int32_t a = (int32_t)floorf(deg * 256.0f) % (4 * quarter);
+	if (a < 0) a += 4 * quarter;
+
+	auto sine = [](int32_t a) {
+		int32_t q = a / quarter, r = a % quarter;
+		if (q & 1) r = quarter - r;
+		int32_t i = r >> 8, f = r & 0xFF;
+		int32_t v = (i < 90) ? SinLUT[i] + (((SinLUT[i + 1] - SinLUT[i]) * f) >> 8) : SinLUT[90];
+		return (q & 2) ? -2 * v : 2 * v;
+	};
+	s = sine(a);
+	c = sine((a + quarter) % (4 * quarter));
+}
+
+/***************************************************************************************
+** Function name:           addDevice
+** Description:             Register device with its chip select, prescaler and mode
+**                          (HAL SPI_BAUDRATEPRESCALER_x, SPI_POLARITY_x, SPI_PHASE_x).
+**                          Returns device id, -1 when table is full
+***************************************************************************************/
+int8_t SPI_Bus::addDevice(GPIO_TypeDef *cs_port, uint16_t cs_pin, uint32_t prescaler, uint32_t polarity, uint32_t phase) {
+	if (__n == BusMaxDevices) return -1;
+
+	__devices[__n] = { (prescaler & SPI_CR1_BR) | (polarity & SPI_CR1_CPOL) | (phase & SPI_CR1_CPHA), cs_port, cs_pin };
+	return __n++;
+}
+
+SPI_HandleTypeDef *SPI_Bus::handle(void) {
+	return __hspi;
+}
+
+/***************************************************************************************
+** Function name:           configure
+** Description:             Reprogram clock and mode when bus changes device. SPI has to be
+**                          idle, HAL enables it again on next transfer
+***************************************************************************************/
+void SPI_Bus::configure(uint8_t dev) {
+	if (__configured == dev) return;
+
+	uint32_t cr1 = __devices[dev].cr1;
+	__HAL_SPI_DISABLE(__hspi);
+	__hspi->Instance->CR1 = (__hspi->Instance->CR1 & ~(SPI_CR1_BR | SPI_CR1_CPOL | SPI_CR1_CPHA)) | cr1;
+	__hspi->Init.BaudRatePrescaler = cr1 & SPI_CR1_BR;
+	__hspi->Init.CLKPolarity = cr1 & SPI_CR1_CPOL;
+	__hspi->Init.CLKPhase = cr1 & SPI_CR1_CPHA;
+	__configured = dev;
+}
+
+/***************************************************************************************
+** Function name:           tryAcquire
+** Description:             Take bus for blocking transfers, false while other device holds
+**                          it or queued transfer runs. Device holding bus may call it again
+***************************************************************************************/
+bool SPI_Bus::tryAcquire(uint8_t dev) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	bool ok = __owner == dev;
+	if (!ok && __owner < 0 && !__running) {
+		__owner = dev;
+		configure(dev);
+		ok = true;
+	}
+
+	__set_PRIMASK(primask);
+	return ok;
+}
+
+/***************************************************************************************
+** Function name:           acquire
+** Description:             Wait for bus, queued transfer in flight is let finish
+***************************************************************************************/
+void SPI_Bus::acquire(uint8_t dev) {
+	while (!tryAcquire(dev));
+}
+
+/***************************************************************************************
+** Function name:           release
+** Description:             Free bus after last transfer of device ended, queued transfers
+**                          start in this gap
+***************************************************************************************/
+void SPI_Bus::release(uint8_t dev) {
+	if (__owner != dev) return;
+	while (__hspi->State != HAL_SPI_STATE_READY);
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	__owner = -1;
+	startNext();
+	__set_PRIMASK(primask);
+}
+
+/***************************************************************************************
+** Function name:           submit
+** Description:             Queue DMA transfer, callable from interrupts. Starts at once when
+**                          bus is free, done is called from spiHandler()
+***************************************************************************************/
+bool SPI_Bus::submit(uint8_t dev, uint8_t *tx, uint8_t *rx, uint16_t len, BusCallback done, void *user) {
+	if (dev >= __n || len == 0) return false;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	bool ok = (uint8_t)(__q_head - __q_tail) < BusQueueLength;
+	if (ok) {
+		__queue[__q_head % BusQueueLength] = { dev, tx, rx, len, done, user };
+		__q_head++;
+		if (__owner < 0 && !__running) startNext();
+	}
+
+	__set_PRIMASK(primask);
+	return ok;
+}
+
+/***************************************************************************************
+** Function name:           startNext
+** Description:             Start oldest queued transfer, interrupts are disabled by caller
+***************************************************************************************/
+void SPI_Bus::startNext(void) {
+	while (__q_tail != __q_head) {
+		__current = __queue[__q_tail % BusQueueLength];
+		__q_tail++;
+
+		const BusDevice &d = __devices[__current.dev];
+		configure(__current.dev);
+		d.cs_port->BSRR = (uint32_t)d.cs_pin << 16U;
+
+		HAL_StatusTypeDef st = __current.rx ? HAL_SPI_TransmitReceive_DMA(__hspi, __current.tx, __current.rx, __current.len)
+											: HAL_SPI_Transmit_DMA(__hspi, __current.tx, __current.len);
+		if (st == HAL_OK) {
+			__running = true;
+			return;
+		}
+
+		d.cs_port->BSRR = (uint32_t)d.cs_pin;
+		if (__current.done) __current.done(__current.user, false);
+	}
+}
+
+/***************************************************************************************
+** Function name:           spiHandler
+** Description:             Queued transfer finished, from HAL TxRx/Tx complete callback
+***************************************************************************************/
+void SPI_Bus::spiHandler(SPI_HandleTypeDef *hspi) {
+	if (hspi != __hspi || !__running) return;
+
+	const BusDevice &d = __devices[__current.dev];
+	d.cs_port->BSRR = (uint32_t)d.cs_pin;
+	__running = false;
+
+	if (__current.done) __current.done(__current.user, true);
+	if (__owner < 0 && !__running) startNext();
+}
+
+/* Least squares fit of s = a * x + b * y + c over n points, fixed point result (TouchCalShift) */
+static bool fitAffine(const int32_t *x, const int32_t *y, const int32_t *s, uint8_t n, int32_t &a, int32_t &b, int32_t &c)
+{
+	double mx = 0, my = 0, ms = 0;
+	for (uint8_t i = 0; i < n; i++) {
+		mx += x[i];
+		my += y[i];
+		ms += s[i];
+	}
+	mx /= n;
+	my /= n;
+	ms /= n;
+
+	double sxx = 0, sxy = 0, syy = 0, sxs = 0, sys = 0;
+	for (uint8_t i = 0; i < n; i++) {
+		double dx = x[i] - mx, dy = y[i] - my, ds = s[i] - ms;
+		sxx += dx * dx;
+		sxy += dx * dy;
+		syy += dy * dy;
+		sxs += dx * ds;
+		sys += dy * ds;
+	}
+
+	double det = sxx * syy - sxy * sxy;
+	if (det <= 1e-6 * sxx * syy) return false;
+
+	double fa = (sxs * syy - sys * sxy) / det;
+	double fb = (sys * sxx - sxs * sxy) / det;
+	double fc = ms - fa * mx - fb * my;
+	const double one = (double)(1 << TouchCalShift);
+
+	a = (int32_t)lround(fa * one);
+	b = (int32_t)lround(fb * one);
+	c = (int32_t)lround(fc * one);
+	return true;
+}
+
 /***************************************************************************************
 ** Function name:           XPT2046_Touchscreen
 ** Description:             Constructor
@@ -31,6 +352,16 @@ XPT2046_Touchscreen::XPT2046_Touchscreen(SPI_HandleTypeDef &bus, GPIO_TypeDef& G
 ***************************************************************************************/
 XPT2046_Touchscreen::~XPT2046_Touchscreen() { }
 
+/***************************************************************************************
+** Function name:           setBus
+** Description:             Share SPI through bus manager, dev is id from bus.addDevice()
+***************************************************************************************/
+void XPT2046_Touchscreen::setBus(SPI_Bus *bus, uint8_t dev) {
+	__arb = bus;
+	__arb_dev = dev;
+	if (bus) __bus = bus->handle();
+}
+
 /***************************************************************************************
 ** Function name:           pressed
 ** Description:             Check if touch is pressed
@@ -75,6 +406,29 @@ void XPT2046_Touchscreen::setRotation(uint8_t rotation) {
 			__rotation = 3;
 		break;
 	}
+	defaultCalibration();
+	buildFrame();
+}
+
+/***************************************************************************************
+** Function name:           defaultCalibration
+** Description:             Affine matrix of nominal min/max raw range in current rotation
+***************************************************************************************/
+void XPT2046_Touchscreen::defaultCalibration(void) {
+	float kx = (float)__scale_x / (__max_x - __min_x);
+	float ky = (float)__scale_y / (__max_y - __min_y);
+	bool flip_x = (__rotation == 0 || __rotation == 3);
+	bool flip_y = (__rotation == 2 || __rotation == 3);
+	const float one = (float)(1 << TouchCalShift);
+
+	__cal.magic = TouchCalMagic;
+	__cal.rotation = __rotation;
+	__cal.ax = lroundf((flip_x ? -kx : kx) * one);
+	__cal.bx = 0;
+	__cal.cx = lroundf((flip_x ? __scale_x + kx * __min_x : -kx * __min_x) * one);
+	__cal.ay = 0;
+	__cal.by = lroundf((flip_y ? -ky : ky) * one);
+	__cal.cy = lroundf((flip_y ? __scale_y + ky * __min_y : -ky * __min_y) * one);
 }
 
 /***************************************************************************************
@@ -82,77 +436,93 @@ void XPT2046_Touchscreen::setRotation(uint8_t rotation) {
 ** Description:             Set number of samples to get average coordinates
 ***************************************************************************************/
 void XPT2046_Touchscreen::setSamplesNumber(uint8_t number_of_samples) {
-	if(number_of_samples >= 16) __no_samples = 16;
-	__no_samples = number_of_samples;
+	__no_samples = max((uint8_t)1, min(number_of_samples, TouchMaxSamples));
+	buildFrame();
 }
 
 /***************************************************************************************
-** Function name:           getRaw
-** Description:             Get calibrated touch coordinates
+** Function name:           rawToScreen
+** Description:             Map raw values to screen coordinates by fixed point affine matrix
 ***************************************************************************************/
-bool XPT2046_Touchscreen::getTouch(int32_t* x, int32_t* y)
+void XPT2046_Touchscreen::rawToScreen(int32_t raw_x, int32_t raw_y, int32_t* x, int32_t* y)
 {
-    int32_t sum_x = 0;
-    int32_t sum_y = 0;
-    uint8_t samples = 0;
-    uint16_t zorros = 0;
-
-    if(!pressed()){
-    	*x = 0;
-    	*y = 0;
-        return 0;
-    }
-
-    CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	int32_t sx = (int32_t)(((int64_t)__cal.ax * raw_x + (int64_t)__cal.bx * raw_y + __cal.cx) >> TouchCalShift);
+	int32_t sy = (int32_t)(((int64_t)__cal.ay * raw_x + (int64_t)__cal.by * raw_y + __cal.cy) >> TouchCalShift);
 
-    for(uint8_t i = 0; i < __no_samples; i++)
-    {
-        samples++;
-
-        uint8_t y_raw[2];
-        uint8_t x_raw[2];
-
-        HAL_SPI_Transmit(__bus, reinterpret_cast<uint8_t*>(&__read_y), 1, HAL_MAX_DELAY);
-        HAL_SPI_TransmitReceive(__bus, reinterpret_cast<uint8_t*>(&zorros), y_raw, 2, HAL_MAX_DELAY);
-
-        HAL_SPI_Transmit(__bus, reinterpret_cast<uint8_t*>(&__read_x), 1, HAL_MAX_DELAY);
-        HAL_SPI_TransmitReceive(__bus, reinterpret_cast<uint8_t*>(&zorros), x_raw, 2, HAL_MAX_DELAY);
+	*x = max((int32_t)0, min(sx, (int32_t)__scale_x - 1));
+	*y = max((int32_t)0, min(sy, (int32_t)__scale_y - 1));
+}
 
-        sum_x += (((uint16_t)x_raw[0]) << 8) | ((uint16_t)x_raw[1]);
-        sum_y += (((uint16_t)y_raw[0]) << 8) | ((uint16_t)y_raw[1]);
-    }
+/***************************************************************************************
+** Function name:           buildFrame
+** Description:             Pipelined command stream, every control byte is sent during
+**                          second byte of previous readout (16 clocks per conversion):
+**                          Z1, Z2, then samples number of Y and X conversions
+***************************************************************************************/
+void XPT2046_Touchscreen::buildFrame(void) {
+	uint8_t cmd = 0;
+	memset(__tx, 0, sizeof(__tx));
+	__tx[2 * cmd++] = TouchReadZ1;
+	__tx[2 * cmd++] = TouchReadZ2;
+	for (uint8_t i = 0; i < __no_samples; i++) __tx[2 * cmd++] = __read_y;
+	for (uint8_t i = 0; i < __no_samples; i++) __tx[2 * cmd++] = __read_x;
+	__frame_len = 2 * cmd + 1;
+}
 
-    CS_PORT->BSRR = (uint32_t)CS_PIN;
+/***************************************************************************************
+** Function name:           readFrame
+** Description:             Send command stream in one blocking transfer
+***************************************************************************************/
+bool XPT2046_Touchscreen::readFrame(int32_t &x, int32_t &y, int32_t &z) {
+	if (__arb) __arb->acquire(__arb_dev);
+	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	HAL_StatusTypeDef st = HAL_SPI_TransmitReceive(__bus, __tx, __rx, __frame_len, HAL_MAX_DELAY);
+	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	if (__arb) __arb->release(__arb_dev);
 
-    if(samples < __no_samples) return false;
+	return st == HAL_OK && parseFrame(x, y, z);
+}
 
-    int32_t raw_x = (sum_x / __no_samples);
-    if(raw_x < __min_x) raw_x = __min_x;
-    if(raw_x > __max_x) raw_x = __max_x;
+/***************************************************************************************
+** Function name:           parseFrame
+** Description:             Median of X and Y readouts and pressure of received stream.
+**                          Returns false for noisy frame (spread of middle half too wide)
+***************************************************************************************/
+bool XPT2046_Touchscreen::parseFrame(int32_t &x, int32_t &y, int32_t &z) {
+	// Readout of conversion k is in bytes 2k+1 and 2k+2, 12 bits left aligned to 15
+	auto readout = [&](uint8_t k) { return (int32_t)(((uint16_t)__rx[2 * k + 1] << 8) | __rx[2 * k + 2]); };
+
+	auto median = [&](uint8_t first, int32_t &m) {
+		int32_t v[TouchMaxSamples];
+		uint8_t n = __no_samples;
+		for (uint8_t i = 0; i < n; i++) v[i] = readout(first + i);
+		sort(v, v + n);
+		m = (n & 1) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+		return v[(3 * n) / 4] - v[n / 4] <= TouchMaxSpread;
+	};
+
+	z = (readout(0) >> 3) + 4095 - (readout(1) >> 3);
+	__z = (uint16_t)max((int32_t)0, z);
+
+	bool ok = median(2, y);
+	return median(2 + __no_samples, x) && ok;
+}
 
-    int32_t raw_y = (sum_y / __no_samples);
-    if(raw_y < __min_y) raw_y = __min_y;
-    if(raw_y > __max_y) raw_y = __max_y;
+/***************************************************************************************
+** Function name:           getTouch
+** Description:             Get calibrated touch coordinates
+***************************************************************************************/
+bool XPT2046_Touchscreen::getTouch(int32_t* x, int32_t* y)
+{
+    int32_t raw_x, raw_y, z;
 
-    switch(__rotation){
-		case 0:
-			*x = 240 - (raw_x - __min_x) * __scale_x / (__max_x - __min_x);
-			*y = (raw_y - __min_y) * __scale_y / (__max_y - __min_y);
-		break;
-		case 1:
-			*x = (raw_x - __min_x) * __scale_x / (__max_x - __min_x);
-			*y = (raw_y - __min_y) * __scale_y / (__max_y - __min_y);
-		break;
-		case 2:
-			*x = (raw_x - __min_x) * __scale_x / (__max_x - __min_x);
-			*y = 320-(raw_y - __min_y) * __scale_y / (__max_y - __min_y);
-    	break;
-		case 3:
-			*x = 320-(raw_x - __min_x) * __scale_x / (__max_x - __min_x);
-			*y = 240-(raw_y - __min_y) * __scale_y / (__max_y - __min_y);
-    	break;
+    if(!pressed() || !readFrame(raw_x, raw_y, z) || z < TouchPressureMin){
+    	*x = 0;
+    	*y = 0;
+        return false;
     }
 
+    rawToScreen(raw_x, raw_y, x, y);
     return true;
 }
 
@@ -162,44 +532,14 @@ bool XPT2046_Touchscreen::getTouch(int32_t* x, int32_t* y)
 ***************************************************************************************/
 bool XPT2046_Touchscreen::getRaw(int32_t* x, int32_t* y)
 {
-    int32_t sum_x = 0;
-    int32_t sum_y = 0;
-    uint8_t samples = 0;
-    uint16_t zorros = 0;
+    int32_t raw_x, raw_y, z;
 
-    if(!pressed()){
+    if(!pressed() || !readFrame(raw_x, raw_y, z) || z < TouchPressureMin){
     	*x = 0;
     	*y = 0;
-        return 0;
-    }
-
-    CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
-
-    for(uint8_t i = 0; i < __no_samples; i++)
-    {
-        samples++;
-
-        uint8_t y_raw[2];
-        uint8_t x_raw[2];
-
-        HAL_SPI_Transmit(__bus, reinterpret_cast<uint8_t*>(&__read_y), 1, HAL_MAX_DELAY);
-        HAL_SPI_TransmitReceive(__bus, reinterpret_cast<uint8_t*>(&zorros), y_raw, 2, HAL_MAX_DELAY);
-
-        HAL_SPI_Transmit(__bus, reinterpret_cast<uint8_t*>(&__read_x), 1, HAL_MAX_DELAY);
-        HAL_SPI_TransmitReceive(__bus, reinterpret_cast<uint8_t*>(&zorros), x_raw, 2, HAL_MAX_DELAY);
-
-
-        sum_x += (((uint16_t)x_raw[0]) << 8) | ((uint16_t)x_raw[1]);
-        sum_y += (((uint16_t)y_raw[0]) << 8) | ((uint16_t)y_raw[1]);
+        return false;
     }
 
-    CS_PORT->BSRR = (uint32_t)CS_PIN;
-
-    if(samples < __no_samples) return false;
-
-    uint32_t raw_x = (sum_x / __no_samples);
-    uint32_t raw_y = (sum_y / __no_samples);
-
     if(__rotation == 1 || __rotation == 3) {
         *x = raw_y;
         *y = raw_x;
@@ -212,89 +552,295 @@ bool XPT2046_Touchscreen::getRaw(int32_t* x, int32_t* y)
     return true;
 }
 
+/***************************************************************************************
+** Function name:           getPressure
+** Description:             Pressure of last conversion, Z1 + 4095 - Z2 (higher is harder)
+***************************************************************************************/
+uint16_t XPT2046_Touchscreen::getPressure(void)
+{
+	return __z;
+}
+
 /***************************************************************************************
 ** Function name:           calibrateTouch
-** Description:             Calibrate touch from 4 points
-***************************************************************************************/
-void XPT2046_Touchscreen::calibrateTouch(TFTLIB_SPI *tft) {
-	uint8_t size = 10;
-	uint16_t calData[8];
-	int32_t x_tmp, y_tmp;
-	uint16_t color_fg = MAGENTA, color_bg = BLACK;
-	char print[32];
+** Description:             Calibrate touch from 5 points (corners and centre), affine matrix
+**                          is least squares fit so rotation and skew of panel are corrected.
+**                          Returns false when points do not fit (mistouch), old matrix stays
+***************************************************************************************/
+bool XPT2046_Touchscreen::calibrateTouch(TFTLIB_SPI *tft) {
+	const int16_t inset = 20, size = 10;
+	const uint16_t color_fg = MAGENTA, color_bg = BLACK;
+
+	int32_t w = tft->width(), h = tft->height();
+	int32_t sx[5] = { inset, w - 1 - inset, w - 1 - inset, inset, w / 2 };
+	int32_t sy[5] = { inset, inset, h - 1 - inset, h - 1 - inset, h / 2 };
+	int32_t rx[5], ry[5];
+
+	auto cross = [&](int32_t x, int32_t y, uint16_t color) {
+		tft->drawFastHLine(x - size, y, 2 * size + 1, color);
+		tft->drawFastVLine(x, y - size, 2 * size + 1, color);
+		tft->drawCircle(x, y, size / 2, color);
+	};
+
+	tft->fillScreen(color_bg);
 	tft->setFont(Font_7x10);
-	tft->setCursor(0, 30);
-	tft->fillScreen(BLACK);
-	for(uint8_t i = 0; i<4; i++){
-		tft->fillRect(0, 0, size+1, size+1, color_bg);
-		tft->fillRect(0, tft->height()-size-1, size+1, size+1, color_bg);
-		tft->fillRect(tft->width()-size-1, 0, size+1, size+1, color_bg);
-		tft->fillRect(tft->width()-size-1, tft->height()-size-1, size+1, size+1, color_bg);
-
-		if (i == 5) break; // used to clear the arrows
-
-		switch (i) {
-			case 0: // up left
-				tft->drawLine(0, 0, 0, size, color_fg);
-				tft->drawLine(0, 0, size, 0, color_fg);
-				tft->drawLine(0, 0, size , size, color_fg);
-			break;
-			case 1: // bot left
-				tft->drawLine(0, tft->height()-size-1, 0, tft->height()-1, color_fg);
-				tft->drawLine(0, tft->height()-1, size, tft->height()-1, color_fg);
-				tft->drawLine(size, tft->height()-size-1, 0, tft->height()-1 , color_fg);
-			break;
-			case 2: // up right
-				tft->drawLine(tft->width()-size-1, 0, tft->width()-1, 0, color_fg);
-				tft->drawLine(tft->width()-size-1, size, tft->width()-1, 0, color_fg);
-				tft->drawLine(tft->width()-1, size, tft->width()-1, 0, color_fg);
-			break;
-			case 3: // bot right
-				tft->drawLine(tft->width()-size-1, tft->height()-size-1, tft->width()-1, tft->height()-1, color_fg);
-				tft->drawLine(tft->width()-1, tft->height()-1-size, tft->width()-1, tft->height()-1, color_fg);
-				tft->drawLine(tft->width()-1-size, tft->height()-1, tft->width()-1, tft->height()-1, color_fg);
-			break;
+	tft->setTextColor(WHITE, color_bg);
+	tft->writeString(w / 2 - 49, h / 2 + 20, (char*)"Touch the cross");
+
+	for (uint8_t i = 0; i < 5; i++) {
+		cross(sx[i], sy[i], color_fg);
+
+		// Average of 8 firm readings, lifting the pen starts over
+		int32_t n = 0, sum_x = 0, sum_y = 0, x, y, z;
+		while (n < 8) {
+			if (!pressed()) n = sum_x = sum_y = 0;
+			else if (readFrame(x, y, z) && z >= TouchPressureMin) {
+				sum_x += x;
+				sum_y += y;
+				n++;
+			}
+			HAL_Delay(5);
 		}
+		rx[i] = sum_x / 8;
+		ry[i] = sum_y / 8;
+
+		cross(sx[i], sy[i], color_bg);
+		while (pressed()) HAL_Delay(5);
+		HAL_Delay(100);
+	}
 
-		while(!getRaw(&x_tmp, &y_tmp));
-		while(pressed());
-		calData[i*2] = x_tmp;
-		calData[i*2+1] = y_tmp;
+	TouchCalibration cal = __cal;
+	bool ok = fitAffine(rx, ry, sx, 5, cal.ax, cal.bx, cal.cx) && fitAffine(rx, ry, sy, 5, cal.ay, cal.by, cal.cy);
 
-		sprintf(print, "x%d = %ld y%d = %ld", i, x_tmp, i, y_tmp);
-		tft->println(print);
-		HAL_Delay(1000);
+	// Every point has to land close to its cross
+	for (uint8_t i = 0; ok && i < 5; i++) {
+		int32_t ex = (int32_t)(((int64_t)cal.ax * rx[i] + (int64_t)cal.bx * ry[i] + cal.cx) >> TouchCalShift) - sx[i];
+		int32_t ey = (int32_t)(((int64_t)cal.ay * rx[i] + (int64_t)cal.by * ry[i] + cal.cy) >> TouchCalShift) - sy[i];
+		if (abs(ex) > TouchCalMaxError || abs(ey) > TouchCalMaxError) ok = false;
 	}
+	if (ok) __cal = cal;
 
-	switch(__rotation){
-		case 0:
-			__min_x = (calData[4] + calData[6]) / 2; // calc min x
-			__max_x = (calData[0] + calData[2]) / 2; // calc max x
-			__min_y = (calData[1] + calData[5]) / 2; // calc min y
-			__max_y = (calData[3] + calData[7]) / 2; // calc max y
-		break;
-		case 1:
-			__min_x = (calData[0] + calData[4]) / 2; // calc min x
-			__max_x = (calData[2] + calData[6]) / 2; // calc max x
-			__min_y = (calData[1] + calData[3]) / 2; // calc min y
-			__max_y = (calData[5] + calData[7]) / 2; // calc max y
-		break;
-		case 2:
-			__min_x = (calData[0] + calData[2]) / 2; // calc min x
-			__max_x = (calData[4] + calData[6]) / 2; // calc max x
-			__min_y = (calData[3] + calData[7]) / 2; // calc min y
-			__max_y = (calData[1] + calData[5]) / 2; // calc max y
-		break;
-		case 3:
-			__min_x = (calData[2] + calData[6])/2; // calc min x
-			__max_x = (calData[0] + calData[4])/2; // calc max x
-			__min_y = (calData[5] + calData[7])/2; // calc min y
-			__max_y = (calData[1] + calData[3])/2; // calc max y
-		break;
+	tft->writeString(w / 2 - 77, h / 2 + 20, ok ? (char*)"Calibration completed! " : (char*)"Calibration failed!    ");
+	HAL_Delay(500);
+	return ok;
+}
+
+/***************************************************************************************
+** Function name:           calibrateTouch
+** Description:             Load matrix through storage callback, calibrate and save it when
+**                          storage has none for current rotation or force is set
+***************************************************************************************/
+bool XPT2046_Touchscreen::calibrateTouch(TFTLIB_SPI *tft, TouchStorage storage, void *user, bool force) {
+	TouchCalibration cal;
+	if (!force && storage(cal, false, user) && cal.magic == TouchCalMagic && cal.rotation == __rotation) {
+		__cal = cal;
+		return true;
+	}
+
+	while (!calibrateTouch(tft));
+	cal = __cal;
+	return storage(cal, true, user);
+}
+
+/***************************************************************************************
+** Function name:           getCalibration
+** Description:             Copy of affine matrix in use
+***************************************************************************************/
+void XPT2046_Touchscreen::getCalibration(TouchCalibration &cal) {
+	cal = __cal;
+}
+
+/***************************************************************************************
+** Function name:           setCalibration
+** Description:             Use stored affine matrix, rotation of matrix is set as well
+***************************************************************************************/
+bool XPT2046_Touchscreen::setCalibration(const TouchCalibration &cal) {
+	if (cal.magic != TouchCalMagic) return false;
+
+	setRotation(cal.rotation);
+	__cal = cal;
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           beginAsync
+** Description:             Start interrupt driven sampling. Application forwards EXTI of
+**                          IRQ pin to irqHandler(), periodic timer (2-10 ms) to
+**                          timerHandler() and SPI TxRx complete to spiHandler().
+**                          Timer starts DMA whenever SPI is idle, so touch needs SPI of
+**                          its own or an SPI_Bus (setBus) when display shares it: its
+**                          blocking transfers leave SPI idle between bytes with CS low
+***************************************************************************************/
+void XPT2046_Touchscreen::beginAsync(void) {
+	__ev_head = __ev_tail = 0;
+	__down = false;
+	__busy = false;
+	__armed = pressed();
+	__async = true;
+}
+
+/***************************************************************************************
+** Function name:           endAsync
+** Description:             Stop interrupt driven sampling, waits for running transfer
+***************************************************************************************/
+void XPT2046_Touchscreen::endAsync(void) {
+	__async = false;
+	__armed = false;
+	while (__busy);
+}
+
+/***************************************************************************************
+** Function name:           irqHandler
+** Description:             Pen down interrupt, arms sampling by timer
+***************************************************************************************/
+void XPT2046_Touchscreen::irqHandler(uint16_t pin) {
+	// PENIRQ toggles during conversions, only first edge counts
+	if (pin != IRQ_PIN || !__async || __armed) return;
+	__armed = true;
+}
+
+/***************************************************************************************
+** Function name:           timerHandler
+** Description:             Start DMA conversion of all samples while pen is down
+***************************************************************************************/
+void XPT2046_Touchscreen::timerHandler(void) {
+	if (!__armed || __busy) return;
+
+	// On shared bus frame waits in queue until display transfer ends
+	if (__arb) {
+		__busy = true;
+		if (!__arb->submit(__arb_dev, __tx, __rx, __frame_len, busDone, this)) __busy = false;
+		return;
+	}
+	if (__bus->State != HAL_SPI_STATE_READY) return;
+
+	__busy = true;
+	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	if (HAL_SPI_TransmitReceive_DMA(__bus, __tx, __rx, __frame_len) != HAL_OK) {
+		CS_PORT->BSRR = (uint32_t)CS_PIN;
+		__busy = false;
+	}
+}
+
+/***************************************************************************************
+** Function name:           spiHandler
+** Description:             DMA conversion finished, average samples and queue event
+***************************************************************************************/
+void XPT2046_Touchscreen::spiHandler(SPI_HandleTypeDef *hspi) {
+	if (hspi != __bus || !__busy || __arb) return;
+
+	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	frameDone();
+}
+
+/***************************************************************************************
+** Function name:           busDone
+** Description:             Completion of frame queued on shared bus
+***************************************************************************************/
+void XPT2046_Touchscreen::busDone(void *user, bool ok) {
+	XPT2046_Touchscreen *ts = (XPT2046_Touchscreen*)user;
+	if (ok) ts->frameDone();
+	else ts->__busy = false;
+}
+
+/***************************************************************************************
+** Function name:           frameDone
+** Description:             Filter finished frame and queue event
+***************************************************************************************/
+void XPT2046_Touchscreen::frameDone(void) {
+	int32_t mx, my, z;
+	uint32_t now = HAL_GetTick();
+
+	// Pressure decides up/down, noisy frames of pressed pen are skipped
+	bool valid = parseFrame(mx, my, z);
+	if (z >= TouchPressureMin && !valid) {
+		__busy = false;
+		return;
+	}
+
+	if (__async && z >= TouchPressureMin) {
+		if (!__down) {
+			__fx = mx;
+			__fy = my;
+		}
+		else {
+			// Moves under jitter threshold are ignored, larger ones smoothed by IIR
+			if (abs(mx - __fx) > TouchJitter) __fx += (mx - __fx) >> TouchIIRShift;
+			if (abs(my - __fy) > TouchJitter) __fy += (my - __fy) >> TouchIIRShift;
+		}
+
+		int32_t x, y;
+		rawToScreen(__fx, __fy, &x, &y);
+
+		if (!__down) {
+			if (pushEvent(TOUCH_EVENT::DOWN, x, y, now)) __down = true;
+		}
+		else if (x != __last_x || y != __last_y) {
+			// Moves are dropped rather than filling the last free slot
+			if ((uint8_t)(__ev_head - __ev_tail) < TouchEventQueue - 1) pushEvent(TOUCH_EVENT::MOVE, x, y, now);
+			else __overruns++;
+		}
+		if (__down) {
+			__last_x = x;
+			__last_y = y;
+		}
+	}
+	else {
+		if (!__down || pushEvent(TOUCH_EVENT::UP, __last_x, __last_y, now)) {
+			__down = false;
+			__armed = false;
+		}
 	}
 
-	  tft->writeString(0, 180, (char*)"Calibration completed!");
-	  HAL_Delay(2000);
+	__busy = false;
+}
+
+/***************************************************************************************
+** Function name:           pushEvent
+** Description:             Add event to ring, single producer (interrupt context)
+***************************************************************************************/
+bool XPT2046_Touchscreen::pushEvent(TOUCH_EVENT type, int16_t x, int16_t y, uint32_t time) {
+	uint8_t head = __ev_head;
+	if ((uint8_t)(head - __ev_tail) >= TouchEventQueue) {
+		__overruns++;
+		return false;
+	}
+
+	__events[head & (TouchEventQueue - 1)] = { type, x, y, __z, time };
+	__DMB();
+	__ev_head = head + 1;
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           pollEvent
+** Description:             Get oldest touch event without blocking, single consumer
+***************************************************************************************/
+bool XPT2046_Touchscreen::pollEvent(TouchEvent &event) {
+	uint8_t tail = __ev_tail;
+	if (tail == __ev_head) return false;
+
+	__DMB();
+	event = __events[tail & (TouchEventQueue - 1)];
+	__DMB();
+	__ev_tail = tail + 1;
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           overruns
+** Description:             Number of events lost because ring was full
+***************************************************************************************/
+uint32_t XPT2046_Touchscreen::overruns(void) {
+	return __overruns;
+}
+
+/***************************************************************************************
+** Function name:           isAsync
+** Description:             Interrupt driven sampling is running
+***************************************************************************************/
+bool XPT2046_Touchscreen::isAsync(void) {
+	return __async;
 }
 
 /***************************************************************************************
@@ -321,6 +867,47 @@ TFTLIB_SPI::TFTLIB_SPI(SPI_HandleTypeDef &bus, TFT_DRIVER drv, GPIO_TypeDef *GPI
 ***************************************************************************************/
 TFTLIB_SPI::~TFTLIB_SPI() {
 	delete[] __buffer;
+	delete[] __cover;
+	delete[] __scratch;
+	delete __jpeg;
+}
+
+/***************************************************************************************
+** Function name:           scratch
+** Description:             Work memory of drawing functions, grows to largest size asked
+**                          for and is kept between calls. Contents are kept when it grows,
+**                          so callers can hold data at its start while calling other users.
+**                          Returns nullptr when out of memory, old memory is left as it was
+***************************************************************************************/
+void *TFTLIB_SPI::scratch(uint32_t size) {
+	if (size > __scratch_size) {
+		uint64_t *p = new (nothrow) uint64_t[(size + 7) / 8];
+		if (p == nullptr) return nullptr;
+		if (__scratch) copy_n(__scratch, (__scratch_size + 7) / 8, p);
+		delete[] __scratch;
+		__scratch = p;
+		__scratch_size = size;
+	}
+	return __scratch;
+}
+
+/***************************************************************************************
+** Function name:           setBus
+** Description:             Share SPI through bus manager, dev is id from bus.addDevice().
+**                          Display holds bus only while its chip select is low
+***************************************************************************************/
+void TFTLIB_SPI::setBus(SPI_Bus *bus, uint8_t dev) {
+	__arb = bus;
+	__arb_dev = dev;
+	if (bus) _bus = bus->handle();
+}
+
+/***************************************************************************************
+** Function name:           handle
+** Description:             SPI of display, the one of SPI_Bus when set
+***************************************************************************************/
+SPI_HandleTypeDef *TFTLIB_SPI::handle(void) {
+	return _bus;
 }
 
 uint16_t TFTLIB_SPI::width(void){
@@ -353,10 +940,10 @@ void TFTLIB_SPI::init(void){
 ***************************************************************************************/
 inline void TFTLIB_SPI::writeCommand(uint8_t cmd)
 {
-	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	CS_L();
 	DC_PORT->BSRR = (uint32_t)DC_PIN << 16U;
 	SPI_Transmit(_bus, &cmd, sizeof(cmd), HAL_MAX_DELAY);
-	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	CS_H();
 }
 
 /***************************************************************************************
@@ -365,7 +952,7 @@ inline void TFTLIB_SPI::writeCommand(uint8_t cmd)
 ***************************************************************************************/
 void TFTLIB_SPI::writeData(uint8_t *buff, size_t buff_size)
 {
-	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	CS_L();
 	DC_PORT->BSRR = (uint32_t)DC_PIN;
 	while (buff_size > 0) {
 		uint16_t chunk_size = buff_size > 65535 ? 65535 : buff_size;
@@ -373,7 +960,7 @@ void TFTLIB_SPI::writeData(uint8_t *buff, size_t buff_size)
 		buff += chunk_size;
 		buff_size -= chunk_size;
 	}
-	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	CS_H();
 }
 
 /***************************************************************************************
@@ -383,7 +970,7 @@ void TFTLIB_SPI::writeData(uint8_t *buff, size_t buff_size)
 
 void TFTLIB_SPI::writeData_DMA(uint8_t *buff, size_t size)
 {
-	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	CS_L();
 	DC_PORT->BSRR = (uint32_t)DC_PIN;
 
 	uint32_t chunk_size = 0;
@@ -395,7 +982,7 @@ void TFTLIB_SPI::writeData_DMA(uint8_t *buff, size_t size)
 		while (_bus->State != HAL_SPI_STATE_READY);
 	}
 
-	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	CS_H();
 }
 
 /***************************************************************************************
@@ -404,10 +991,10 @@ void TFTLIB_SPI::writeData_DMA(uint8_t *buff, size_t size)
 ***************************************************************************************/
 inline void TFTLIB_SPI::writeSmallData(uint8_t data)
 {
-	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	CS_L();
 	DC_PORT->BSRR = (uint32_t)DC_PIN;
 	SPI_Transmit(_bus, &data, sizeof(data), HAL_MAX_DELAY);
-	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	CS_H();
 }
 
 /***************************************************************************************
@@ -474,10 +1061,20 @@ void TFTLIB_SPI::setRotation(uint8_t m)
 			break;
 		}
 	}
+	resetViewport();
 }
 
 /***************************************************************************************
-** Function name:           invertColors
+** Function name:           getRotation
+** Description:             Actual screen rotation 0 - 3
+***************************************************************************************/
+uint8_t TFTLIB_SPI::getRotation(void)
+{
+	return __rotation;
+}
+
+/***************************************************************************************
+** Function name:           invertColors
 ** Description:             Inverted colors mode
 ***************************************************************************************/
 void TFTLIB_SPI::invertColors(uint8_t invert)
@@ -495,6 +1092,29 @@ void TFTLIB_SPI::tearEffect(uint8_t tear)
 	writeCommand(tear ? 0x35 : 0x34);
 }
 
+/***************************************************************************************
+** Function name:           setScrollArea
+** Description:             Define vertical scroll area in panel rows (native portrait
+**                          direction), tfa + vsa + bfa must be panel height
+***************************************************************************************/
+void TFTLIB_SPI::setScrollArea(uint16_t tfa, uint16_t vsa, uint16_t bfa)
+{
+	uint16_t area[3] = { SWAP_UINT16(tfa), SWAP_UINT16(vsa), SWAP_UINT16(bfa) };
+	writeCommand(VSCRDEF);
+	writeData((uint8_t*)area, 6);
+}
+
+/***************************************************************************************
+** Function name:           scrollTo
+** Description:             Set panel row shown at top of vertical scroll area
+***************************************************************************************/
+void TFTLIB_SPI::scrollTo(uint16_t vsp)
+{
+	uint16_t row = SWAP_UINT16(vsp);
+	writeCommand(VSCRSADD);
+	writeData((uint8_t*)&row, 2);
+}
+
 /***************************************************************************************
 ** Function name:           color565
 ** Description:             Convert value RGB888 to RGB565
@@ -537,21 +1157,64 @@ uint16_t TFTLIB_SPI::color8to16(uint8_t color)
 ***************************************************************************************/
 uint16_t TFTLIB_SPI::alphaBlend(uint8_t alpha, uint16_t fgc, uint16_t bgc)
 {
-	// For speed use fixed point maths and rounding to permit a power of 2 division
-	uint16_t fgR = ((fgc >> 10) & 0x3E) + 1;
-	uint16_t fgG = ((fgc >>  4) & 0x7E) + 1;
-	uint16_t fgB = ((fgc <<  1) & 0x3E) + 1;
+	return blend565(alpha, fgc, bgc);
+}
+
+/***************************************************************************************
+** Function name:           blendSpan
+** Description:             Blend n pixels of src over dst in place, alpha per pixel
+***************************************************************************************/
+void TFTLIB_SPI::blendSpan(uint16_t *dst, const uint16_t *src, const uint8_t *alpha, uint32_t n)
+{
+	uint32_t i = 0;
+#if defined(BLEND565_X8)
+	for (; i + 8 <= n; i += 8) store8(dst + i, blend565x8(load8(alpha + i), load8(src + i), load8(dst + i)));
+#endif
+	for (; i < n; i++) dst[i] = blend565(alpha[i], src[i], dst[i]);
+}
 
-	uint16_t bgR = ((bgc >> 10) & 0x3E) + 1;
-	uint16_t bgG = ((bgc >>  4) & 0x7E) + 1;
-	uint16_t bgB = ((bgc <<  1) & 0x3E) + 1;
+/***************************************************************************************
+** Function name:           blendSpan
+** Description:             Blend single color over n pixels of dst, alpha per pixel
+***************************************************************************************/
+void TFTLIB_SPI::blendSpan(uint16_t *dst, uint16_t color, const uint8_t *alpha, uint32_t n)
+{
+	uint32_t i = 0;
+#if defined(BLEND565_X8)
+	for (; i + 8 <= n; i += 8) store8(dst + i, blend565x8(load8(alpha + i), dup8(color), load8(dst + i)));
+#endif
+	for (; i < n; i++) dst[i] = blend565(alpha[i], color, dst[i]);
+}
 
-	// Shift right 1 to drop rounding bit and shift right 8 to divide by 256
-	uint16_t r = (((fgR * alpha) + (bgR * (255 - alpha))) >> 9);
-	uint16_t g = (((fgG * alpha) + (bgG * (255 - alpha))) >> 9);
-	uint16_t b = (((fgB * alpha) + (bgB * (255 - alpha))) >> 9);
+/***************************************************************************************
+** Function name:           blendSpan
+** Description:             Blend n pixels of src over dst with constant alpha
+***************************************************************************************/
+void TFTLIB_SPI::blendSpan(uint16_t *dst, const uint16_t *src, uint8_t alpha, uint32_t n)
+{
+	if (alpha == 0) return;
+	if (alpha == 255) {
+		copy_n(src, n, dst);
+		return;
+	}
+	uint32_t i = 0;
+#if defined(BLEND565_X8)
+	for (; i + 8 <= n; i += 8) store8(dst + i, blend565x8(dup8(alpha), load8(src + i), load8(dst + i)));
+#endif
+	for (; i < n; i++) dst[i] = blend565(alpha, src[i], dst[i]);
+}
 
-	return (r << 11) | (g << 5) | (b << 0);
+/***************************************************************************************
+** Function name:           blendSpan
+** Description:             Blend single color over n pixels of dst with constant alpha
+***************************************************************************************/
+void TFTLIB_SPI::blendSpan(uint16_t *dst, uint16_t color, uint8_t alpha, uint32_t n)
+{
+	uint32_t i = 0;
+#if defined(BLEND565_X8)
+	for (; i + 8 <= n; i += 8) store8(dst + i, blend565x8(dup8(alpha), dup8(color), load8(dst + i)));
+#endif
+	for (; i < n; i++) dst[i] = blend565(alpha, color, dst[i]);
 }
 
 /***************************************************************************************
@@ -560,6 +1223,8 @@ uint16_t TFTLIB_SPI::alphaBlend(uint8_t alpha, uint16_t fgc, uint16_t bgc)
 ***************************************************************************************/
 void TFTLIB_SPI::setWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
 {
+	// Started job holds CS low and sends from buffer, every blocking drawing waits here
+	finish();
 	if(x0 < 0 || x0 >= _width || x1 < 0 || x1 >= _width || y0 < 0 || y0 >= _height || y1 < 0 || y1 >= _height) return;
 
 	/* Column Address set */
@@ -584,6 +1249,71 @@ void TFTLIB_SPI::setWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
 	writeCommand(RAMWR);
 }
 
+/***************************************************************************************
+** Function name:           setViewport
+** Description:             Move drawing origin to x&y and clip everything to w*h area
+***************************************************************************************/
+void TFTLIB_SPI::setViewport(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+	__vp_x = x;
+	__vp_y = y;
+	__vp_w = w;
+	__vp_h = h;
+	resetClipRect();
+}
+
+/***************************************************************************************
+** Function name:           resetViewport
+** Description:             Restore origin to 0,0 and clip area to full screen
+***************************************************************************************/
+void TFTLIB_SPI::resetViewport(void)
+{
+	setViewport(0, 0, _width, _height);
+}
+
+/***************************************************************************************
+** Function name:           setClipRect
+** Description:             Limit drawing to area inside viewport (viewport coordinates)
+***************************************************************************************/
+void TFTLIB_SPI::setClipRect(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+	int32_t x0 = max(__vp_x + x, max(__vp_x, (int32_t)0));
+	int32_t y0 = max(__vp_y + y, max(__vp_y, (int32_t)0));
+	int32_t x1 = min(__vp_x + x + w, min(__vp_x + __vp_w, _width)) - 1;
+	int32_t y1 = min(__vp_y + y + h, min(__vp_y + __vp_h, _height)) - 1;
+
+	__clip_x0 = x0;
+	__clip_y0 = y0;
+	__clip_x1 = x1;
+	__clip_y1 = y1;
+}
+
+/***************************************************************************************
+** Function name:           resetClipRect
+** Description:             Clip only to viewport area
+***************************************************************************************/
+void TFTLIB_SPI::resetClipRect(void)
+{
+	setClipRect(0, 0, __vp_w, __vp_h);
+}
+
+/***************************************************************************************
+** Function name:           clipRect
+** Description:             Move area to screen coordinates and cut it to clip rectangle
+***************************************************************************************/
+inline bool TFTLIB_SPI::clipRect(int32_t &x, int32_t &y, int32_t &w, int32_t &h)
+{
+	x += __vp_x;
+	y += __vp_y;
+
+	if (x < __clip_x0) { w -= __clip_x0 - x; x = __clip_x0; }
+	if (y < __clip_y0) { h -= __clip_y0 - y; y = __clip_y0; }
+	if (x + w > __clip_x1 + 1) w = __clip_x1 + 1 - x;
+	if (y + h > __clip_y1 + 1) h = __clip_y1 + 1 - y;
+
+	return (w > 0) && (h > 0);
+}
+
 /***************************************************************************************
 ** Function name:           pushPixels
 ** Description:             Write pixels from pointer (for JPEG Decoding)
@@ -618,20 +1348,17 @@ void TFTLIB_SPI::pushPixels(const void* data_in, uint32_t len){
 ** Description:             Push block of data divided on chunk with size of buffer
 ***************************************************************************************/
 void TFTLIB_SPI::pushBlock(uint16_t color, uint32_t len = 1){
-	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	CS_L();
 	DC_PORT->BSRR = (uint32_t)DC_PIN;
-	uint16_t last_chunk_size=0;
-	while (len-- > 0) {
-		uint16_t chunk_size = len > __buffer_size ? __buffer_size : len;
-		if(chunk_size != last_chunk_size){
-			last_chunk_size = chunk_size;
-			fill_n(__buffer, chunk_size, SWAP_UINT16(color));
-		}
+	uint16_t chunk_size = len > __buffer_size ? __buffer_size : len;
+	fill_n(__buffer, chunk_size, SWAP_UINT16(color));
+	while (len > 0) {
+		chunk_size = len > __buffer_size ? __buffer_size : len;
 		HAL_SPI_Transmit_DMA(_bus, reinterpret_cast<uint8_t*>(__buffer), chunk_size*2);
 		len -= chunk_size;
 		while(HAL_DMA_GetState(_bus->hdmatx) != HAL_DMA_STATE_READY);
 	}
-	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	CS_H();
 }
 
 /***************************************************************************************
@@ -642,10 +1369,10 @@ void TFTLIB_SPI::fillScreen(uint16_t color)
 {
 	uint32_t buff_size = 0, chunk_size = 0;
 
-	fill_n(__buffer, __buffer_size, SWAP_UINT16(color));
 	setWindow(0, 0, _width-1, _height - 1);
+	fill_n(__buffer, __buffer_size, SWAP_UINT16(color));
 
-	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	CS_L();
 	DC_PORT->BSRR = (uint32_t)DC_PIN;
 
 	chunk_size = __buffer_size;
@@ -657,7 +1384,7 @@ void TFTLIB_SPI::fillScreen(uint16_t color)
 		while(HAL_DMA_GetState(_bus->hdmatx) != HAL_DMA_STATE_READY);
 	}
 
-	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	CS_H();
 }
 
 /***************************************************************************************
@@ -746,17 +1473,87 @@ void TFTLIB_SPI::ARTtoggle() {
 ***************************************************************************************/
 void TFTLIB_SPI::drawPixel(int32_t x, int32_t y, uint16_t color)
 {
-	if ((x < 0) || (x >= _width) || (y < 0) || (y >= _height))	return;
+	x += __vp_x;
+	y += __vp_y;
+	if ((x < __clip_x0) || (x > __clip_x1) || (y < __clip_y0) || (y > __clip_y1))	return;
 
-	__buffer[0] = SWAP_UINT16(color);
+	pushPixel(x, y, color);
+}
+
+/***************************************************************************************
+** Function name:           pushPixel
+** Description:             Send single pixel at screen coords x&y, no clipping
+***************************************************************************************/
+inline void TFTLIB_SPI::pushPixel(int32_t x, int32_t y, uint16_t color)
+{
 	setWindow(x, y, x, y);
+	__buffer[0] = SWAP_UINT16(color);
 
-	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
+	CS_L();
 	DC_PORT->BSRR = (uint32_t)DC_PIN;
 
 	SPI_Transmit(_bus, reinterpret_cast<uint8_t*>(__buffer), 2, HAL_MAX_DELAY);
 
-	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	CS_H();
+}
+
+/***************************************************************************************
+** Function name:           plotPixel
+** Description:             Queue single pixel in batch, flushed as merged spans
+***************************************************************************************/
+inline void TFTLIB_SPI::plotPixel(int32_t x, int32_t y, uint16_t color)
+{
+	x += __vp_x;
+	y += __vp_y;
+	if ((x < __clip_x0) || (x > __clip_x1) || (y < __clip_y0) || (y > __clip_y1))	return;
+
+	if (__plot_len && (color != __plot_color || __plot_len >= PlotBatchSize)) flushPixels();
+
+	__plot_color = color;
+	__plot[__plot_len++] = ((uint32_t)y << 16) | (uint32_t)x;
+}
+
+/***************************************************************************************
+** Function name:           flushPixels
+** Description:             Sort batched pixels and send them as horizontal/vertical spans
+***************************************************************************************/
+void TFTLIB_SPI::flushPixels(void)
+{
+	uint32_t n = __plot_len, i, j, singles = 0;
+	if (n == 0) return;
+	__plot_len = 0;
+
+	// Keys are (y << 16 | x), so sorted order gives rows with contiguous x runs
+	sort(__plot, __plot + n);
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && (__plot[j] - __plot[j - 1]) <= 1; j++);
+		int32_t x = __plot[i] & 0xFFFF, y = __plot[i] >> 16;
+		int32_t len = (int32_t)(__plot[j - 1] & 0xFFFF) - x + 1;
+		if (len > 1) pushHLine(x, y, len, __plot_color);
+		else __plot[singles++] = ((uint32_t)x << 16) | (uint32_t)y; // Re-key left-overs by column
+	}
+
+	// Left-over pixels sorted by column: merge vertical runs, same column keeps CASET cached
+	sort(__plot, __plot + singles);
+
+	for (i = 0; i < singles; i = j) {
+		for (j = i + 1; j < singles && (__plot[j] - __plot[j - 1]) <= 1; j++);
+		int32_t x = __plot[i] >> 16, y = __plot[i] & 0xFFFF;
+		int32_t len = (int32_t)(__plot[j - 1] & 0xFFFF) - y + 1;
+		if (len > 1) pushVLine(x, y, len, __plot_color);
+		else pushPixel(x, y, __plot_color);
+	}
+}
+
+/***************************************************************************************
+** Function name:           plotPixels
+** Description:             Draw array of points with single color using merged spans
+***************************************************************************************/
+void TFTLIB_SPI::plotPixels(const Point *points, uint32_t n, uint16_t color)
+{
+	for (uint32_t i = 0; i < n; i++) plotPixel(points[i].x, points[i].y, color);
+	flushPixels();
 }
 
 /***************************************************************************************
@@ -764,25 +1561,74 @@ void TFTLIB_SPI::drawPixel(int32_t x, int32_t y, uint16_t color)
 ** Description:             Fast drawing Horizontal Line
 ***************************************************************************************/
 inline void TFTLIB_SPI::drawFastHLine(int32_t x, int32_t y, int32_t w, uint16_t color) {
-	if(x < 0 || x > _width || y < 0 || y > _height || x + w > _width) return;
+	int32_t h = 1;
+	if(!clipRect(x, y, w, h)) return;
+
+	pushHLine(x, y, w, color);
+}
+
+/***************************************************************************************
+** Function name:           drawFastVLine
+** Description:             Drawing Vertical Line
+***************************************************************************************/
+inline void TFTLIB_SPI::drawFastVLine(int32_t x, int32_t y, int32_t h, uint16_t color) {
+	int32_t w = 1;
+	if(!clipRect(x, y, w, h)) return;
+
+	pushVLine(x, y, h, color);
+}
 
+/***************************************************************************************
+** Function name:           pushHLine
+** Description:             Send horizontal span at screen coords, no clipping
+***************************************************************************************/
+inline void TFTLIB_SPI::pushHLine(int32_t x, int32_t y, int32_t w, uint16_t color) {
 	fill_n(__buffer, w, SWAP_UINT16(color));
+	pushLine(x, y, w);
+}
 
+/***************************************************************************************
+** Function name:           pushLine
+** Description:             Send w pixels already prepared in buffer as one row at screen coords
+***************************************************************************************/
+inline void TFTLIB_SPI::pushLine(int32_t x, int32_t y, int32_t w) {
 	setWindow(x, y, x + w - 1, y);
 	if(w>(_width/4)) writeData_DMA((uint8_t*)__buffer, w*2);
 	else writeData((uint8_t*)__buffer, w*2);
 }
 
 /***************************************************************************************
-** Function name:           drawFastVLine
-** Description:             Drawing Vertical Line
+** Function name:           pushLineKeyed
+** Description:             Send buffer like pushLine, pixels of transparent colour
+**                          (RGB565, -1 = none) are skipped
 ***************************************************************************************/
-inline void TFTLIB_SPI::drawFastVLine(int32_t x, int32_t y, int32_t h, uint16_t color) {
-	if(x < 0 || x > _width || y < 0 || y > _height || y + h > _height) return;
+inline void TFTLIB_SPI::pushLineKeyed(int32_t x, int32_t y, int32_t w, int32_t transparent) {
+	if (transparent < 0) {
+		pushLine(x, y, w);
+		return;
+	}
 
-	fill_n(__buffer, h, SWAP_UINT16(color));
+	uint16_t key = SWAP_UINT16(transparent);
+	for (int32_t i = 0; i < w; ) {
+		while (i < w && __buffer[i] == key) i++;
+		int32_t xs = i;
+		while (i < w && __buffer[i] != key) i++;
+		if (i == xs) break;
+
+		setWindow(x + xs, y, x + i - 1, y);
+		if(i - xs > (_width/4)) writeData_DMA((uint8_t*)(__buffer + xs), (i - xs)*2);
+		else writeData((uint8_t*)(__buffer + xs), (i - xs)*2);
+	}
+}
 
+/***************************************************************************************
+** Function name:           pushVLine
+** Description:             Send vertical span at screen coords, no clipping
+***************************************************************************************/
+inline void TFTLIB_SPI::pushVLine(int32_t x, int32_t y, int32_t h, uint16_t color) {
 	setWindow(x, y, x, y + h - 1);
+	fill_n(__buffer, h, SWAP_UINT16(color));
+
 	if(h>(_height/4)) writeData_DMA((uint8_t*)__buffer, h*2);
 	else writeData((uint8_t*)__buffer, h*2);
 }
@@ -810,23 +1656,23 @@ inline void TFTLIB_SPI::drawCircleHelper( int32_t x0, int32_t y0, int32_t rr, ui
 
 		if (xe-xs==1) {
 			if (cornername & 0x1) { // left top
-				drawPixel(x0 - xe, y0 - rr, color);
-				drawPixel(x0 - rr, y0 - xe, color);
+				plotPixel(x0 - xe, y0 - rr, color);
+				plotPixel(x0 - rr, y0 - xe, color);
 			}
 
 			if (cornername & 0x2) { // right top
-				drawPixel(x0 + rr    , y0 - xe, color);
-				drawPixel(x0 + xs + 1, y0 - rr, color);
+				plotPixel(x0 + rr    , y0 - xe, color);
+				plotPixel(x0 + xs + 1, y0 - rr, color);
 			}
 
 			if (cornername & 0x4) { // right bottom
-				drawPixel(x0 + xs + 1, y0 + rr    , color);
-				drawPixel(x0 + rr, y0 + xs + 1, color);
+				plotPixel(x0 + xs + 1, y0 + rr    , color);
+				plotPixel(x0 + rr, y0 + xs + 1, color);
 			}
 
 			if (cornername & 0x8) { // left bottom
-				drawPixel(x0 - rr, y0 + xs + 1, color);
-				drawPixel(x0 - xe, y0 + rr    , color);
+				plotPixel(x0 - rr, y0 + xs + 1, color);
+				plotPixel(x0 - xe, y0 + rr    , color);
 			}
 		}
 
@@ -854,16 +1700,7 @@ inline void TFTLIB_SPI::drawCircleHelper( int32_t x0, int32_t y0, int32_t rr, ui
 		}
 	xs = xe;
 	}
-}
-
-/***************************************************************************************
-** Function name:           wideWedgeDistance
-** Description:             Support function for drawWedgeLine
-***************************************************************************************/
-inline float TFTLIB_SPI::wedgeLineDistance(float xpax, float ypay, float bax, float bay, float dr) {
-	float h = fmaxf(fminf((xpax * bax + ypay * bay) / (bax * bax + bay * bay), 1.0f), 0.0f);
-	float dx = xpax - bax * h, dy = ypay - bay * h;
-	return sqrtf(dx * dx + dy * dy) + h * dr;
+	flushPixels();
 }
 
 /***************************************************************************************
@@ -871,8 +1708,6 @@ inline float TFTLIB_SPI::wedgeLineDistance(float xpax, float ypay, float bax, fl
 ** Description:             Support function for fillRoundRect()
 ***************************************************************************************/
 inline void TFTLIB_SPI::fillCircleHelper(int32_t x0, int32_t y0, int32_t r, uint8_t cornername, int32_t delta, uint16_t color) {
-	if(x0 < 0 || y0 < 0 || x0 > _width || y0 > _height || x0 + r > _width || y0 + r > _height) return;
-
 	int32_t f     = 1 - r;
 	int32_t ddF_x = 1;
 	int32_t ddF_y = -r - r;
@@ -897,46 +1732,25 @@ inline void TFTLIB_SPI::fillCircleHelper(int32_t x0, int32_t y0, int32_t r, uint
 	}
 }
 
-/***************************************************************************************
-** Function name:           fillCircleHelperAA
-** Description:             Support function for fillRoundRectAA()
-***************************************************************************************/
-inline void TFTLIB_SPI::fillCircleHelperAA(int32_t x0, int32_t y0, int32_t r, uint8_t cornername, int32_t delta, uint16_t color) {
-  int32_t f     = 1 - r;
-  int32_t ddF_x = 1;
-  int32_t ddF_y = -r - r;
-  int32_t y     = 0;
-
-  delta++;
-
-  while (y < r) {
-    if (f >= 0) {
-      if (cornername & 0x1) drawWideLine(x0 - y, y0 + r, x0 + y + delta, y0 + r, 1, color);
-      ddF_y += 2;
-      f     += ddF_y;
-      if (cornername & 0x2) drawWideLine(x0 - y, y0 - r, x0 + y + delta, y0 - r, 1, color);
-      r--;
-    }
-
-    y++;
-    if (cornername & 0x1) drawWideLine(x0 - r, y0 + y, x0 + r + delta, y0 + y, 1, color);
-    ddF_x += 2;
-    f     += ddF_x;
-    if (cornername & 0x2) drawWideLine(x0 - r, y0 - y, x0 + r + delta, y0 - y, 1, color);
-  }
-}
-
 /***************************************************************************************
 ** Function name:           drawLine
 ** Description:             Draw a line with single color
 ***************************************************************************************/
 void TFTLIB_SPI::drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint16_t color)
 {
-	if(x0 < 0 || x0 > _width || y0 < 0 || y0 > _height || x1 < 0 || x1 > _width || y1 < 0 || y1 > _height) return;
+	// Clip rectangle in viewport coordinates
+	int32_t cx0 = __clip_x0 - __vp_x, cx1 = __clip_x1 - __vp_x;
+	int32_t cy0 = __clip_y0 - __vp_y, cy1 = __clip_y1 - __vp_y;
+
+	// Trivial reject when both ends are outside the same clip edge
+	if ((x0 < cx0 && x1 < cx0) || (x0 > cx1 && x1 > cx1) || (y0 < cy0 && y1 < cy0) || (y0 > cy1 && y1 > cy1)) return;
+
 	bool steep = abs(y1 - y0) > abs(x1 - x0);
 	if (steep) {
 		swap_coord(x0, y0);
 		swap_coord(x1, y1);
+		swap_coord(cx0, cy0);
+		swap_coord(cx1, cy1);
 	}
 
 	if (x0 > x1) {
@@ -946,17 +1760,34 @@ void TFTLIB_SPI::drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint16
 
 	int32_t dx = x1 - x0, dy = abs(y1 - y0);
 
-	int32_t err = dx >> 1, ystep = -1, xs = x0, dlen = 0;
+	int32_t err = dx >> 1, ystep = -1, xs, dlen = 0;
 
 	if (y0 < y1) ystep = 1;
 
+	// Clip major axis and jump Bresenham state to first visible step, so
+	// clipped lines hit exactly the same pixels as unclipped ones
+	int32_t ia = cx0 - x0, ib = cx1 - x0;
+	if (ia < 0) ia = 0;
+	if (ib > dx) ib = dx;
+	if (ia > ib) return;
+
+	if (ia > 0) {
+		int64_t n = (int64_t)ia * dy - err;
+		int32_t m = (n > 0) ? (int32_t)((n + dx - 1) / dx) : 0;
+		y0 += m * ystep;
+		err += m * dx - ia * dy;
+	}
+	x1 = x0 + ib;
+	x0 += ia;
+	xs = x0;
+
 	// Split into steep and not steep for FastH/V separation
 	if (steep) {
 		for (; x0 <= x1; x0++) {
 			dlen++;
 			err -= dy;
 			if (err < 0) {
-				if (dlen == 1) drawPixel(y0, xs, color);
+				if (dlen == 1) plotPixel(y0, xs, color);
 				else drawFastVLine(y0, xs, dlen, color);
 				dlen = 0;
 				y0 += ystep; xs = x0 + 1;
@@ -970,7 +1801,7 @@ void TFTLIB_SPI::drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint16
 			dlen++;
 			err -= dy;
 			if (err < 0) {
-				if (dlen == 1) drawPixel(xs, y0, color);
+				if (dlen == 1) plotPixel(xs, y0, color);
 				else drawFastHLine(xs, y0, dlen, color);
 				dlen = 0;
 				y0 += ystep; xs = x0 + 1;
@@ -979,6 +1810,7 @@ void TFTLIB_SPI::drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint16
 		}
 		if (dlen) drawFastHLine(xs, y0, dlen, color);
 	}
+	flushPixels();
 }
 
 /***************************************************************************************
@@ -1010,6 +1842,7 @@ void TFTLIB_SPI::drawWedgeLine(float ax, float ay, float bx, float by, float ar,
 ** Description:             Draw anti-aliased line with single color
 ***************************************************************************************/
 void TFTLIB_SPI::drawWedgeLine(float ax, float ay, float bx, float by, float ar, float br, uint16_t fg_color, uint16_t bg_color) {
+	finish();
 	if ( (abs(ax - bx) < 0.01f) && (abs(ay - by) < 0.01f) ) bx += 0.01f;  // Avoid divide by zero
 
 	// Find line bounding box
@@ -1018,92 +1851,150 @@ void TFTLIB_SPI::drawWedgeLine(float ax, float ay, float bx, float by, float ar,
 	int32_t y0 = (int32_t)floorf(fminf(ay-ar, by-br));
 	int32_t y1 = (int32_t) ceilf(fmaxf(ay+ar, by+br));
 
+	// Cut bounding box to clip rectangle (viewport coordinates)
+	x0 = max(x0, __clip_x0 - __vp_x);
+	x1 = min(x1, __clip_x1 - __vp_x);
+	y0 = max(y0, __clip_y0 - __vp_y);
+	y1 = min(y1, __clip_y1 - __vp_y);
+	if (x0 > x1 || y0 > y1) return;
+
 	// Establish x start and y start
 	int32_t ys = ay;
 	if ((ax-ar)>(bx-br)) ys = by;
+	ys = min(max(ys, y0), y1);
 
-	float rdt = ar - br; // Radius delta
-	float alpha = 1.0f;
-	ar += 0.5;
-
-	float xpax, ypay, bax = bx - ax, bay = by - ay;
+	// Fixed point distance field, only setup is done in float
+	WedgeSDF sdf;
+	wedgeSetup(sdf, ax, ay, bx, by, ar, br);
 
 	int32_t xs = x0;
 	// Scan bounding box from ys down, calculate pixel intensity from distance to line
 	for (int32_t yp = ys; yp <= y1; yp++) {
-		bool swin = true;  // Flag to start new window area
-		bool endX = false; // Flag to skip pixels
-		ypay = yp - ay;
-		for (int32_t xp = xs; xp <= x1; xp++) {
-			if (endX) if (alpha <= LoAlphaTheshold) break;  // Skip right side
-			xpax = xp - ax;
-			alpha = ar - wedgeLineDistance(xpax, ypay, bax, bay, rdt);
-			if (alpha <= LoAlphaTheshold ) continue;
-			// Track edge to minimise calculations
-			if (!endX) {
-				endX = true;
-				xs = xp;
-			}
-
-			if (alpha > HiAlphaTheshold) {
-				if (swin) {
-					setWindow(xp, yp, width()-1, yp);
-					swin = false;
-				}
-				pushBlock(fg_color);
-				continue;
-			}
-
-			//Blend color with background and plot
-			if(bg_color == 0xFFFF) {
-				swin = true;
-			}
-
-			if (swin) {
-				setWindow(xp, yp, width()-1, yp);
-				swin = false;
-			}
-			pushBlock(alphaBlend((uint8_t)(alpha * PixelAlphaGain), fg_color, bg_color));
-		}
+		drawWedgeSpan(yp, xs, x1, sdf, fg_color, bg_color);
 	}
 
 	// Reset x start to left side of box
 	xs = x0;
 	// Scan bounding box from ys-1 up, calculate pixel intensity from distance to line
 	for (int32_t yp = ys-1; yp >= y0; yp--) {
-		bool swin = true;  // Flag to start new window area
-		bool endX = false; // Flag to skip pixels
-		ypay = yp - ay;
-		for (int32_t xp = xs; xp <= x1; xp++) {
-			if (endX) if (alpha <= LoAlphaTheshold) break;  // Skip right side of drawn line
-			xpax = xp - ax;
-			alpha = ar - wedgeLineDistance(xpax, ypay, bax, bay, rdt);
-			if (alpha <= LoAlphaTheshold ) continue;
-			// Track line boundary
-			if (!endX) {
-				endX = true;
-				xs = xp;
-			}
-			if (alpha > HiAlphaTheshold) {
-				if (swin) {
-					setWindow(xp, yp, width()-1, yp);
-					swin = false;
-				}
-				pushBlock(fg_color);
-				continue;
-			}
+		drawWedgeSpan(yp, xs, x1, sdf, fg_color, bg_color);
+	}
+}
 
-			//Blend color with background and plot
-			if(bg_color == 0xFFFF) {
-				swin = true;
-			}
-			if (swin) {
-				setWindow(xp, yp, width()-1, yp);
-				swin = false;
-			}
-			pushBlock(alphaBlend((uint8_t)(alpha * PixelAlphaGain), fg_color, bg_color));
-		}
+/***************************************************************************************
+** Function name:           wedgeSetup
+** Description:             Support function for drawWedgeLine, fixed point distance field
+**                          of line from a (radius ar) to b (radius br)
+***************************************************************************************/
+inline void TFTLIB_SPI::wedgeSetup(WedgeSDF &sdf, float ax, float ay, float bx, float by, float ar, float br) {
+	float bax = bx - ax, bay = by - ay;
+	float len = sqrtf(bax * bax + bay * bay);
+	// Rounded, unit vector in Q30 as it is stepped along a whole row
+	sdf.ax  = lroundf(ax * 65536.0f);
+	sdf.ay  = lroundf(ay * 65536.0f);
+	sdf.ux  = lroundf(bax / len * 1073741824.0f);
+	sdf.uy  = lroundf(bay / len * 1073741824.0f);
+	sdf.len = lroundf(len * 65536.0f);
+	sdf.ar  = lroundf((ar + 0.5f) * 65536.0f);
+	sdf.dr  = lroundf((ar - br) * 65536.0f);
+	sdf.k   = lroundf((ar - br) / len * 65536.0f);
+
+	// Squared distance limits for both end caps, sqrt only between them
+	for (int32_t i = 0; i < 2; i++) {
+		int64_t r_in  = sdf.ar - (i ? sdf.dr : 0) - (int32_t)(HiAlphaTheshold * 65536.0f);
+		int64_t r_out = sdf.ar - (i ? sdf.dr : 0) - (int32_t)(LoAlphaTheshold * 65536.0f);
+		sdf.cap_in[i]  = (r_in  > 0) ? r_in  * r_in  : -1;
+		sdf.cap_out[i] = (r_out > 0) ? r_out * r_out : 0;
+	}
+}
+
+/***************************************************************************************
+** Function name:           fixedSqrt
+** Description:             Square root of 64bit value, reciprocal sqrt table + 2 Newton steps,
+**                          within 1 of exact below 2^52
+***************************************************************************************/
+inline uint32_t TFTLIB_SPI::fixedSqrt(uint64_t x) {
+	if (x == 0) return 0;
+
+	// Normalise to m in [2^62, 2^64) with even shift
+	int32_t s = __builtin_clzll(x) & ~1;
+	uint64_t m = x << s;
+	uint32_t mm = (uint32_t)(m >> 32);                           // m / 2^62, Q30
+	uint32_t y = (uint32_t)RSqrtLUT[(m >> 57) - 32] << 14;       // 1/sqrt(mm), Q30
+
+	// y = y * (3 - mm * y^2) / 2
+	for (int32_t i = 0; i < 2; i++) {
+		uint32_t y2 = (uint32_t)(((uint64_t)y * y) >> 30);
+		uint32_t t  = (3U << 30) - (uint32_t)(((uint64_t)mm * y2) >> 30);
+		y = (uint32_t)(((uint64_t)y * t) >> 31);
+	}
+
+	// sqrt(x) = sqrt(mm) * 2^(31 - s/2), sqrt(mm) = mm * y
+	uint32_t r = (uint32_t)(((uint64_t)mm * y) >> 30);
+	s >>= 1;
+	if (s <= 1) return r << (1 - s);
+	return (r + (1U << (s - 2))) >> (s - 1);
+}
+
+/***************************************************************************************
+** Function name:           wedgeCoverage
+** Description:             Support function for drawWedgeLine, pixel alpha (Q16) from its
+**                          position along (u) and across (v) the line
+***************************************************************************************/
+inline int32_t TFTLIB_SPI::wedgeCoverage(const WedgeSDF &sdf, int32_t u, int32_t v) {
+	// Between end caps distance is just |v|, no sqrt needed
+	if (u > 0 && u < sdf.len) {
+		return sdf.ar - abs(v) - (int32_t)(((int64_t)u * sdf.k) >> 16);
+	}
+
+	// Inside end caps: solid and empty pixels are sorted out on squared distance
+	int32_t i = (u > 0);
+	if (i) u -= sdf.len;
+	int64_t d2 = (int64_t)u * u + (int64_t)v * v;
+	if (d2 < sdf.cap_in[i]) return 1 << 16;
+	if (d2 >= sdf.cap_out[i]) return 0;
+	return sdf.ar - (i ? sdf.dr : 0) - (int32_t)fixedSqrt((uint64_t)d2);
+}
+
+/***************************************************************************************
+** Function name:           drawWedgeSpan
+** Description:             Support function for drawWedgeLine, builds one scanline in
+**                          buffer and sends it with single window and transfer
+***************************************************************************************/
+inline void TFTLIB_SPI::drawWedgeSpan(int32_t yp, int32_t &xs, int32_t x1, const WedgeSDF &sdf, uint16_t fg_color, uint16_t bg_color) {
+	const int32_t lo = (int32_t)(LoAlphaTheshold * 65536.0f);
+	const int32_t hi = (int32_t)(HiAlphaTheshold * 65536.0f);
+	uint16_t fg_sw = SWAP_UINT16(fg_color);
+	int32_t alpha;
+	int32_t xp = xs, xe = -1;
+
+	// Position along and across line (Q30) at start of row, then updated by one step per pixel
+	int64_t px = ((int64_t)xp << 16) - sdf.ax, py = ((int64_t)yp << 16) - sdf.ay;
+	int64_t u = (px * sdf.ux + py * sdf.uy) >> 16;
+	int64_t v = (py * sdf.ux - px * sdf.uy) >> 16;
+
+	// Skip left side, track edge to minimise calculations on next line
+	for (; xp <= x1; xp++, u += sdf.ux, v -= sdf.uy) {
+		alpha = wedgeCoverage(sdf, (int32_t)(u >> 14), (int32_t)(v >> 14));
+		if (alpha > lo) break;
 	}
+	if (xp > x1) return;
+	xs = xp;
+
+	// Accumulate visible pixels until right side of line is reached
+	uint16_t *p = __buffer;
+	for (;;) {
+		if (alpha > hi) *p++ = fg_sw;
+		else *p++ = SWAP_UINT16(alphaBlend((uint8_t)((alpha * 255) >> 16), fg_color, bg_color));
+		xe = xp;
+		if (++xp > x1) break;
+		u += sdf.ux;
+		v -= sdf.uy;
+		alpha = wedgeCoverage(sdf, (int32_t)(u >> 14), (int32_t)(v >> 14));
+		if (alpha <= lo) break;
+	}
+
+	pushLine(xs + __vp_x, yp + __vp_y, xe - xs + 1);
 }
 
 /***************************************************************************************
@@ -1133,7 +2024,7 @@ void TFTLIB_SPI::drawTriangleAA(int32_t x1, int32_t y1, int32_t x2, int32_t y2,
 ***************************************************************************************/
 void TFTLIB_SPI::drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color)
 {
-	if(x < 0 || y < 0 || w < 0 || h < 0 || x > _width || y > _height || x + w > _width || y + h > _height) return;
+	if(w < 0 || h < 0) return;
 	drawFastHLine(x, y, w, color);
 	drawFastHLine(x, y + h, w, color);
 	drawFastVLine(x, y, h, color);
@@ -1146,7 +2037,7 @@ void TFTLIB_SPI::drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t c
 ***************************************************************************************/
 void TFTLIB_SPI::drawRectAA(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color)
 {
-	if(x < 0 || y < 0 || w < 0 || h < 0 || x > _width || y > _height || x + w > _width || y + h > _height) return;
+	if(w < 0 || h < 0) return;
 	drawWideLine(x, y, x + w, y, 1, color);
 	drawWideLine(x, y, x, y + h, 1, color);
 	drawWideLine(x + w, y, x + w, y + h, 1, color);
@@ -1159,7 +2050,7 @@ void TFTLIB_SPI::drawRectAA(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t
 ***************************************************************************************/
 void TFTLIB_SPI::drawRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color)
 {
-	if(x < 0 || y < 0 || w < 0 || h < 0 || x > _width || y > _height || x + w > _width || y + h > _height) return;
+	if(w < 0 || h < 0) return;
 	drawFastHLine(x + r  , y    , w - r - r, color); // Top
 	drawFastHLine(x + r  , y + h - 1, w - r - r, color); // Bottom
 	drawFastVLine(x    , y + r  , h - r - r, color); // Left
@@ -1178,7 +2069,7 @@ void TFTLIB_SPI::drawRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32
 ***************************************************************************************/
 void TFTLIB_SPI::drawCircle(int32_t x0, int32_t y0, int32_t r, uint16_t color)
 {
-	if(x0 - r < 0 || x0 + r > _width || y0 - r < 0 || y0 + r > _height)	return;
+	if(r < 0) return;
 
 	int32_t f     = 1 - r;
 	int32_t ddF_y = -2 * r;
@@ -1219,18 +2110,19 @@ void TFTLIB_SPI::drawCircle(int32_t x0, int32_t y0, int32_t r, uint16_t color)
 		}
 		else {
 			++xs;
-			drawPixel(x0 - xe, y0 + r, color);
-			drawPixel(x0 - xe, y0 - r, color);
-			drawPixel(x0 + xs, y0 - r, color);
-			drawPixel(x0 + xs, y0 + r, color);
-
-			drawPixel(x0 + r, y0 + xs, color);
-			drawPixel(x0 + r, y0 - xe, color);
-			drawPixel(x0 - r, y0 - xe, color);
-			drawPixel(x0 - r, y0 + xs, color);
+			plotPixel(x0 - xe, y0 + r, color);
+			plotPixel(x0 - xe, y0 - r, color);
+			plotPixel(x0 + xs, y0 - r, color);
+			plotPixel(x0 + xs, y0 + r, color);
+
+			plotPixel(x0 + r, y0 + xs, color);
+			plotPixel(x0 + r, y0 - xe, color);
+			plotPixel(x0 - r, y0 - xe, color);
+			plotPixel(x0 - r, y0 + xs, color);
 		}
 		xs = xe;
 	} while (xe < --r);
+	flushPixels();
 }
 
 /***************************************************************************************
@@ -1239,7 +2131,7 @@ void TFTLIB_SPI::drawCircle(int32_t x0, int32_t y0, int32_t r, uint16_t color)
 ***************************************************************************************/
 void TFTLIB_SPI::drawEllipse(int16_t x0, int16_t y0, int32_t rx, int32_t ry, uint16_t color)
 {
-	if(x0 - rx < 0 || x0 + rx > _width || y0 - ry < 0 || y0 + ry > _height || rx < 2 || ry < 2) return;
+	if(rx < 2 || ry < 2) return;
 	int32_t x, y;
 	int32_t rx2 = rx * rx;
 	int32_t ry2 = ry * ry;
@@ -1248,10 +2140,10 @@ void TFTLIB_SPI::drawEllipse(int16_t x0, int16_t y0, int32_t rx, int32_t ry, uin
 	int32_t s;
 
 	for (x = 0, y = ry, s = 2*ry2+rx2*(1-2*ry); ry2*x <= rx2*y; x++) {
-		drawPixel(x0 + x, y0 + y, color);
-		drawPixel(x0 - x, y0 + y, color);
-		drawPixel(x0 - x, y0 - y, color);
-		drawPixel(x0 + x, y0 - y, color);
+		plotPixel(x0 + x, y0 + y, color);
+		plotPixel(x0 - x, y0 + y, color);
+		plotPixel(x0 - x, y0 - y, color);
+		plotPixel(x0 + x, y0 - y, color);
 		if (s >= 0) {
 			s += fx2 * (1 - y);
 			y--;
@@ -1260,16 +2152,17 @@ void TFTLIB_SPI::drawEllipse(int16_t x0, int16_t y0, int32_t rx, int32_t ry, uin
 	}
 
 	for (x = rx, y = 0, s = 2*rx2+ry2*(1-2*rx); rx2*y <= ry2*x; y++) {
-		drawPixel(x0 + x, y0 + y, color);
-		drawPixel(x0 - x, y0 + y, color);
-		drawPixel(x0 - x, y0 - y, color);
-		drawPixel(x0 + x, y0 - y, color);
+		plotPixel(x0 + x, y0 + y, color);
+		plotPixel(x0 - x, y0 + y, color);
+		plotPixel(x0 - x, y0 - y, color);
+		plotPixel(x0 + x, y0 - y, color);
 		if (s >= 0) {
 			s += fy2 * (1 - x);
 			x--;
 		}
 		s += rx2 * ((4 * y) + 6);
 	}
+	flushPixels();
 }
 
 /***************************************************************************************
@@ -1338,87 +2231,137 @@ void TFTLIB_SPI::fillTriangle ( int32_t x0, int32_t y0, int32_t x1, int32_t y1,
 }
 
 /***************************************************************************************
-** Function name:           fillTriangleAA
-** Description:             Draw anti-aliased filled triangle with fixed color
+** Function name:           fillPolygon
+** Description:             Draw a filled polygon with single color, pixel centres on left
+**                          and top edges are inside, on right and bottom edges outside
 ***************************************************************************************/
-void TFTLIB_SPI::fillTriangleAA( int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color)
+void TFTLIB_SPI::fillPolygon(const Point *points, uint16_t n, uint16_t color, FILL_RULE rule)
 {
-  int32_t a, b, y, last;
-
-  // Sort coordinates by Y order (y2 >= y1 >= y0)
-  if (y0 > y1) {
-    swap_coord(y0, y1); swap_coord(x0, x1);
-  }
-  if (y1 > y2) {
-    swap_coord(y2, y1); swap_coord(x2, x1);
-  }
-  if (y0 > y1) {
-    swap_coord(y0, y1); swap_coord(x0, x1);
-  }
-
-  if (y0 == y2) { // Handle awkward all-on-same-line case as its own thing
-    a = b = x0;
-    if (x1 < a)      a = x1;
-    else if (x1 > b) b = x1;
-    if (x2 < a)      a = x2;
-    else if (x2 > b) b = x2;
-    drawWideLine(a, y0, b + 1, y0, 1, color);
-    return;
-  }
-
-  int32_t
-  dx01 = x1 - x0,
-  dy01 = y1 - y0,
-  dx02 = x2 - x0,
-  dy02 = y2 - y0,
-  dx12 = x2 - x1,
-  dy12 = y2 - y1,
-  sa   = 0,
-  sb   = 0;
-
-  if (y1 == y2) last = y1;
-  else last = y1 - 1;
-
-  for (y = y0; y <= last; y++) {
-    a   = x0 + sa / dy01;
-    b   = x0 + sb / dy02;
-    sa += dx01;
-    sb += dx02;
-
-    if (a > b) swap_coord(a, b);
-    drawWideLine(a, y, b + 1, y, 1, color);
-  }
-
-  sa = dx12 * (y - y1);
-  sb = dx02 * (y - y0);
-  for (; y <= y2; y++) {
-    a   = x1 + sa / dy12;
-    b   = x0 + sb / dy02;
-    sa += dx12;
-    sb += dx02;
-
-    if (a > b) swap_coord(a, b);
-    drawWideLine(a, y, b + 1, y, 1, color);
-  }
+	fillPolyHelper(points, n, color, rule);
 }
 
 /***************************************************************************************
-** Function name:           fillRect
-** Description:             Draw a filled rectangle with fixed color
+** Function name:           fillPolyHelper
+** Description:             Scanline fill of fillPolygon. First skip bytes (multiple of 8)
+**                          of scratch memory are held by caller, points may be among them
 ***************************************************************************************/
-void TFTLIB_SPI::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color)
+void TFTLIB_SPI::fillPolyHelper(const Point *points, uint16_t n, uint16_t color, FILL_RULE rule, uint32_t skip)
 {
-	if(x < 0 || y < 0 || w < 0 || h < 0 || x > _width || y > _height || x + w > _width || y + h > _height) return;
-
-	uint32_t buff_size = 0;
-	setWindow(x, y, x + w - 1, y + h - 1);
+	if (n < 3) return;
+
+	// Sorted edge table in screen space, integer slope keeps crossings exact. Edges,
+	// crossings and active edges share scratch memory after the part held by caller
+	struct Edge { int32_t x0, y0, y1, dx, dy, dir; };
+	uint32_t at = skip ? (uint32_t)((const uint8_t*)points - (const uint8_t*)__scratch) : 0;
+	uint8_t *mem = (uint8_t*)scratch(skip + n * (sizeof(Edge) + sizeof(int32_t) + sizeof(uint16_t)));
+	if (mem == nullptr) return;
+	if (skip) points = (const Point*)(mem + at);
+	Edge *edges = (Edge*)(mem + skip);
+	int32_t *xs = (int32_t*)(edges + n);
+	uint16_t *act = (uint16_t*)(xs + n);
+	uint16_t ne = 0;
+	int32_t ymin = INT32_MAX, ymax = INT32_MIN;
+
+	for (uint16_t i = 0; i < n; i++) {
+		int32_t px = points[i].x + __vp_x, py = points[i].y + __vp_y;
+		int32_t qx = points[(i + 1 < n) ? i + 1 : 0].x + __vp_x, qy = points[(i + 1 < n) ? i + 1 : 0].y + __vp_y;
+		if (py == qy) continue;
+
+		Edge &e = edges[ne++];
+		e.dir = 1;
+		if (py > qy) {
+			swap_coord(px, qx);
+			swap_coord(py, qy);
+			e.dir = -1;
+		}
+		e.x0 = px;
+		e.y0 = py;
+		e.y1 = qy;
+		e.dx = qx - px;
+		e.dy = qy - py;
+		ymin = min(ymin, py);
+		ymax = max(ymax, qy);
+	}
 
-	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
-	DC_PORT->BSRR = (uint32_t)DC_PIN;
+	sort(edges, edges + ne, [](const Edge &a, const Edge &b) { return a.y0 < b.y0; });
 
-	buff_size = w * h;
+	int32_t ya = max(ymin, __clip_y0), yb = min(ymax, __clip_y1 + 1);
+	uint16_t na = 0, next = 0;
 
-	fill_n(__buffer, __buffer_size, SWAP_UINT16(color));
+	for (int32_t y = ya; y < yb; y++) {
+		// Update active edge table and collect first pixel right of each crossing, winding direction in bit 0
+		while (next < ne && edges[next].y0 <= y) {
+			if (edges[next].y1 > y) act[na++] = next;
+			next++;
+		}
+
+		uint16_t k = 0, nx = 0;
+		for (uint16_t i = 0; i < na; i++) {
+			const Edge &e = edges[act[i]];
+			if (e.y1 <= y) continue;
+			act[k++] = act[i];
+			int32_t t = (y - e.y0) * e.dx;
+			int32_t x = e.x0 + ((t >= 0) ? (t + e.dy - 1) / e.dy : -(-t / e.dy));
+			xs[nx++] = (x << 1) | (e.dir > 0);
+		}
+		na = k;
+		sort(xs, xs + nx);
+
+		// Walk crossings, merge touching spans and send each as one window
+		int32_t wind = 0, sa = 0, ra = INT32_MIN, rb = INT32_MIN;
+		for (uint16_t i = 0; i < nx; i++) {
+			bool in = (rule == FILL_RULE::EVENODD) ? (wind & 1) : (wind != 0);
+			wind += (xs[i] & 1) ? 1 : -1;
+			bool now = (rule == FILL_RULE::EVENODD) ? (wind & 1) : (wind != 0);
+			int32_t x = xs[i] >> 1;
+
+			if (!in && now) sa = x;
+			else if (in && !now && x > sa) {
+				if (sa <= rb) rb = max(rb, x);
+				else {
+					if (ra != INT32_MIN) {
+						int32_t l = max(ra, __clip_x0), r = min(rb, __clip_x1 + 1);
+						if (l < r) pushHLine(l, y, r - l, color);
+					}
+					ra = sa;
+					rb = x;
+				}
+			}
+		}
+		if (ra != INT32_MIN) {
+			int32_t l = max(ra, __clip_x0), r = min(rb, __clip_x1 + 1);
+			if (l < r) pushHLine(l, y, r - l, color);
+		}
+	}
+}
+
+/***************************************************************************************
+** Function name:           fillTriangleAA
+** Description:             Draw anti-aliased filled triangle with fixed color
+***************************************************************************************/
+void TFTLIB_SPI::fillTriangleAA( int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color, uint16_t bg_color)
+{
+	PointF p[3] = { {(float)x0, (float)y0}, {(float)x1, (float)y1}, {(float)x2, (float)y2} };
+	fillPolygonAA(p, 3, color, FILL_RULE::NONZERO, bg_color);
+}
+
+/***************************************************************************************
+** Function name:           fillRect
+** Description:             Draw a filled rectangle with fixed color
+***************************************************************************************/
+void TFTLIB_SPI::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color)
+{
+	if(!clipRect(x, y, w, h)) return;
+
+	uint32_t buff_size = 0;
+	setWindow(x, y, x + w - 1, y + h - 1);
+
+	CS_L();
+	DC_PORT->BSRR = (uint32_t)DC_PIN;
+
+	buff_size = w * h;
+
+	fill_n(__buffer, __buffer_size, SWAP_UINT16(color));
 
 	while (buff_size > (8 * __buffer_size)) {
 		HAL_SPI_Transmit_DMA(_bus, (uint8_t*)__buffer, __buffer_size*2);
@@ -1452,7 +2395,7 @@ void TFTLIB_SPI::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t c
 		while (_bus->State != HAL_SPI_STATE_READY);
 		buff_size -= buff_size;
 	}
-	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	CS_H();
 }
 
 /***************************************************************************************
@@ -1461,33 +2404,9 @@ void TFTLIB_SPI::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t c
 ***************************************************************************************/
 void TFTLIB_SPI::fillRectAA(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color)
 {
-	if(x < 0 || y < 0 || w < 0 || h < 0 || x > _width || y > _height || x + w > _width || y + h > _height) return;
-
-	uint32_t chunk_size = 0, buff_size = 0;
-	setWindow(x, y, x + w - 1, y + h - 1);
-
-	CS_PORT->BSRR = (uint32_t)CS_PIN << 16U;
-	DC_PORT->BSRR = (uint32_t)DC_PIN;
-
-	if(w * h >  __buffer_size){
-		chunk_size = w;
-		fill_n(__buffer, w, SWAP_UINT16(color));
-	}
-
-	else{
-		chunk_size = w * h;
-		fill_n(__buffer, w*h, SWAP_UINT16(color));
-	}
-
-	buff_size = w * h;
-
-	while (buff_size > 0) {
-		HAL_SPI_Transmit_DMA(_bus, (uint8_t*)__buffer, chunk_size*2);
-		buff_size -= chunk_size;
-		while (_bus->State != HAL_SPI_STATE_READY);
-	}
+	if(w <= 0 || h <= 0) return;
 
-	CS_PORT->BSRR = (uint32_t)CS_PIN;
+	fillRect(x, y, w, h, color);
 
 	drawWideLine(x, y, x + w - 1, y, 1, color);
 	drawWideLine(x, y+h-1, x+w-1, y+h-1, 1, color);
@@ -1509,13 +2428,32 @@ void TFTLIB_SPI::fillRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32
 
 /***************************************************************************************
 ** Function name:           fillRoundRectAA
-** Description:             Draw a filled rectangle with rounded corners & single color
+** Description:             Draw anti-aliased filled rectangle with rounded corners & single color
 ***************************************************************************************/
-void TFTLIB_SPI::fillRoundRectAA(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color) {
-  fillRectAA(x, y + r, w, h - r - r, color);
+void TFTLIB_SPI::fillRoundRectAA(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color, uint16_t bg_color) {
+	if(w <= 0 || h <= 0) return;
+	r = max((int32_t)0, min(r, min(w, h) / 2));
+
+	// Corner segment count keeps chord error near 0.08 pixel
+	const int32_t max_seg = 16;
+	int32_t seg = min(max_seg, (int32_t)(2.0f * sqrtf((float)r)) + 1);
+	float cs[max_seg + 1], sn[max_seg + 1];
+	for (int32_t i = 0; i <= seg; i++) {
+		cs[i] = r * cosf(i * (float)M_PI / 2 / seg);
+		sn[i] = r * sinf(i * (float)M_PI / 2 / seg);
+	}
 
-  fillCircleHelperAA(x + r, y + h - r - 1, r, 1, w - r - r - 1, color);
-  fillCircleHelperAA(x + r    , y + r, r, 2, w - r - r - 1, color);
+	// Rectangle edges lie on pixel borders, corners are clockwise quarter circles
+	float l = x - 0.5f + r, t = y - 0.5f + r;
+	float rr = x + w - 0.5f - r, b = y + h - 0.5f - r;
+	PointF p[4 * (max_seg + 1)];
+	uint16_t n = 0;
+	for (int32_t i = 0; i <= seg; i++) p[n++] = { l - cs[i], t - sn[i] };
+	for (int32_t i = seg; i >= 0; i--) p[n++] = { rr + cs[i], t - sn[i] };
+	for (int32_t i = 0; i <= seg; i++) p[n++] = { rr + cs[i], b + sn[i] };
+	for (int32_t i = seg; i >= 0; i--) p[n++] = { l - cs[i], b + sn[i] };
+
+	fillPolygonAA(p, n, color, FILL_RULE::NONZERO, bg_color);
 }
 
 /***************************************************************************************
@@ -1523,15 +2461,18 @@ void TFTLIB_SPI::fillRoundRectAA(int32_t x, int32_t y, int32_t w, int32_t h, int
 ** Description:             Draw a filled circle with single color
 ***************************************************************************************/
 void TFTLIB_SPI::fillCircle(int32_t x, int32_t y, int32_t r, uint16_t color){
-	if(x - r < 0 || x + r > _width || y - r < 0 || y + r > _height)	return;
-	int16_t  xs  = 0;
-	int16_t  dx = 1;
-	int16_t  dy = r+r;
-	int16_t  p  = -(r>>1);
+	if(r < 0) return;
+	// Whole circle outside clip rectangle
+	if(x + r < __clip_x0 - __vp_x || x - r > __clip_x1 - __vp_x || y + r < __clip_y0 - __vp_y || y - r > __clip_y1 - __vp_y) return;
+
+	int32_t  xs = 0;
+	int32_t  dx = 1;
+	int32_t  dy = r+r;
+	int32_t  p  = -(r>>1);
 
 	drawFastHLine(x - r, y, dy+1, color);
 
-	while(x < r) {
+	while(xs < r) {
 		if(p >= 0) {
 			drawFastHLine(x - xs, y + r, dx, color);
 			dy-=2;
@@ -1541,7 +2482,7 @@ void TFTLIB_SPI::fillCircle(int32_t x, int32_t y, int32_t r, uint16_t color){
 			r--;
 		}
 
-		x++;
+		xs++;
 		drawFastHLine(x - r, y + xs, dy+1, color);
 
 		dx+=2;
@@ -1555,719 +2496,3752 @@ void TFTLIB_SPI::fillCircle(int32_t x, int32_t y, int32_t r, uint16_t color){
 ** Description:             Draw anti-aliased filled circle with fixed color
 ***************************************************************************************/
 void TFTLIB_SPI::fillCircleAA(float x, float y, float r, uint16_t color) {
-	if(x - r < 0 || x + r > _width || y - r < 0 || y + r > _height)	return;
-	drawWedgeLine(x, y, x, y, r, r, color, 0xFFFF);
+	fillArcHelperAA(x, y, r, 0, 0, 360, color, 0xFFFF);
 }
 
 /***************************************************************************************
-** Function name:           fillEllipse
-** Description:             Draw a filled ellipse with single color
+** Function name:           fillCircleAA
+** Description:             Draw anti-aliased filled circle blended with background color
 ***************************************************************************************/
-void TFTLIB_SPI::fillEllipse(int16_t x0, int16_t y0, int32_t rx, int32_t ry, uint16_t color)
-{
-	if(x0 - rx < 0 || x0 + rx > _width || y0 - ry < 0 || y0 + ry > _height || rx < 2 || ry < 2) return;
-	int32_t x, y;
-	int32_t rx2 = rx * rx;
-	int32_t ry2 = ry * ry;
-	int32_t fx2 = 4 * rx2;
-	int32_t fy2 = 4 * ry2;
-	int32_t s;
-
-	for (x = 0, y = ry, s = 2*ry2+rx2*(1-2*ry); ry2*x <= rx2*y; x++) {
-		drawFastHLine(x0 - x, y0 - y, x + x + 1, color);
-		drawFastHLine(x0 - x, y0 + y, x + x + 1, color);
-
-		if (s >= 0) {
-			s += fx2 * (1 - y);
-			y--;
-		}
-		s += ry2 * ((4 * x) + 6);
-	}
-
-	for (x = rx, y = 0, s = 2*rx2+ry2*(1-2*rx); rx2*y <= ry2*x; y++) {
-		drawFastHLine(x0 - x, y0 - y, x + x + 1, color);
-		drawFastHLine(x0 - x, y0 + y, x + x + 1, color);
-
-		if (s >= 0) {
-			s += fy2 * (1 - x);
-			x--;
-		}
-		s += rx2 * ((4 * y) + 6);
-	}
+void TFTLIB_SPI::fillCircleAA(float x, float y, float r, uint16_t color, uint16_t bg_color) {
+	fillArcHelperAA(x, y, r, 0, 0, 360, color, bg_color);
 }
 
 /***************************************************************************************
-** Function name:           drawImage
-** Description:             Draw image at coords x&y
+** Function name:           drawRingAA
+** Description:             Draw anti-aliased ring (thick circle) between radius ir and r
 ***************************************************************************************/
-void TFTLIB_SPI::drawImage(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data) {
-	if(x < 0 || y < 0 || w < 0 || h < 0 || x > _width || y > _height || x + w > _width || y + h > _height) return;
-
-	setWindow(x, y, x + w - 1, y + h - 1);
-	writeData_DMA((uint8_t *)data, w * h * 2);
+void TFTLIB_SPI::drawRingAA(float x, float y, float r, float ir, uint16_t color, uint16_t bg_color) {
+	fillArcHelperAA(x, y, r, ir, 0, 360, color, bg_color);
 }
 
 /***************************************************************************************
-** Function name:           drawBitmap
-** Description:             Draw bitmap from array with fixed color
+** Function name:           drawArcAA
+** Description:             Draw anti-aliased arc of ring, angles in degrees clockwise from 12 o'clock
+**                          Arcs with hard (not smooth) ends at the same angle join without seam
 ***************************************************************************************/
-void TFTLIB_SPI::drawBitmap(int16_t x, int16_t y, int16_t w, int16_t h, const uint8_t *bitmap, uint16_t color) {
-	if(x < 0 || y < 0 || w < 0 || h < 0 || x > _width || y > _height || x + w > _width || y + h > _height) return;
-
-	int32_t i, j, byteWidth = (w + 7) / 8;
-
-	for (j = 0; j < h; j++) {
-		for (i = 0; i < w; i++ ) {
-			if (pgm_read_byte(bitmap + j * byteWidth + i / 8) & (128 >> (i & 7))) {
-				drawPixel(x + i, y + j, color);
-			}
-		}
-	}
+void TFTLIB_SPI::drawArcAA(float x, float y, float r, float ir, float start_angle, float end_angle, uint16_t color, uint16_t bg_color, bool smooth_start, bool smooth_end) {
+	fillArcHelperAA(x, y, r, ir, start_angle, end_angle, color, bg_color, smooth_start, smooth_end);
 }
 
 /***************************************************************************************
-** Function name:           setCursor
-** Description:             Set text cursor at x&y. Used for print/println function
+** Function name:           fillPieAA
+** Description:             Draw anti-aliased pie slice, angles in degrees clockwise from 12 o'clock
 ***************************************************************************************/
-void TFTLIB_SPI::setCursor(int32_t x, int32_t y){
-	if(x > _width || y > _height) return;
-	_posx = x;
-	_posy = y;
+void TFTLIB_SPI::fillPieAA(float x, float y, float r, float start_angle, float end_angle, uint16_t color, uint16_t bg_color) {
+	fillArcHelperAA(x, y, r, 0, start_angle, end_angle, color, bg_color);
 }
 
 /***************************************************************************************
-** Function name:           setTextColor
-** Description:             Set text cursor at x&y. Used for print/println function
+** Function name:           fillArcHelperAA
+** Description:             Support function for AA circles, rings, arcs and pies. Rows are
+**                          cut analytically into solid interior and edge pixels, only
+**                          edge pixels get distance calculation
 ***************************************************************************************/
-void TFTLIB_SPI::setTextColor(int32_t fg, int32_t bg){
-	__text_fg = fg;
-	__text_bg = bg;
+void TFTLIB_SPI::fillArcHelperAA(float x, float y, float r, float ir, float start_angle, float end_angle, uint16_t fg_color, uint16_t bg_color, bool smooth_start, bool smooth_end) {
+	finish();
+	if (r <= 0 || ir >= r) return;
+
+	const int32_t lo = (int32_t)(LoAlphaTheshold * 65536.0f);
+	const int32_t hi = (int32_t)(HiAlphaTheshold * 65536.0f);
+	ArcSDF arc;
+
+	arc.cx = (int32_t)(x * 65536.0f);
+	arc.cy = (int32_t)(y * 65536.0f);
+	arc.ro = (int32_t)((r + 0.5f) * 65536.0f);
+	arc.ri = (int32_t)((ir - 0.5f) * 65536.0f);
+	arc.inner = (ir > 0);
+
+	// Squared radius limits of visible and solid pixels
+	int64_t rov = arc.ro - lo, ros = arc.ro - hi;
+	int64_t riv = arc.ri + lo, ris = arc.ri + hi;
+	arc.rov2 = rov * rov;
+	arc.ros2 = (ros > 0) ? ros * ros : 0;
+	arc.riv2 = (arc.inner && riv > 0) ? riv * riv : -1;
+	arc.ris2 = (arc.inner && ris > 0) ? ris * ris : -1;
+
+	// Angle limits as unit vectors, 0 deg points up and angles grow clockwise
+	float sweep = end_angle - start_angle;
+	arc.full = (sweep >= 360) || (sweep <= -360);
+	while (sweep < 0) sweep += 360;
+	if (!arc.full && sweep == 0) return;
+	arc.wide = (sweep > 180);
+	arc.hard_start = !smooth_start;
+	arc.hard_end = !smooth_end;
+	sinCosDeg(start_angle, arc.sx, arc.sy);
+	sinCosDeg(end_angle, arc.ex, arc.ey);
+	arc.sy = -arc.sy;
+	arc.ey = -arc.ey;
+
+	// Clip rectangle in viewport coordinates
+	int32_t cx0 = __clip_x0 - __vp_x, cx1 = __clip_x1 - __vp_x;
+	int32_t cy0 = __clip_y0 - __vp_y, cy1 = __clip_y1 - __vp_y;
+
+	int32_t yt = (int32_t)((arc.cy - rov) >> 16);
+	int32_t yb = (int32_t)((arc.cy + rov) >> 16) + 1;
+
+	// With centre on pixel grid rows above centre are mirror of rows below,
+	// so full circles and rings are calculated only for lower half
+	int32_t yc = arc.cy >> 16;
+	bool mirror = arc.full && ((arc.cy & 0xFFFF) == 0);
+	int32_t ys = mirror ? yc : max(yt, cy0);
+	int32_t ye = mirror ? yb : min(yb, cy1);
+
+	for (int32_t yp = ys; yp <= ye; yp++) {
+		int32_t ya = (yp >= cy0 && yp <= cy1) ? yp : INT32_MIN;
+		int32_t ym = 2 * yc - yp;
+		if (!mirror || yp == yc || ym < cy0 || ym > cy1) ym = INT32_MIN;
+		if (ya == INT32_MIN && ym == INT32_MIN) continue;
+
+		int32_t dy = (yp << 16) - arc.cy;
+		int64_t dy2 = (int64_t)dy * dy;
+		if (dy2 >= arc.rov2) continue;
+
+		// Horizontal half widths where pixels become visible / solid
+		int32_t xov = fixedSqrt(arc.rov2 - dy2);
+		int32_t xos = (arc.ros2 > dy2) ? (int32_t)fixedSqrt(arc.ros2 - dy2) : -1;
+		int32_t xiv = (arc.riv2 > dy2) ? (int32_t)fixedSqrt(arc.riv2 - dy2) : -1;
+		int32_t xis = (arc.ris2 > dy2) ? (int32_t)fixedSqrt(arc.ris2 - dy2) : -1;
+
+		int32_t xl = max((arc.cx - xov) >> 16, cx0);
+		int32_t xr = min(((arc.cx + xov) >> 16) + 1, cx1);
+
+		// Solid part of row, inner edge of ring cuts out (hl, hr)
+		int32_t sl = (xos < 0) ? INT32_MAX : ((arc.cx - xos) >> 16) + 1;
+		int32_t sr = (xos < 0) ? INT32_MIN : (arc.cx + xos - 1) >> 16;
+		int32_t hl = (xis < 0) ? INT32_MAX : (arc.cx - xis - 1) >> 16;
+		int32_t hr = (xis < 0) ? INT32_MIN : ((arc.cx + xis) >> 16) + 1;
+
+		if (xiv < 0) {
+			fillArcSpan(ya, ym, xl, xr, sl, sr, hl, hr, dy, dy2, arc, fg_color, bg_color);
+			continue;
+		}
+
+		// Ring: left and right part of row, the hole between them is skipped
+		int32_t il = (arc.cx - xiv - 1) >> 16, ir = ((arc.cx + xiv) >> 16) + 1;
+		fillArcSpan(ya, ym, xl, min(xr, il), sl, sr, hl, hr, dy, dy2, arc, fg_color, bg_color);
+		fillArcSpan(ya, ym, max(xl, ir), xr, sl, sr, hl, hr, dy, dy2, arc, fg_color, bg_color);
+	}
 }
 
 /***************************************************************************************
-** Function name:           setFont
-** Description:             Set text cursor at x&y. Used for print/println function
+** Function name:           arcCoverage
+** Description:             Support function for fillArcHelperAA, pixel alpha (Q16)
 ***************************************************************************************/
-void TFTLIB_SPI::setFont(FontDef &Font){
-	__font = &Font;
+inline int32_t TFTLIB_SPI::arcCoverage(const ArcSDF &arc, int32_t dx, int32_t dy, int64_t dy2, bool solid) {
+	int32_t alpha = 1 << 16;
+
+	if (!solid) {
+		int64_t d2 = (int64_t)dx * dx + dy2;
+		if (d2 >= arc.rov2 || d2 <= arc.riv2) return 0;
+		if (d2 >= arc.ros2 || d2 <= arc.ris2) {
+			int32_t d = fixedSqrt(d2);
+			alpha = arc.ro - d;
+			if (arc.inner) alpha = min(alpha, d - arc.ri);
+		}
+	}
+
+	if (arc.full) return alpha;
+
+	// Distance to both arc end rays, +0.5 pixel for coverage. Hard rays take pixels with
+	// centre on start ray but not on end ray, so sectors sharing a ray never overlap
+	int64_t d1 = (int64_t)arc.sx * dy - (int64_t)arc.sy * dx;
+	int64_t d2 = (int64_t)dx * arc.ey - (int64_t)dy * arc.ex;
+	int32_t s1 = arc.hard_start ? ((d1 >= 0) ? (1 << 16) : -1) : (int32_t)(d1 >> 16) + (1 << 15);
+	int32_t s2 = arc.hard_end ? ((d2 > 0) ? (1 << 16) : -1) : (int32_t)(d2 >> 16) + (1 << 15);
+	int32_t sa = arc.wide ? max(s1, s2) : min(s1, s2);
+	return min(alpha, sa);
 }
 
 /***************************************************************************************
-** Function name:           writeChar
-** Description:             Print character at coords x&y with selected font
+** Function name:           fillArcSpan
+** Description:             Support function for fillArcHelperAA, builds visible runs of
+**                          one row in buffer and sends them to row ya and mirrored row ym
 ***************************************************************************************/
-void TFTLIB_SPI::writeChar(int32_t x, int32_t y, char ch) {
-	int32_t i=0, b=0, j=0;
-
-	if(x + __font->width > _width || y + __font->height > _height) return;
-	setWindow(x, y, x + __font->width - 1, y + __font->height - 1);
-
-	for (i = 0; i < __font->height; i++) {
-		b = __font->data[(ch - 32) * __font->height + i];
-		for (j = 0; j < __font->width; j++) {
-			if ((b << j) & 0x8000) {
-				__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_fg);
+inline void TFTLIB_SPI::fillArcSpan(int32_t ya, int32_t ym, int32_t xa, int32_t xb, int32_t sl, int32_t sr, int32_t hl, int32_t hr, int32_t dy, int64_t dy2, const ArcSDF &arc, uint16_t fg_color, uint16_t bg_color) {
+	const int32_t lo = (int32_t)(LoAlphaTheshold * 65536.0f);
+	const int32_t hi = (int32_t)(HiAlphaTheshold * 65536.0f);
+	uint16_t fg_sw = SWAP_UINT16(fg_color);
+	uint16_t *p = __buffer;
+	int32_t rs = INT32_MIN;
+
+	for (int32_t x = xa; x <= xb + 1; x++) {
+		int32_t alpha = 0;
+		if (x <= xb) {
+			bool solid = (x >= sl && x <= sr && (x <= hl || x >= hr));
+
+			// Solid interior of full circle goes straight in as one block
+			if (arc.full && solid) {
+				int32_t n = min(min(sr, xb), (x <= hl) ? hl : sr) - x + 1;
+				if (rs == INT32_MIN) rs = x;
+				fill_n(p, n, fg_sw);
+				p += n;
+				x += n - 1;
+				continue;
 			}
-			else {
-				__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_bg);
+			alpha = arcCoverage(arc, (x << 16) - arc.cx, dy, dy2, solid);
+		}
+
+		if (alpha <= lo) {
+			// End of run
+			if (rs != INT32_MIN) {
+				if (ya != INT32_MIN) pushLine(rs + __vp_x, ya + __vp_y, p - __buffer);
+				if (ym != INT32_MIN) pushLine(rs + __vp_x, ym + __vp_y, p - __buffer);
+				rs = INT32_MIN;
+				p = __buffer;
 			}
+			continue;
 		}
+
+		if (rs == INT32_MIN) rs = x;
+		if (alpha > hi) *p++ = fg_sw;
+		else *p++ = SWAP_UINT16(alphaBlend((uint8_t)((min(alpha, 0xFFFF) * 255) >> 16), fg_color, bg_color));
 	}
-	writeData_DMA((uint8_t*)__buffer, __font->width * __font->height * 2);
 }
 
 /***************************************************************************************
-** Function name:           writeString
-** Description:             Print string at coords x&y with selected font
+** Function name:           coverEdge
+** Description:             Support function for fillPolyHelperAA, adds signed area of edge
+**                          part between yt and yb to coverage row (Q16, 1.0 = full pixel)
 ***************************************************************************************/
-void TFTLIB_SPI::writeString(int32_t x, int32_t y, char *ch) {
+inline void TFTLIB_SPI::coverEdge(const PolyEdge &e, int32_t yt, int32_t yb, int32_t cx0, int32_t cx1, int32_t &xmin, int32_t &xmax) {
+	int32_t dy = yb - yt;
+	if (dy <= 0) return;
+
+	int32_t xa = e.x0 + (int32_t)(((yt - e.y0) * e.dxdy) >> 16);
+	int32_t xb = e.x0 + (int32_t)(((yb - e.y0) * e.dxdy) >> 16);
+	int32_t d  = dy * e.dir;
+	int32_t x0 = min(xa, xb), x1 = max(xa, xb);
+	int32_t x0i = x0 >> 16, x1i = (x1 + 0xFFFF) >> 16;
+
+	// Cells left of clip feed the first column, cells right of clip can not affect it
+	auto add = [&](int32_t x, int32_t v) {
+		if (x > cx1) return;
+		if (x < cx0) x = cx0;
+		__cover[x - cx0] += v;
+		if (x < xmin) xmin = x;
+		if (x > xmax) xmax = x;
+	};
+
+	if (x1i <= x0i + 1) {
+		// Edge stays inside one column, split by mean x
+		int32_t xmf = ((xa + xb) >> 1) - (x0i << 16);
+		int32_t dm  = (int32_t)(((int64_t)d * xmf) >> 16);
+		add(x0i, d - dm);
+		add(x0i + 1, dm);
+		return;
+	}
 
-	while(*ch){
-		if(strcmp(reinterpret_cast<const char*>(&ch), " ") == 0){
-			x += __font->width;
-			ch++;
-			return;
-		}
+	// Edge crosses several columns, triangles at both ends and equal steps between
+	int32_t ds  = e.dydx * e.dir;
+	int32_t x0f = 0x10000 - (x0 - (x0i << 16));
+	int32_t x1f = x1 - (x1i << 16) + 0x10000;
+	int32_t a0  = (int32_t)(((((int64_t)x0f * x0f) >> 16) * ds) >> 17);
+	int32_t am  = (int32_t)(((((int64_t)x1f * x1f) >> 16) * ds) >> 17);
 
-		else {
-			if(x + __font->width > _width || y + __font->height > _height) return;
-			int32_t i=0, b=0, j=0;
-			setWindow(x, y, x + __font->width - 1, y + __font->height - 1);
-
-			for (i = 0; i < __font->height; i++) {
-				b = __font->data[(*ch - 32) * __font->height + i];
-				for (j = 0; j < __font->width; j++) {
-					if ((b << j) & 0x8000) {
-						__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_fg);
-					}
-					else {
-						__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_bg);
-					}
-				}
-			}
-			writeData_DMA((uint8_t*)__buffer, __font->width * __font->height * 2);
-			x += __font->width;
-			ch++;
-		}
+	add(x0i, a0);
+	if (x1i == x0i + 2) {
+		add(x0i + 1, d - a0 - am);
+	}
+	else {
+		int32_t a1 = (int32_t)(((int64_t)ds * (x0f + 0x8000)) >> 16);
+		add(x0i + 1, a1 - a0);
+		for (int32_t x = x0i + 2; x < x1i - 1; x++) add(x, ds);
+		int32_t a2 = a1 + (x1i - x0i - 3) * ds;
+		add(x1i - 1, d - a2 - am);
 	}
+	add(x1i, am);
 }
 
 /***************************************************************************************
-** Function name:           print
-** Description:             Print string with selected font
+** Function name:           fillPolyHelperAA
+** Description:             Anti-aliased scanline rasterizer for polygons of one or more
+**                          contours, ends[] holds index past last point of each contour.
+**                          First skip bytes (multiple of 8) of scratch memory are held by
+**                          caller, points may be among them
 ***************************************************************************************/
-void TFTLIB_SPI::print(char *ch) {
-	int32_t i=0, b=0, j=0;
+void TFTLIB_SPI::fillPolyHelperAA(const PointF *points, const uint16_t *ends, uint16_t contours, uint16_t fg_color, FILL_RULE rule, uint16_t bg_color, uint32_t skip) {
+	finish();
+	if (contours == 0 || ends[contours - 1] < 3) return;
+
+	const int32_t lo = (int32_t)(LoAlphaTheshold * 65536.0f);
+	const int32_t hi = (int32_t)(HiAlphaTheshold * 65536.0f);
+	const float lim = 8192.0f;
+
+	// Coverage row is kept between calls, edges and active edges are in scratch memory after
+	// the part held by caller. Points held there move along when scratch memory grows
+	if (__cover == nullptr) __cover = new (nothrow) int32_t[max(_display_width, _display_height) + 2]();
+	uint32_t at = skip ? (uint32_t)((const uint8_t*)points - (const uint8_t*)__scratch) : 0;
+	uint8_t *mem = (uint8_t*)scratch(skip + ends[contours - 1] * (sizeof(PolyEdge) + sizeof(uint16_t)));
+	if (__cover == nullptr || mem == nullptr) return;
+	if (skip) points = (const PointF*)(mem + at);
+	PolyEdge *edges = (PolyEdge*)(mem + skip);
+	uint16_t *act = (uint16_t*)(edges + ends[contours - 1]);
+
+	// Build edge table in screen space, pixel centres at +0.5
+	uint16_t ne = 0;
+	int32_t ymin = INT32_MAX, ymax = INT32_MIN;
+
+	for (uint16_t c = 0, first = 0; c < contours; first = ends[c++]) {
+		for (uint16_t i = first; i < ends[c]; i++) {
+			const PointF &p = points[i];
+			const PointF &q = points[(i + 1 < ends[c]) ? i + 1 : first];
+			int32_t px = (int32_t)(max(-lim, min(lim, p.x + __vp_x + 0.5f)) * 65536.0f);
+			int32_t py = (int32_t)(max(-lim, min(lim, p.y + __vp_y + 0.5f)) * 65536.0f);
+			int32_t qx = (int32_t)(max(-lim, min(lim, q.x + __vp_x + 0.5f)) * 65536.0f);
+			int32_t qy = (int32_t)(max(-lim, min(lim, q.y + __vp_y + 0.5f)) * 65536.0f);
+			if (py == qy) continue;
+
+			PolyEdge &e = edges[ne++];
+			e.dir = 1;
+			if (py > qy) {
+				swap_coord(px, qx);
+				swap_coord(py, qy);
+				e.dir = -1;
+			}
+			e.x0 = px;
+			e.y0 = py;
+			e.y1 = qy;
+			e.dxdy = ((int64_t)(qx - px) << 16) / (qy - py);
+			int64_t adx = (e.dxdy < 0) ? -e.dxdy : e.dxdy;
+			e.dydx = adx ? (int32_t)min((int64_t)INT32_MAX, ((int64_t)1 << 32) / adx) : INT32_MAX;
+			ymin = min(ymin, py);
+			ymax = max(ymax, qy);
+		}
+	}
 
-	while(*ch){
-		if(strcmp(reinterpret_cast<const char*>(&ch), " ") == 0){
-			_posx += __font->width;
-			ch++;
-			return;
+	sort(edges, edges + ne, [](const PolyEdge &a, const PolyEdge &b) { return a.y0 < b.y0; });
+
+	int32_t cx0 = __clip_x0, cx1 = __clip_x1;
+	int32_t ya = max(ymin >> 16, __clip_y0);
+	int32_t yb = min((ymax + 0xFFFF) >> 16, __clip_y1 + 1);
+
+	uint16_t fg_sw = SWAP_UINT16(fg_color);
+	uint16_t na = 0, next = 0;
+
+	for (int32_t y = ya; y < yb; y++) {
+		int32_t rt = y << 16, rb = rt + 0x10000;
+
+		// Update active edge table
+		while (next < ne && edges[next].y0 < rb) {
+			if (edges[next].y1 > rt) act[na++] = next;
+			next++;
 		}
 
-		setWindow(_posx, _posy, _posx + __font->width - 1, _posy + __font->height - 1);
-		for (i = 0; i < __font->height; i++) {
-			b = __font->data[(*ch - 32) * __font->height + i];
-			for (j = 0; j < __font->width; j++) {
-				if ((b << j) & 0x8000) {
-					__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_fg);
+		int32_t xmin = INT32_MAX, xmax = INT32_MIN;
+		uint16_t k = 0;
+		for (uint16_t i = 0; i < na; i++) {
+			const PolyEdge &e = edges[act[i]];
+			if (e.y1 <= rt) continue;
+			act[k++] = act[i];
+			coverEdge(e, max(rt, e.y0), min(rb, e.y1), cx0, cx1, xmin, xmax);
+		}
+		na = k;
+		if (xmin > xmax) continue;
+
+		// Accumulate coverage along the row and send visible runs
+		uint16_t *p = __buffer;
+		int32_t rs = INT32_MIN;
+		int32_t acc = 0;
+
+		for (int32_t x = xmin; x <= cx1 + 1; x++) {
+			int32_t alpha = 0;
+			if (x <= cx1) {
+				if (x <= xmax) {
+					acc += __cover[x - cx0];
+					__cover[x - cx0] = 0;
 				}
-				else {
-					__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_bg);
+				else if (acc == 0) x = cx1;
+
+				alpha = (acc < 0) ? -acc : acc;
+				if (rule == FILL_RULE::EVENODD) {
+					alpha &= 0x1FFFF;
+					if (alpha > 0x10000) alpha = 0x20000 - alpha;
 				}
 			}
+
+			if (alpha <= lo) {
+				if (rs != INT32_MIN) {
+					pushLine(rs, y, p - __buffer);
+					rs = INT32_MIN;
+					p = __buffer;
+				}
+				continue;
+			}
+
+			if (rs == INT32_MIN) rs = x;
+			if (alpha > hi) {
+				// Solid interior runs until next edge cell
+				int32_t n = 1;
+				while (x + n <= cx1 && (x + n > xmax || __cover[x + n - cx0] == 0)) n++;
+				fill_n(p, n, fg_sw);
+				p += n;
+				x += n - 1;
+			}
+			else *p++ = SWAP_UINT16(alphaBlend((uint8_t)((min(alpha, 0xFFFF) * 255) >> 16), fg_color, bg_color));
 		}
-		writeData_DMA((uint8_t*)__buffer, __font->width * __font->height * 2);
-		_posx += __font->width;
-		ch++;
 	}
 }
 
 /***************************************************************************************
-** Function name:           println
-** Description:             Print string with selected font
+** Function name:           fillPolygonAA
+** Description:             Draw anti-aliased filled polygon, convex or concave
 ***************************************************************************************/
-void TFTLIB_SPI::println(uint8_t *ch)
-{
-	int32_t cur_x = _posx;
-	int32_t i=0, b=0, j=0;
+void TFTLIB_SPI::fillPolygonAA(const PointF *points, uint16_t n, uint16_t color, FILL_RULE rule, uint16_t bg_color) {
+	fillPolyHelperAA(points, &n, 1, color, rule, bg_color);
+}
 
-	while(*ch){
-		if(*ch < 32 || *ch > 128 || *ch == 0) return;
-		if(cur_x + __font->width > _width) setCursor(0, _posy + __font->height);
+/***************************************************************************************
+** Function name:           fillPathAA
+** Description:             Draw anti-aliased filled path of several closed contours
+***************************************************************************************/
+void TFTLIB_SPI::fillPathAA(const PointF *points, const uint16_t *ends, uint16_t contours, uint16_t color, FILL_RULE rule, uint16_t bg_color) {
+	fillPolyHelperAA(points, ends, contours, color, rule, bg_color);
+}
+
+/***************************************************************************************
+** Function name:           drawPolyline
+** Description:             Draw anti-aliased thick polyline with joins and caps. Whole stroke
+**                          is one outline (left side forward, right side back) that goes
+**                          through the vertex on the inner side of every join. Its nonzero
+**                          winding is the union of segments, joins and caps, so the stroke
+**                          is rasterized in one pass and each pixel is written once
+***************************************************************************************/
+void TFTLIB_SPI::drawPolyline(const PointF *points, uint16_t n, float width, LINE_JOIN join, LINE_CAP cap, uint16_t color, uint16_t bg_color) {
+	if (n == 0 || !(width > 0.0f)) return;
+
+	const float hw = width * 0.5f;
 
-		setWindow(cur_x, _posy, cur_x + __font->width - 1, _posy + __font->height - 1);
+	// Vertices, directions and outline are held at start of scratch memory
+	PointF *v = (PointF*)scratch((2 * n + 1) * sizeof(PointF));
+	if (v == nullptr) return;
 
-		for (i = 0; i < __font->height; i++) {
-			b = __font->data[(*ch - 32) * __font->height + i];
-			for (j = 0; j < __font->width; j++) {
-				if ((b << j) & 0x8000) {
-					__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_fg);
+	// Drop repeated vertices, single point is drawn as zero length segment
+	uint16_t m = 0;
+	for (uint16_t i = 0; i < n; i++) {
+		if (m == 0 || fabsf(points[i].x - v[m - 1].x) + fabsf(points[i].y - v[m - 1].y) > 0.001f) v[m++] = points[i];
+	}
+	if (m == 1) v[m++] = v[0];
+
+	uint16_t segs = m - 1;
+	PointF *d = v + n + 1;
+	for (uint16_t i = 0; i < segs; i++) {
+		float dx = v[i + 1].x - v[i].x, dy = v[i + 1].y - v[i].y;
+		float len = sqrtf(dx * dx + dy * dy);
+		d[i] = (len > 0.0f) ? PointF{ dx / len, dy / len } : PointF{ 1.0f, 0.0f };
+	}
+
+	// Arc step keeps chord error under 1/8 pixel
+	float step = 2.0f * acosf(max(0.0f, 1.0f - 0.125f / hw));
+	step = max(step, (float)M_PI / 64.0f);
+	uint32_t arc = (uint32_t)ceilf((float)M_PI / step) + 2;
+
+	uint32_t size = 2 * (2 * segs + (segs - 1) * arc + arc);
+	if (size > 0xFFFF) return;
+
+	uint32_t held = (2 * n + 1 + size) * sizeof(PointF);
+	PointF *o = (PointF*)scratch(held);
+	if (o == nullptr) return;
+	v = o;
+	d = v + n + 1;
+	o = d + n;
+	uint16_t k = 0;
+
+	auto offset = [&](const PointF &p, const PointF &n, float a, float b) {
+		o[k++] = { p.x + n.x * a + n.y * b, p.y + n.y * a - n.x * b };
+	};
+
+	// Points strictly between start normal nx,ny and the end of sweep around c
+	auto arcTo = [&](const PointF &c, float nx, float ny, float sweep) {
+		int32_t cnt = (int32_t)ceilf(fabsf(sweep) / step);
+		float cs = cosf(sweep / cnt), sn = sinf(sweep / cnt);
+		for (int32_t i = 1; i < cnt; i++) {
+			float t = nx * cs - ny * sn;
+			ny = nx * sn + ny * cs;
+			nx = t;
+			o[k++] = { c.x + nx * hw, c.y + ny * hw };
+		}
+	};
+
+	// Left side of path walked in one direction, then cap at its last vertex
+	auto side = [&](bool reverse) {
+		for (uint16_t j = 0; j < segs; j++) {
+			uint16_t i = reverse ? segs - 1 - j : j;
+			const PointF &a = v[reverse ? i + 1 : i], &b = v[reverse ? i : i + 1];
+			float dx = reverse ? -d[i].x : d[i].x, dy = reverse ? -d[i].y : d[i].y;
+			PointF nl = { -dy, dx };
+
+			offset(a, nl, hw, 0.0f);
+			offset(b, nl, hw, 0.0f);
+
+			if (j + 1 < segs) {
+				uint16_t ni = reverse ? i - 1 : i + 1;
+				float ex = reverse ? -d[ni].x : d[ni].x, ey = reverse ? -d[ni].y : d[ni].y;
+				float cross = dx * ey - dy * ex, dot = dx * ex + dy * ey;
+
+				if (cross > 0.0f || (cross == 0.0f && dot > 0.0f)) {
+					// Inner side, go through vertex
+					if (cross > 0.0f) o[k++] = b;
 				}
-				else {
-					__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_bg);
+				else if (join == LINE_JOIN::ROUND) {
+					arcTo(b, nl.x, nl.y, -fabsf(atan2f(cross, dot)));
+				}
+				else if (join == LINE_JOIN::MITER) {
+					float mx = nl.x - ey, my = nl.y + ex;
+					float len2 = mx * mx + my * my;
+					if (len2 * MiterLimit * MiterLimit >= 4.0f) o[k++] = { b.x + mx * 2.0f * hw / len2, b.y + my * 2.0f * hw / len2 };
 				}
 			}
+			else if (cap == LINE_CAP::ROUND) {
+				arcTo(b, nl.x, nl.y, -(float)M_PI);
+			}
+			else if (cap == LINE_CAP::SQUARE) {
+				offset(b, nl, hw, hw);
+				offset(b, nl, -hw, hw);
+			}
 		}
-		writeData_DMA((uint8_t*)__buffer, __font->width * __font->height * 2);
-		cur_x += __font->width;
-		ch++;
-	}
+	};
 
-	if(_posy + __font->height > _height)
-		_posy = 0;
-	else
-		_posy += __font->height;
-}
+	side(false);
+	side(true);
 
-void TFTLIB_SPI::println(char *ch)
-{
-	int32_t cur_x = _posx;
-	int32_t i=0, b=0, j=0;
+	fillPolyHelperAA(o, &k, 1, color, FILL_RULE::NONZERO, bg_color, held);
+}
 
-	while(*ch){
-		if(*ch < 32 || *ch > 128 || *ch == 0) return;
-		if(cur_x + __font->width > _width) setCursor(0, _posy + __font->height);
+/***************************************************************************************
+** Function name:           bezierSegments
+** Description:             Number of line segments keeping flattened Bezier curve within
+**                          tolerance, chord error is at most max|B''| / (8 * n^2)
+***************************************************************************************/
+uint16_t TFTLIB_SPI::bezierSegments(const PointF *ctrl, uint8_t degree, float tolerance) {
+	if (degree < 2) return 1;
+
+	float m = 0.0f;
+	for (uint8_t i = 0; i + 2 <= degree; i++) {
+		float dx = ctrl[i].x - 2.0f * ctrl[i + 1].x + ctrl[i + 2].x;
+		float dy = ctrl[i].y - 2.0f * ctrl[i + 1].y + ctrl[i + 2].y;
+		m = max(m, sqrtf(dx * dx + dy * dy));
+	}
+	m *= degree * (degree - 1);
 
-		setWindow(cur_x, _posy, cur_x + __font->width - 1, _posy + __font->height - 1);
+	float n = ceilf(sqrtf(m / (8.0f * max(tolerance, 0.01f))));
+	return (uint16_t)max(1.0f, min(n, (float)BezierMaxSegments));
+}
 
-		for (i = 0; i < __font->height; i++) {
-			b = __font->data[(*ch - 32) * __font->height + i];
-			for (j = 0; j < __font->width; j++) {
-				if ((b << j) & 0x8000) {
-					__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_fg);
-				}
-				else {
-					__buffer[(i*__font->width) + j] = SWAP_UINT16(__text_bg);
-				}
-			}
-		}
-		writeData_DMA((uint8_t*)__buffer, __font->width * __font->height * 2);
-		cur_x += __font->width;
-		ch++;
+/***************************************************************************************
+** Function name:           flattenBezier
+** Description:             Write n points of line (degree 1), quadratic or cubic Bezier by
+**                          forward differencing, start point is not written
+***************************************************************************************/
+void TFTLIB_SPI::flattenBezier(const PointF *ctrl, uint8_t degree, uint16_t n, PointF *out) {
+	const PointF &p0 = ctrl[0], &p1 = ctrl[1];
+
+	// Power basis a t^3 + b t^2 + c t + p0
+	float ax = 0.0f, ay = 0.0f, bx = 0.0f, by = 0.0f, cx = p1.x - p0.x, cy = p1.y - p0.y;
+	if (degree == 2) {
+		const PointF &p2 = ctrl[2];
+		bx = p0.x - 2.0f * p1.x + p2.x;
+		by = p0.y - 2.0f * p1.y + p2.y;
+		cx *= 2.0f;
+		cy *= 2.0f;
+	}
+	else if (degree == 3) {
+		const PointF &p2 = ctrl[2], &p3 = ctrl[3];
+		ax = p3.x - p0.x + 3.0f * (p1.x - p2.x);
+		ay = p3.y - p0.y + 3.0f * (p1.y - p2.y);
+		bx = 3.0f * (p0.x - 2.0f * p1.x + p2.x);
+		by = 3.0f * (p0.y - 2.0f * p1.y + p2.y);
+		cx *= 3.0f;
+		cy *= 3.0f;
 	}
 
-	if(_posy + __font->height > _height)
-		_posy = 0;
-	else
-		_posy += __font->height;
+	float h = 1.0f / n, h2 = h * h, h3 = h2 * h;
+	float fx = p0.x, fy = p0.y;
+	float dx = ax * h3 + bx * h2 + cx * h, dy = ay * h3 + by * h2 + cy * h;
+	float ddx = 6.0f * ax * h3 + 2.0f * bx * h2, ddy = 6.0f * ay * h3 + 2.0f * by * h2;
+	float dddx = 6.0f * ax * h3, dddy = 6.0f * ay * h3;
+
+	for (uint16_t i = 0; i + 1 < n; i++) {
+		fx += dx;
+		fy += dy;
+		dx += ddx;
+		dy += ddy;
+		ddx += dddx;
+		ddy += dddy;
+		out[i] = { fx, fy };
+	}
+	out[n - 1] = ctrl[degree];
 }
 
-/***************************************************************************************************************************
-** 												Test functions for display benchmark
-****************************************************************************************************************************/
-uint32_t TFTLIB_SPI::testFillScreen() {
-	unsigned long start = HAL_GetTick();
-	fillScreen(BLACK);
-	fillScreen(RED);
-	fillScreen(GREEN);
-	fillScreen(BLUE);
-	fillScreen(BLACK);
-	return HAL_GetTick() - start;
+/***************************************************************************************
+** Function name:           flattenShape
+** Description:             Flatten closed shape of line and curve segments to polygon.
+**                          points[] is start point followed by degrees[i] points of every
+**                          segment, last point closes to start. Result is at start of
+**                          scratch memory, nullptr when too long or out of memory
+***************************************************************************************/
+PointF *TFTLIB_SPI::flattenShape(const PointF *points, const uint8_t *degrees, uint16_t segments, float tolerance, uint16_t &n) {
+	uint32_t total = 0;
+	const PointF *c = points;
+	for (uint16_t i = 0; i < segments; i++) {
+		uint8_t deg = max((uint8_t)1, min(degrees[i], (uint8_t)3));
+		total += bezierSegments(c, deg, tolerance);
+		c += deg;
+	}
+
+	n = 0;
+	if (total > 0xFFFF) return nullptr;
+
+	PointF *poly = (PointF*)scratch(total * sizeof(PointF));
+	if (poly == nullptr) return nullptr;
+	c = points;
+	for (uint16_t i = 0; i < segments; i++) {
+		uint8_t deg = max((uint8_t)1, min(degrees[i], (uint8_t)3));
+		uint16_t k = bezierSegments(c, deg, tolerance);
+		flattenBezier(c, deg, k, poly + n);
+		n += k;
+		c += deg;
+	}
+	return poly;
 }
 
-uint32_t TFTLIB_SPI::testText() {
-	fillScreen(BLACK);
+/***************************************************************************************
+** Function name:           drawBezier
+** Description:             Draw quadratic (degree 2, 3 points) or cubic (degree 3, 4 points)
+**                          Bezier curve as one pixel wide line
+***************************************************************************************/
+void TFTLIB_SPI::drawBezier(const PointF *ctrl, uint8_t degree, uint16_t color, float tolerance) {
+	if (degree < 1 || degree > 3) return;
+
+	uint16_t n = bezierSegments(ctrl, degree, tolerance);
+	PointF pts[BezierMaxSegments];
+	flattenBezier(ctrl, degree, n, pts);
+
+	int32_t x = lroundf(ctrl[0].x), y = lroundf(ctrl[0].y);
+	for (uint16_t i = 0; i < n; i++) {
+		int32_t nx = lroundf(pts[i].x), ny = lroundf(pts[i].y);
+		if (nx != x || ny != y || i == 0) drawLine(x, y, nx, ny, color);
+		x = nx;
+		y = ny;
+	}
+}
 
-	unsigned long start = HAL_GetTick();
-	setFont(Font_7x10);
-	setTextColor(WHITE, BLACK);
-	writeString(0, 0, (char*)"Hello World!");
+/***************************************************************************************
+** Function name:           drawBezierAA
+** Description:             Draw anti-aliased quadratic or cubic Bezier curve of given width
+**                          with round joins and caps in one pass
+***************************************************************************************/
+void TFTLIB_SPI::drawBezierAA(const PointF *ctrl, uint8_t degree, float width, uint16_t color, uint16_t bg_color, float tolerance) {
+	if (degree < 1 || degree > 3) return;
 
-	setFont(Font_11x18);
-	setTextColor(YELLOW, BLACK);
-	writeString(0, 10, (char*)"1234.56");
+	uint16_t n = bezierSegments(ctrl, degree, tolerance);
+	PointF pts[BezierMaxSegments + 1];
+	pts[0] = ctrl[0];
+	flattenBezier(ctrl, degree, n, pts + 1);
 
-	setTextColor(RED, BLACK);
-	writeString(0, 28, (char*)"0xDEADBEEF");
+	drawPolyline(pts, n + 1, width, LINE_JOIN::ROUND, LINE_CAP::ROUND, color, bg_color);
+}
 
-	setFont(Font_16x26);
-	setTextColor(GREEN, BLACK);
-	writeString(0, 64, (char*)"Groop");
+/***************************************************************************************
+** Function name:           fillBezierShape
+** Description:             Fill closed shape of line (degree 1), quadratic and cubic segments
+***************************************************************************************/
+void TFTLIB_SPI::fillBezierShape(const PointF *points, const uint8_t *degrees, uint16_t segments, uint16_t color, float tolerance) {
+	uint16_t n;
+	PointF *poly = flattenShape(points, degrees, segments, tolerance, n);
+	if (poly == nullptr) return;
+
+	// Rounded in place, every point is read before its slot is overwritten
+	Point *ip = (Point*)poly;
+	for (uint16_t i = 0; i < n; i++) {
+		PointF f = poly[i];
+		ip[i] = { (int16_t)lroundf(f.x), (int16_t)lroundf(f.y) };
+	}
+	fillPolyHelper(ip, n, color, FILL_RULE::NONZERO, (n * sizeof(Point) + 7) & ~7u);
+}
 
-	setFont(Font_11x18);
-	setTextColor(MAGENTA, BLACK);
-	writeString(0, 90, (char*)"I implore thee,");
+/***************************************************************************************
+** Function name:           fillBezierShapeAA
+** Description:             Fill anti-aliased closed shape of line, quadratic and cubic segments
+***************************************************************************************/
+void TFTLIB_SPI::fillBezierShapeAA(const PointF *points, const uint8_t *degrees, uint16_t segments, uint16_t color, uint16_t bg_color, float tolerance) {
+	uint16_t n;
+	PointF *poly = flattenShape(points, degrees, segments, tolerance, n);
+	if (poly == nullptr) return;
 
-	setFont(Font_7x10);
-	setTextColor(LGRAY, BLACK);
-	writeString(0, 108, (char*)"And hooptiously drangle me");
-	writeString(0, 118, (char*)"with crinkly bindlewurdles,");
-	writeString(0, 128, (char*)"Or I will rend thee");
-	writeString(0, 138, (char*)"in the gobberwarts");
-	writeString(0, 148, (char*)"with my blurglecruncheon,");
-	writeString(0, 158, (char*)"see if I don't!");
-	return HAL_GetTick() - start;
+	fillPolyHelperAA(poly, &n, 1, color, FILL_RULE::NONZERO, bg_color, n * sizeof(PointF));
 }
 
-uint32_t TFTLIB_SPI::testLines(uint16_t color) {
-	unsigned long start, t;
-	int           x1, y1, x2, y2,
-				w = _width,
-				h = _height;
+/***************************************************************************************
+** Function name:           gradientSetup
+** Description:             Build colour ramp and fixed point steps of gradient in screen space
+***************************************************************************************/
+void TFTLIB_SPI::gradientSetup(const Gradient &g, GradientDDA &d) {
+	d.radial = (g.type == GRADIENT::RADIAL);
+	d.dither = g.dither;
+
+	// Ramp of 256 colours between stops, RGB888 for dithering or swapped RGB565
+	for (int32_t i = 0, s = 0; i < 256; i++) {
+		while (s + 1 < g.count && g.stops[s + 1].pos <= i) s++;
+		const GradientStop &a = g.stops[s];
+		const GradientStop &b = g.stops[(s + 1 < g.count) ? s + 1 : s];
+		int32_t f = (i <= a.pos || b.pos <= a.pos) ? 0 : ((i - a.pos) << 8) / (b.pos - a.pos);
+
+		int32_t ar = ((a.color >> 8) & 0xF8) | (a.color >> 13), br = ((b.color >> 8) & 0xF8) | (b.color >> 13);
+		int32_t ag = ((a.color >> 3) & 0xFC) | ((a.color >> 9) & 0x03), bg = ((b.color >> 3) & 0xFC) | ((b.color >> 9) & 0x03);
+		int32_t ab = ((a.color << 3) & 0xF8) | ((a.color >> 2) & 0x07), bb = ((b.color << 3) & 0xF8) | ((b.color >> 2) & 0x07);
+		uint32_t r = ar + (((br - ar) * f) >> 8);
+		uint32_t gg = ag + (((bg - ag) * f) >> 8);
+		uint32_t bl = ab + (((bb - ab) * f) >> 8);
+
+		if (d.dither) d.lut[i] = (r << 16) | (gg << 8) | bl;
+		else d.lut[i] = SWAP_UINT16(((min(r + 4, 255U) >> 3) << 11) | ((min(gg + 2, 255U) >> 2) << 5) | (min(bl + 4, 255U) >> 3));
+	}
 
-	fillScreen(BLACK);
+	if (d.radial) {
+		// Q8 centre and Q8 ramp index per pixel
+		d.cx = (int32_t)((g.x0 + __vp_x) * 256.0f);
+		d.cy = (int32_t)((g.y0 + __vp_y) * 256.0f);
+		d.k  = (int32_t)(255.0f * 256.0f / max(g.r, 0.5f) + 0.5f);
+		return;
+	}
 
-	x1 = y1 = 0;
-	y2    = h - 1;
-	start = HAL_GetTick();
-	for (x2 = 0; x2 < w; x2 += 6) drawLine(x1, y1, x2, y2, color);
-	x2    = w - 1;
-	for (y2 = 0; y2 < h; y2 += 6) drawLine(x1, y1, x2, y2, color);
-	t     = HAL_GetTick() - start; // fillScreen doesn't count against timing
+	// Q16 ramp index at screen origin and per column / row
+	float dx = g.x1 - g.x0, dy = g.y1 - g.y0;
+	float l2 = dx * dx + dy * dy;
+	if (l2 < 1e-6f) {
+		d.t0 = d.tx = d.ty = 0;
+		return;
+	}
+	float sc = 255.0f * 65536.0f / l2;
+	d.tx = (int64_t)(dx * sc);
+	d.ty = (int64_t)(dy * sc);
+	d.t0 = -(int64_t)(((g.x0 + __vp_x) * dx + (g.y0 + __vp_y) * dy) * sc);
+}
 
-	fillScreen(BLACK);
+/***************************************************************************************
+** Function name:           gradientSpan
+** Description:             Generate w gradient pixels of screen row y into p, swapped RGB565
+***************************************************************************************/
+inline void TFTLIB_SPI::gradientSpan(const GradientDDA &d, int32_t x, int32_t y, int32_t w, uint16_t *p) {
+	int64_t t = 0, ts = 0, dd = 0, d2 = 0;
+	const int64_t dmax = (int64_t)(255 << 8) * (255 << 8);
+
+	if (d.radial) {
+		// Squared distance in Q8 ramp units, stepped by first and second difference
+		int64_t u = ((int64_t)((x << 8) - d.cx) * d.k) >> 8;
+		int64_t v = ((int64_t)((y << 8) - d.cy) * d.k) >> 8;
+		t  = u * u + v * v;
+		dd = 2 * u * (d.k) + (int64_t)d.k * d.k;
+		d2 = 2 * (int64_t)d.k * d.k;
+	}
+	else {
+		t  = d.t0 + x * d.tx + y * d.ty;
+		ts = d.tx;
+	}
 
-	x1    = w - 1;
-	y1    = 0;
-	y2    = h - 1;
-	start = HAL_GetTick();
-	for (x2 = 0; x2 < w; x2 += 6) drawLine(x1, y1, x2, y2, color);
-	x2    = 0;
-	for (y2 = 0; y2 < h; y2 += 6) drawLine(x1, y1, x2, y2, color);
-	t    += HAL_GetTick() - start;
+	const uint8_t *bayer = &Bayer4x4[(y & 3) << 2];
+	for (int32_t i = 0; i < w; i++) {
+		int32_t idx;
+		if (d.radial) {
+			idx = (t >= dmax) ? 255 : (int32_t)(fixedSqrt(t) >> 8);
+			t  += dd;
+			dd += d2;
+		}
+		else {
+			idx = (t <= 0) ? 0 : (t >= (255 << 16)) ? 255 : (int32_t)(t >> 16);
+			t  += ts;
+		}
 
-	fillScreen(BLACK);
+		if (!d.dither) {
+			*p++ = (uint16_t)d.lut[idx];
+			continue;
+		}
 
-	x1    = 0;
-	y1    = h - 1;
-	y2    = 0;
-	start = HAL_GetTick();
-	for (x2 = 0; x2 < w; x2 += 6) drawLine(x1, y1, x2, y2, color);
-	x2    = w - 1;
-	for (y2 = 0; y2 < h; y2 += 6) drawLine(x1, y1, x2, y2, color);
-	t    += HAL_GetTick() - start;
+		// Ordered dither, threshold 0-7 for 5 bit and 0-3 for 6 bit channels
+		uint32_t c = d.lut[idx], b = bayer[(x + i) & 3];
+		uint32_t r  = min((c >> 16) + (b >> 1), 255U) >> 3;
+		uint32_t gg = min(((c >> 8) & 0xFF) + (b >> 2), 255U) >> 2;
+		uint32_t bl = min((c & 0xFF) + (b >> 1), 255U) >> 3;
+		*p++ = SWAP_UINT16((r << 11) | (gg << 5) | bl);
+	}
+}
 
-	fillScreen(BLACK);
+/***************************************************************************************
+** Function name:           fillRectGradient
+** Description:             Draw a rectangle filled with gradient, rows are generated in one
+**                          half of buffer while the other half is sent by DMA
+***************************************************************************************/
+void TFTLIB_SPI::fillRectGradient(int32_t x, int32_t y, int32_t w, int32_t h, const Gradient &g) {
+	if(g.count == 0 || !clipRect(x, y, w, h)) return;
 
-	x1    = w - 1;
-	y1    = h - 1;
-	y2    = 0;
-	start = HAL_GetTick();
-	for (x2 = 0; x2 < w; x2 += 6) drawLine(x1, y1, x2, y2, color);
-	x2    = 0;
-	for (y2 = 0; y2 < h; y2 += 6) drawLine(x1, y1, x2, y2, color);
+	GradientDDA *d = (GradientDDA*)scratch(sizeof(GradientDDA));
+	if (d == nullptr) return;
+	gradientSetup(g, *d);
 
-	return HAL_GetTick() - start;
+	int32_t half = __buffer_size / 2;
+	int32_t rows = max(half / w, (int32_t)1);
+	uint16_t *buf[2] = { __buffer, __buffer + half };
+	uint8_t sel = 0;
+
+	setWindow(x, y, x + w - 1, y + h - 1);
+
+	CS_L();
+	DC_PORT->BSRR = (uint32_t)DC_PIN;
+
+	for (int32_t yy = y; yy < y + h; ) {
+		int32_t n = min(rows, y + h - yy);
+		for (int32_t i = 0; i < n; i++) gradientSpan(*d, x, yy + i, w, buf[sel] + i * w);
+
+		while (_bus->State != HAL_SPI_STATE_READY);
+		HAL_SPI_Transmit_DMA(_bus, (uint8_t*)buf[sel], n * w * 2);
+		yy += n;
+		sel ^= 1;
+	}
+	while (_bus->State != HAL_SPI_STATE_READY);
+
+	CS_H();
 }
 
-uint32_t TFTLIB_SPI::testFastLines(uint16_t color1, uint16_t color2) {
-	unsigned long start;
-	int           x, y, w = _width, h = _height;
+/***************************************************************************************
+** Function name:           fillRoundRectGradient
+** Description:             Draw a rectangle with rounded corners filled with gradient
+***************************************************************************************/
+void TFTLIB_SPI::fillRoundRectGradient(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, const Gradient &g) {
+	finish();
+	r = max((int32_t)0, min(r, min(w, h) / 2));
+	if(r == 0) {
+		fillRectGradient(x, y, w, h, g);
+		return;
+	}
+	if(g.count == 0 || w <= 0 || h <= 0) return;
+
+	// Ramp and corner half widths share scratch memory
+	GradientDDA *d = (GradientDDA*)scratch(sizeof(GradientDDA) + (r + 1) * sizeof(int16_t));
+	if (d == nullptr) return;
+	gradientSetup(g, *d);
+
+	// Corner half widths per row from the same midpoint walk as fillCircle
+	int16_t *hw = (int16_t*)(d + 1);
+	int32_t xs = 0, dx = 1, dd = r + r, p = -(r >> 1), rr = r;
+	fill_n(hw, r + 1, 0);
+	hw[0] = r;
+	while (xs < rr) {
+		if (p >= 0) {
+			hw[rr] = max((int32_t)hw[rr], xs);
+			dd -= 2;
+			p  -= dd;
+			rr--;
+		}
+		xs++;
+		hw[xs] = max((int32_t)hw[xs], rr);
+		dx += 2;
+		p  += dx;
+	}
 
-	fillScreen(BLACK);
-	start = HAL_GetTick();
-	for (y = 0; y < h; y += 5) drawFastHLine(0, y, w, color1);
-	for (x = 0; x < w; x += 5) drawFastVLine(x, 0, h, color2);
+	int32_t ya = max(y, __clip_y0 - __vp_y), yb = min(y + h - 1, __clip_y1 - __vp_y);
+	for (int32_t yy = ya; yy <= yb; yy++) {
+		int32_t dy = max(r - (yy - y), (yy - y) - (h - 1 - r));
+		int32_t in = (dy > 0) ? r - hw[dy] : 0;
 
-	return HAL_GetTick() - start;
+		int32_t xa = max(x + in, __clip_x0 - __vp_x), xb = min(x + w - 1 - in, __clip_x1 - __vp_x);
+		if (xa > xb) continue;
+
+		gradientSpan(*d, xa + __vp_x, yy + __vp_y, xb - xa + 1, __buffer);
+		pushLine(xa + __vp_x, yy + __vp_y, xb - xa + 1);
+	}
 }
 
-uint32_t TFTLIB_SPI::testRects(uint16_t color) {
-	unsigned long start;
-	int           n, i, i2,
-				cx = _width  / 2,
-				cy = _height / 2;
+/***************************************************************************************
+** Function name:           fillCircleGradient
+** Description:             Draw a circle filled with gradient
+***************************************************************************************/
+void TFTLIB_SPI::fillCircleGradient(int32_t x, int32_t y, int32_t r, const Gradient &g) {
+	if(r < 0) return;
+	fillRoundRectGradient(x - r, y - r, r + r + 1, r + r + 1, r, g);
+}
 
-	fillScreen(BLACK);
-	n     = min(_width, _height);
-	start = HAL_GetTick();
-	for (i = 2; i < n; i += 6) {
-		i2 = i / 2;
-		drawRect(cx - i2, cy - i2, i, i, color);
+/***************************************************************************************
+** Function name:           fillEllipse
+** Description:             Draw a filled ellipse with single color
+***************************************************************************************/
+void TFTLIB_SPI::fillEllipse(int16_t x0, int16_t y0, int32_t rx, int32_t ry, uint16_t color)
+{
+	if(rx < 2 || ry < 2) return;
+	int32_t x, y;
+	int32_t rx2 = rx * rx;
+	int32_t ry2 = ry * ry;
+	int32_t fx2 = 4 * rx2;
+	int32_t fy2 = 4 * ry2;
+	int32_t s;
+
+	for (x = 0, y = ry, s = 2*ry2+rx2*(1-2*ry); ry2*x <= rx2*y; x++) {
+		drawFastHLine(x0 - x, y0 - y, x + x + 1, color);
+		drawFastHLine(x0 - x, y0 + y, x + x + 1, color);
+
+		if (s >= 0) {
+			s += fx2 * (1 - y);
+			y--;
+		}
+		s += ry2 * ((4 * x) + 6);
 	}
 
-	return HAL_GetTick() - start;
+	for (x = rx, y = 0, s = 2*rx2+ry2*(1-2*rx); rx2*y <= ry2*x; y++) {
+		drawFastHLine(x0 - x, y0 - y, x + x + 1, color);
+		drawFastHLine(x0 - x, y0 + y, x + x + 1, color);
+
+		if (s >= 0) {
+			s += fy2 * (1 - x);
+			x--;
+		}
+		s += rx2 * ((4 * y) + 6);
+	}
 }
 
-uint32_t TFTLIB_SPI::testFilledRects(uint16_t color1, uint16_t color2) {
-	unsigned long start, t = 0;
-	int           n, i, i2,
-				cx = _width  / 2 - 1,
-				cy = _height / 2 - 1;
+/***************************************************************************************
+** Function name:           drawImage
+** Description:             Draw image at coords x&y
+***************************************************************************************/
+void TFTLIB_SPI::drawImage(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data) {
+	int32_t cx = x, cy = y, cw = w, ch = h;
+	if(w <= 0 || h <= 0 || !clipRect(cx, cy, cw, ch)) return;
 
-	fillScreen(BLACK);
-	n = min(_width, _height);
-	for (i = n - 1; i > 0; i -= 6) {
-		i2    = i / 2;
-		start = HAL_GetTick();
-		fillRect(cx - i2, cy - i2, i, i, color1);
-		t    += HAL_GetTick() - start;
-		// Outlines are not included in timing results
-		drawRect(cx - i2, cy - i2, i, i, color2);
+	setWindow(cx, cy, cx + cw - 1, cy + ch - 1);
+
+	// Skip clipped rows and columns of source
+	data += (cy - y - __vp_y) * w + (cx - x - __vp_x);
+
+	if(cw == w) {
+		writeData_DMA((uint8_t *)data, cw * ch * 2);
+		return;
+	}
+
+	for(int32_t j = 0; j < ch; j++) {
+		writeData_DMA((uint8_t *)data, cw * 2);
+		data += w;
 	}
-	return t;
 }
 
-uint32_t TFTLIB_SPI::testFilledCircles(uint8_t radius, uint16_t color) {
-	unsigned long start;
-	int x, y, w = _width, h = _height, r2 = radius * 2;
+/***************************************************************************************
+** Function name:           drawRows
+** Description:             Draw area filled row by row by callback, rows are made in one
+**                          half of buffer while the other half is sent by DMA in one window.
+**                          Source is asked only for visible pixels, returns bytes sent
+***************************************************************************************/
+uint32_t TFTLIB_SPI::drawRows(int32_t x, int32_t y, int32_t w, int32_t h, RowSource src, void *user) {
+	int32_t cx = x, cy = y, cw = w, ch = h;
+	if(w <= 0 || h <= 0 || !clipRect(cx, cy, cw, ch)) return 0;
 
-	fillScreen(BLACK);
-	start = HAL_GetTick();
-	for (x = radius; x < w; x += r2) {
-		for (y = radius; y < h; y += r2) {
-			fillCircle(x, y, radius, color);
+	int32_t half = __buffer_size / 2;
+	int32_t rows = max(half / cw, (int32_t)1);
+	uint16_t *buf[2] = { __buffer, __buffer + half };
+	uint8_t sel = 0;
+
+	setWindow(cx, cy, cx + cw - 1, cy + ch - 1);
+
+	CS_L();
+	DC_PORT->BSRR = (uint32_t)DC_PIN;
+
+	for (int32_t j = 0; j < ch; ) {
+		int32_t n = min(rows, ch - j);
+		for (int32_t i = 0; i < n; i++) {
+			src(user, cx - __vp_x, cy - __vp_y + j + i, cw, buf[sel] + i * cw);
 		}
+
+		while (_bus->State != HAL_SPI_STATE_READY);
+		HAL_SPI_Transmit_DMA(_bus, (uint8_t*)buf[sel], n * cw * 2);
+		j += n;
+		sel ^= 1;
 	}
-	return HAL_GetTick() - start;
+	while (_bus->State != HAL_SPI_STATE_READY);
+
+	CS_H();
+	return cw * ch * 2;
 }
 
-uint32_t TFTLIB_SPI::testCircles(uint8_t radius, uint16_t color) {
-	unsigned long start;
-	int           x, y, r2 = radius * 2,
-					  w = _width  + radius,
-					  h = _height + radius;
+/***************************************************************************************
+** Function name:           sampleBilinear
+** Description:             Support function for scaled and rotated images, pixel of image at
+**                          u&v (Q16, pixel centres on integers). Next to transparent pixels
+**                          the nearest pixel is taken so edges keep the colour key
+***************************************************************************************/
+inline uint16_t TFTLIB_SPI::sampleBilinear(const uint16_t *data, int32_t w, int32_t h, int32_t u, int32_t v, int32_t transparent) {
+	u = max(u, (int32_t)0);
+	v = max(v, (int32_t)0);
+
+	int32_t ix = u >> 16, iy = v >> 16;
+	int32_t fx = u & 0xFFFF, fy = v & 0xFFFF;
+	if (ix >= w - 1) { ix = w - 1; fx = 0; }
+	if (iy >= h - 1) { iy = h - 1; fy = 0; }
+
+	const uint16_t *p = data + iy * w + ix;
+	int32_t dx = fx ? 1 : 0, dy = fy ? w : 0;
+	uint16_t p00 = p[0], p01 = p[dx], p10 = p[dy], p11 = p[dy + dx];
+
+	if (transparent >= 0) {
+		uint16_t key = SWAP_UINT16(transparent);
+		if (p00 == key || p01 == key || p10 == key || p11 == key) return p[(fx & 0x8000 ? dx : 0) + (fy & 0x8000 ? dy : 0)];
+	}
 
-	// Screen is not cleared for this one -- this is
-	// intentional and does not affect the reported time.
-	start = HAL_GetTick();
-	for (x = 0; x < w; x += r2) {
-		for (y = 0; y < h; y += r2) {
-			drawCircle(x, y, radius, color);
+	uint8_t ax = (fx * 255 + 0x8000) >> 16, ay = (fy * 255 + 0x8000) >> 16;
+	uint16_t top = blend565(ax, SWAP_UINT16(p01), SWAP_UINT16(p00));
+	uint16_t bot = blend565(ax, SWAP_UINT16(p11), SWAP_UINT16(p10));
+	return SWAP_UINT16(blend565(ay, bot, top));
+}
+
+/***************************************************************************************
+** Function name:           startFill
+** Description:             Start non-blocking fill of rectangle, false when clipped away
+***************************************************************************************/
+bool TFTLIB_SPI::startFill(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+	finish();
+	if(!clipRect(x, y, w, h)) return false;
+
+	fill_n(__buffer, __buffer_size, SWAP_UINT16(color));
+	setWindow(x, y, x + w - 1, y + h - 1);
+
+	CS_L();
+	DC_PORT->BSRR = (uint32_t)DC_PIN;
+
+	__job_src = nullptr;
+	__job_left = w * h;
+	__job_copy = false;
+	__job_active = true;
+	jobNext();
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           startImage
+** Description:             Start non-blocking push of image in panel byte order like
+**                          drawImage(). Clipped images are copied by rows into one half of
+**                          buffer while the other one is sent
+***************************************************************************************/
+bool TFTLIB_SPI::startImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data) {
+	finish();
+	int32_t cx = x, cy = y, cw = w, ch = h;
+	if(w <= 0 || h <= 0 || !clipRect(cx, cy, cw, ch)) return false;
+
+	setWindow(cx, cy, cx + cw - 1, cy + ch - 1);
+
+	CS_L();
+	DC_PORT->BSRR = (uint32_t)DC_PIN;
+
+	__job_src = data + (cy - y - __vp_y) * w + (cx - x - __vp_x);
+	__job_left = cw * ch;
+	__job_w = cw;
+	__job_stride = w;
+	__job_col = 0;
+	__job_sel = 0;
+	__job_ready = 0;
+	__job_copy = cw != w;
+	__job_active = true;
+	if(__job_copy) jobPrepare();
+	jobNext();
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           jobPrepare
+** Description:             Copy next pixels of clipped image into buffer half __job_sel
+***************************************************************************************/
+void TFTLIB_SPI::jobPrepare(void) {
+	uint16_t *out = __buffer + __job_sel * (__buffer_size / 2);
+	uint16_t n = min(__job_left, (uint32_t)__buffer_size / 2);
+
+	for(uint16_t k = 0; k < n; ) {
+		int32_t take = min((int32_t)(n - k), __job_w - __job_col);
+		copy_n(__job_src + __job_col, take, out + k);
+		k += take;
+		__job_col += take;
+		if(__job_col == __job_w) {
+			__job_col = 0;
+			__job_src += __job_stride;
 		}
 	}
 
-	return HAL_GetTick() - start;
+	__job_left -= n;
+	__job_ready = n;
 }
 
-uint32_t TFTLIB_SPI::testTriangles() {
-	unsigned long start;
-	int           n, i, cx = _width  / 2 - 1,
-				  cy = _height / 2 - 1;
+/***************************************************************************************
+** Function name:           jobNext
+** Description:             Start next DMA chunk of job or end it, SPI has to be idle
+***************************************************************************************/
+void TFTLIB_SPI::jobNext(void) {
+	if(__job_copy) {
+		if(__job_ready == 0) {
+			CS_H();
+			__job_active = false;
+			return;
+		}
 
+		HAL_SPI_Transmit_DMA(_bus, (uint8_t*)(__buffer + __job_sel * (__buffer_size / 2)), __job_ready * 2);
+		__job_sel ^= 1;
+		jobPrepare();
+		return;
+	}
+
+	if(__job_left == 0) {
+		CS_H();
+		__job_active = false;
+		return;
+	}
+
+	// Fills repeat buffer, contiguous images are sent straight from source
+	uint32_t n = min(__job_left, __job_src ? (uint32_t)32767 : (uint32_t)__buffer_size);
+	HAL_SPI_Transmit_DMA(_bus, (uint8_t*)(__job_src ? __job_src : __buffer), n * 2);
+	if(__job_src) __job_src += n;
+	__job_left -= n;
+}
+
+/***************************************************************************************
+** Function name:           poll
+** Description:             Advance started job when its DMA chunk is done, true while job
+**                          is still running
+***************************************************************************************/
+bool TFTLIB_SPI::poll(void) {
+	if(!__job_active) return false;
+	if(_bus->State != HAL_SPI_STATE_READY) return true;
+
+	jobNext();
+	return __job_active;
+}
+
+/***************************************************************************************
+** Function name:           finish
+** Description:             Wait for end of started job. Called by setWindow() and by drawing
+**                          that builds rows in buffer before its window is set
+***************************************************************************************/
+void TFTLIB_SPI::finish(void) {
+	while(poll());
+}
+
+/***************************************************************************************
+** Function name:           drawImageScaled
+** Description:             Draw w*h image (data as drawImage) scaled to dw*dh at coords x&y,
+**                          transparent = RGB565 colour key or -1
+***************************************************************************************/
+void TFTLIB_SPI::drawImageScaled(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data, int32_t dw, int32_t dh, IMAGE_FILTER filter, int32_t transparent) {
+	finish();
+	int32_t cx = x, cy = y, cw = dw, ch = dh;
+	if(w <= 0 || h <= 0 || dw <= 0 || dh <= 0 || !clipRect(cx, cy, cw, ch)) return;
+
+	// Source position of destination pixel centres, stepped in Q16
+	int32_t sx = (int32_t)(((int64_t)w << 16) / dw);
+	int32_t sy = (int32_t)(((int64_t)h << 16) / dh);
+	int32_t u0 = (sx >> 1) + (cx - x - __vp_x) * sx;
+	int32_t v  = (sy >> 1) + (cy - y - __vp_y) * sy;
+	bool bilinear = (filter == IMAGE_FILTER::BILINEAR);
+
+	for (int32_t j = 0; j < ch; j++, v += sy) {
+		int32_t u = u0;
+		if (bilinear) {
+			for (int32_t i = 0; i < cw; i++, u += sx) __buffer[i] = sampleBilinear(data, w, h, u - 0x8000, v - 0x8000, transparent);
+		}
+		else {
+			const uint16_t *row = data + min(v >> 16, h - 1) * w;
+			for (int32_t i = 0; i < cw; i++, u += sx) __buffer[i] = row[min(u >> 16, w - 1)];
+		}
+		pushLineKeyed(cx, cy + j, cw, transparent);
+	}
+}
+
+/***************************************************************************************
+** Function name:           drawImageRotated
+** Description:             Draw w*h image (data as drawImage) rotated by angle (degrees,
+**                          clockwise) and scaled around its centre placed at coords x&y
+***************************************************************************************/
+void TFTLIB_SPI::drawImageRotated(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data, float angle, float scale, IMAGE_FILTER filter, int32_t transparent) {
+	finish();
+	if(w <= 0 || h <= 0 || scale <= 0.0f) return;
+
+	float sa = sinf(angle * (float)M_PI / 180), ca = cosf(angle * (float)M_PI / 180);
+	int32_t hx = (int32_t)ceilf((fabsf(ca) * w + fabsf(sa) * h) * scale / 2) + 1;
+	int32_t hy = (int32_t)ceilf((fabsf(sa) * w + fabsf(ca) * h) * scale / 2) + 1;
+
+	// Inverse mapping: source u = A + px*c, v = B - px*s along screen row (Q16)
+	int32_t c = (int32_t)(ca / scale * 65536.0f);
+	int32_t s = (int32_t)(sa / scale * 65536.0f);
+	int32_t X = x + __vp_x, Y = y + __vp_y;
+	int64_t W = (int64_t)w << 16, H = (int64_t)h << 16;
+	int64_t rx = -(int64_t)X * 65536 + 0x8000;
+
+	int32_t ya = max(Y - hy, __clip_y0), yb = min(Y + hy, __clip_y1);
+	int32_t xa = max(X - hx, __clip_x0), xb = min(X + hx, __clip_x1);
+	bool bilinear = (filter == IMAGE_FILTER::BILINEAR);
+
+	// Columns where 0 <= a + px*d < len, narrows xs..xe
+	auto limit = [](int64_t a, int64_t d, int64_t len, int32_t &xs, int32_t &xe) {
+		auto fdiv = [](int64_t n, int64_t q) { return n / q - ((n % q != 0) && ((n < 0) != (q < 0))); };
+		if (d == 0) {
+			if (a < 0 || a >= len) xe = xs - 1;
+			return;
+		}
+		if (d > 0) {
+			xs = (int32_t)max((int64_t)xs, -fdiv(a, d));
+			xe = (int32_t)min((int64_t)xe, -fdiv(a - len, d) - 1);
+		}
+		else {
+			xs = (int32_t)max((int64_t)xs, fdiv(len - a, d) + 1);
+			xe = (int32_t)min((int64_t)xe, fdiv(-a, d));
+		}
+	};
+
+	for (int32_t py = ya; py <= yb; py++) {
+		int64_t ry = (int64_t)(py - Y) * 65536 + 0x8000;
+		int64_t A = (W >> 1) + ((rx * c + ry * s) >> 16);
+		int64_t B = (H >> 1) + ((ry * c - rx * s) >> 16);
+
+		int32_t xs = xa, xe = xb;
+		limit(A, c, W, xs, xe);
+		limit(B, -(int64_t)s, H, xs, xe);
+		if (xs > xe) continue;
+
+		int32_t u = (int32_t)(A + (int64_t)xs * c), v = (int32_t)(B - (int64_t)xs * s);
+		for (int32_t i = 0; i <= xe - xs; i++, u += c, v -= s) {
+			if (bilinear) __buffer[i] = sampleBilinear(data, w, h, u - 0x8000, v - 0x8000, transparent);
+			else __buffer[i] = data[(v >> 16) * w + (u >> 16)];
+		}
+		pushLineKeyed(xs, py, xe - xs + 1, transparent);
+	}
+}
+
+/***************************************************************************************
+** Function name:           decodeQ565
+** Description:             Decode next n pixels of Q565 stream as swapped RGB565 into out,
+**                          out = nullptr skips pixels. Returns false on end of data
+***************************************************************************************/
+inline bool TFTLIB_SPI::decodeQ565(Q565Decoder &d, uint16_t *out, int32_t n) {
+	while (n > 0) {
+		if (d.run) {
+			int32_t k = min(n, (int32_t)d.run);
+			if (out) {
+				fill_n(out, k, SWAP_UINT16(d.px));
+				out += k;
+			}
+			d.run -= k;
+			n -= k;
+			continue;
+		}
+
+		if (d.p >= d.end) return false;
+		uint8_t op = *d.p++;
+
+		if (op < Q565OpDiff) {
+			d.px = d.index[op];
+		}
+		else if (op < Q565OpLuma) {
+			uint16_t r = ((d.px >> 11) + ((op >> 4) & 3) - 2) & 0x1F;
+			uint16_t g = (((d.px >> 5) & 0x3F) + ((op >> 2) & 3) - 2) & 0x3F;
+			uint16_t b = ((d.px & 0x1F) + (op & 3) - 2) & 0x1F;
+			d.px = (r << 11) | (g << 5) | b;
+		}
+		else if (op < Q565OpRun) {
+			if (d.p >= d.end) return false;
+			int32_t dg = (op & 0x3F) - 32;
+			uint8_t rb = *d.p++;
+			uint16_t r = ((d.px >> 11) + (dg >> 1) + (rb >> 4) - 8) & 0x1F;
+			uint16_t g = (((d.px >> 5) & 0x3F) + dg) & 0x3F;
+			uint16_t b = ((d.px & 0x1F) + (dg >> 1) + (rb & 0x0F) - 8) & 0x1F;
+			d.px = (r << 11) | (g << 5) | b;
+		}
+		else if (op < Q565OpColor) {
+			d.run = (op & 0x3F) + 1;
+			continue;
+		}
+		else if (op == Q565OpColor) {
+			if (d.end - d.p < 2) return false;
+			d.px = (d.p[0] << 8) | d.p[1];
+			d.p += 2;
+		}
+		else return false;
+
+		d.index[Q565Hash(d.px)] = d.px;
+		if (out) *out++ = SWAP_UINT16(d.px);
+		n--;
+	}
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           drawImageQ565
+** Description:             Draw Q565 compressed image at coords x&y, rows are decoded into
+**                          one half of buffer while the other half is sent by DMA
+***************************************************************************************/
+void TFTLIB_SPI::drawImageQ565(int32_t x, int32_t y, const uint8_t *data, uint32_t len) {
+	if(len < Q565HeaderSize || data[0] != 'Q' || data[1] != '5' || data[2] != '6' || data[3] != '5') return;
+
+	int32_t w = data[4] | (data[5] << 8);
+	int32_t h = data[6] | (data[7] << 8);
+	int32_t cx = x, cy = y, cw = w, ch = h;
+	if(w <= 0 || h <= 0 || !clipRect(cx, cy, cw, ch)) return;
+
+	Q565Decoder d;
+	d.p = data + Q565HeaderSize;
+	d.end = data + len;
+	d.px = 0;
+	d.run = 0;
+	fill_n(d.index, 64, 0);
+
+	// Pixels of clipped rows and columns are decoded and dropped
+	int32_t sl = cx - x - __vp_x, sr = w - cw - sl;
+	bool ok = decodeQ565(d, nullptr, (cy - y - __vp_y) * w);
+
+	int32_t half = __buffer_size / 2;
+	int32_t rows = max(half / cw, (int32_t)1);
+	uint16_t *buf[2] = { __buffer, __buffer + half };
+	uint8_t sel = 0;
+
+	setWindow(cx, cy, cx + cw - 1, cy + ch - 1);
+
+	CS_L();
+	DC_PORT->BSRR = (uint32_t)DC_PIN;
+
+	for (int32_t j = 0; ok && j < ch; ) {
+		int32_t n = min(rows, ch - j), i = 0;
+		for (; ok && i < n; i++) {
+			ok = decodeQ565(d, nullptr, sl) && decodeQ565(d, buf[sel] + i * cw, cw) && decodeQ565(d, nullptr, sr);
+		}
+
+		// On corrupt data only rows decoded before it are sent
+		if (!ok) n = i - 1;
+		if (n == 0) break;
+
+		while (_bus->State != HAL_SPI_STATE_READY);
+		HAL_SPI_Transmit_DMA(_bus, (uint8_t*)buf[sel], n * cw * 2);
+		j += n;
+		sel ^= 1;
+	}
+	while (_bus->State != HAL_SPI_STATE_READY);
+
+	CS_H();
+}
+
+/***************************************************************************************
+** Function name:           drawJpegHelper
+** Description:             Support function for drawJpeg(), every MCU is decoded into one
+**                          half of buffer while the previous one is sent by DMA
+***************************************************************************************/
+bool TFTLIB_SPI::drawJpegHelper(int32_t x, int32_t y, JPEG_Decoder &jpg, JPEG_SCALE scale) {
+	finish();
+	jpg.setScale(scale);
+
+	uint16_t *buf[2] = { __buffer, __buffer + __buffer_size / 2 };
+	uint8_t sel = 0;
+	uint16_t mx, my, mw, mh;
+	bool busy = false;
+
+	while (jpg.nextMCU(mx, my, mw, mh)) {
+		int32_t cx = x + mx, cy = y + my, cw = mw, ch = mh;
+
+		// MCUs outside clip are only entropy decoded, nothing is left below clip
+		if (!clipRect(cx, cy, cw, ch)) {
+			if (y + my + __vp_y > __clip_y1) break;
+			jpg.decodeMCU(nullptr);
+			continue;
+		}
+		if (!jpg.decodeMCU(buf[sel])) break;
+
+		// Move visible part of MCU to start of buffer
+		int32_t sx = cx - x - mx - __vp_x, sy = cy - y - my - __vp_y;
+		if (cw != mw || ch != mh) {
+			for (int32_t j = 0; j < ch; j++) {
+				copy_n(buf[sel] + (sy + j) * mw + sx, cw, buf[sel] + j * cw);
+			}
+		}
+
+		while (_bus->State != HAL_SPI_STATE_READY);
+		setWindow(cx, cy, cx + cw - 1, cy + ch - 1);
+
+		CS_L();
+		DC_PORT->BSRR = (uint32_t)DC_PIN;
+		HAL_SPI_Transmit_DMA(_bus, (uint8_t*)buf[sel], cw * ch * 2);
+		busy = true;
+		sel ^= 1;
+	}
+
+	if (busy) {
+		while (_bus->State != HAL_SPI_STATE_READY);
+		CS_H();
+	}
+	return !jpg.failed();
+}
+
+/***************************************************************************************
+** Function name:           drawJpeg
+** Description:             Draw baseline JPEG from memory at coords x&y, optionally scaled
+**                          down by 2, 4 or 8
+***************************************************************************************/
+bool TFTLIB_SPI::drawJpeg(int32_t x, int32_t y, const uint8_t *data, uint32_t len, JPEG_SCALE scale) {
+	// Decoder is allocated on first use and kept for next images
+	if (__jpeg == nullptr) __jpeg = new (nothrow) JPEG_Decoder;
+	return __jpeg && __jpeg->open(data, len) && drawJpegHelper(x, y, *__jpeg, scale);
+}
+
+/***************************************************************************************
+** Function name:           drawJpeg
+** Description:             Draw baseline JPEG read through callback (file, flash, network),
+**                          reader fills buf with up to len bytes and returns count, 0 at end
+***************************************************************************************/
+bool TFTLIB_SPI::drawJpeg(int32_t x, int32_t y, JPEG_Decoder::Reader reader, void *user, JPEG_SCALE scale) {
+	if (__jpeg == nullptr) __jpeg = new (nothrow) JPEG_Decoder;
+	return __jpeg && __jpeg->open(reader, user) && drawJpegHelper(x, y, *__jpeg, scale);
+}
+
+/***************************************************************************************
+** Function name:           drawBitmap
+** Description:             Draw bitmap from array with fixed color (transparent background)
+***************************************************************************************/
+void TFTLIB_SPI::drawBitmap(int16_t x, int16_t y, int16_t w, int16_t h, const uint8_t *bitmap, uint16_t color) {
+	int32_t cx = x, cy = y, cw = w, ch = h;
+	if(w <= 0 || h <= 0 || !clipRect(cx, cy, cw, ch)) return;
+
+	int32_t i, j, xs, byteWidth = (w + 7) / 8;
+
+	// Send every horizontal run of set bits as one span, rows outside clip are skipped
+	for (j = cy - y - __vp_y; j < cy - y - __vp_y + ch; j++) {
+		const uint8_t *line = bitmap + j * byteWidth;
+		i = 0;
+		while (i < w) {
+			while (i < w && !(pgm_read_byte(line + (i >> 3)) & (128 >> (i & 7)))) {
+				if (!pgm_read_byte(line + (i >> 3)) && !(i & 7)) i += 8;
+				else i++;
+			}
+			if (i >= w) break;
+
+			xs = i;
+			while (i < w && (pgm_read_byte(line + (i >> 3)) & (128 >> (i & 7)))) {
+				if (pgm_read_byte(line + (i >> 3)) == 0xFF && !(i & 7) && i + 8 <= w) i += 8;
+				else i++;
+			}
+			drawFastHLine(x + xs, y + j, i - xs, color);
+		}
+	}
+}
+
+/***************************************************************************************
+** Function name:           drawBitmap
+** Description:             Draw bitmap from array with fixed color on opaque background
+***************************************************************************************/
+void TFTLIB_SPI::drawBitmap(int16_t x, int16_t y, int16_t w, int16_t h, const uint8_t *bitmap, uint16_t color, uint16_t bg) {
+	int32_t cx = x, cy = y, cw = w, ch = h;
+	if(w <= 0 || h <= 0 || !clipRect(cx, cy, cw, ch)) return;
+
+	int32_t i, j, byteWidth = (w + 7) / 8;
+	int32_t i0 = cx - x - __vp_x, j0 = cy - y - __vp_y;
+	int32_t rows = __buffer_size / cw;
+	uint16_t fg_sw = SWAP_UINT16(color), bg_sw = SWAP_UINT16(bg);
+
+	setWindow(cx, cy, cx + cw - 1, cy + ch - 1);
+
+	// Expand as many whole visible rows as fit in the buffer, then send them in one transfer
+	j = j0;
+	while (j < j0 + ch) {
+		int32_t n = (j0 + ch - j) < rows ? (j0 + ch - j) : rows;
+		uint16_t *p = __buffer;
+		for (int32_t k = 0; k < n; k++, j++) {
+			const uint8_t *line = bitmap + j * byteWidth;
+			for (i = i0; i < i0 + cw; i++) {
+				*p++ = (pgm_read_byte(line + (i >> 3)) & (128 >> (i & 7))) ? fg_sw : bg_sw;
+			}
+		}
+		writeData_DMA((uint8_t*)__buffer, n * cw * 2);
+	}
+}
+
+/***************************************************************************************
+** Function name:           setCursor
+** Description:             Set text cursor at x&y. Used for print/println function
+***************************************************************************************/
+void TFTLIB_SPI::setCursor(int32_t x, int32_t y){
+	if(x > _width || y > _height) return;
+	_posx = x;
+	_posy = y;
+}
+
+/***************************************************************************************
+** Function name:           getCursor
+** Description:             Get text cursor position
+***************************************************************************************/
+void TFTLIB_SPI::getCursor(int32_t &x, int32_t &y){
+	x = _posx;
+	y = _posy;
+}
+
+/***************************************************************************************
+** Function name:           setTextColor
+** Description:             Set text cursor at x&y. Used for print/println function
+***************************************************************************************/
+void TFTLIB_SPI::setTextColor(int32_t fg, int32_t bg){
+	__text_fg = fg;
+	__text_bg = bg;
+}
+
+/***************************************************************************************
+** Function name:           setFont
+** Description:             Set text cursor at x&y. Used for print/println function
+***************************************************************************************/
+void TFTLIB_SPI::setFont(FontDef &Font){
+	__font = &Font;
+}
+
+/***************************************************************************************
+** Function name:           writeChar
+** Description:             Print character at coords x&y with selected font
+***************************************************************************************/
+void TFTLIB_SPI::writeChar(int32_t x, int32_t y, char ch) {
+	int32_t i=0, b=0, j=0;
+	int32_t cx = x, cy = y, cw = __font->width, cht = __font->height;
+
+	if(!clipRect(cx, cy, cw, cht)) return;
+	setWindow(cx, cy, cx + cw - 1, cy + cht - 1);
+
+	// Only visible rows and columns of glyph are expanded
+	int32_t i0 = cy - y - __vp_y, j0 = cx - x - __vp_x;
+	uint16_t *p = __buffer;
+	for (i = i0; i < i0 + cht; i++) {
+		b = __font->data[(ch - 32) * __font->height + i];
+		for (j = j0; j < j0 + cw; j++) {
+			if ((b << j) & 0x8000) {
+				*p++ = SWAP_UINT16(__text_fg);
+			}
+			else {
+				*p++ = SWAP_UINT16(__text_bg);
+			}
+		}
+	}
+	writeData_DMA((uint8_t*)__buffer, cw * cht * 2);
+}
+
+/***************************************************************************************
+** Function name:           writeString
+** Description:             Print string at coords x&y with selected font
+***************************************************************************************/
+void TFTLIB_SPI::writeString(int32_t x, int32_t y, char *ch) {
+
+	while(*ch){
+		if(strcmp(reinterpret_cast<const char*>(&ch), " ") == 0){
+			x += __font->width;
+			ch++;
+			return;
+		}
+
+		else {
+			if(x + __vp_x > __clip_x1) return;
+			writeChar(x, y, *ch);
+			x += __font->width;
+			ch++;
+		}
+	}
+}
+
+/***************************************************************************************
+** Function name:           print
+** Description:             Print string with selected font
+***************************************************************************************/
+void TFTLIB_SPI::print(char *ch) {
+	while(*ch){
+		if(strcmp(reinterpret_cast<const char*>(&ch), " ") == 0){
+			_posx += __font->width;
+			ch++;
+			return;
+		}
+
+		writeChar(_posx, _posy, *ch);
+		_posx += __font->width;
+		ch++;
+	}
+}
+
+/***************************************************************************************
+** Function name:           println
+** Description:             Print string with selected font
+***************************************************************************************/
+void TFTLIB_SPI::println(uint8_t *ch)
+{
+	int32_t cur_x = _posx;
+
+	while(*ch){
+		if(*ch < 32 || *ch > 128 || *ch == 0) return;
+		if(cur_x + __font->width > __vp_w) {
+			cur_x = 0;
+			setCursor(0, _posy + __font->height);
+		}
+
+		writeChar(cur_x, _posy, *ch);
+		cur_x += __font->width;
+		ch++;
+	}
+
+	if(_posy + __font->height > __vp_h)
+		_posy = 0;
+	else
+		_posy += __font->height;
+}
+
+void TFTLIB_SPI::println(char *ch)
+{
+	int32_t cur_x = _posx;
+
+	while(*ch){
+		if(*ch < 32 || *ch > 128 || *ch == 0) return;
+		if(cur_x + __font->width > __vp_w) {
+			cur_x = 0;
+			setCursor(0, _posy + __font->height);
+		}
+
+		writeChar(cur_x, _posy, *ch);
+		cur_x += __font->width;
+		ch++;
+	}
+
+	if(_posy + __font->height > __vp_h)
+		_posy = 0;
+	else
+		_posy += __font->height;
+}
+
+/***************************************************************************************************************************
+** 												Test functions for display benchmark
+****************************************************************************************************************************/
+uint32_t TFTLIB_SPI::testFillScreen() {
+	unsigned long start = HAL_GetTick();
 	fillScreen(BLACK);
-	n     = min(cx, cy);
-	start = HAL_GetTick();
+	fillScreen(RED);
+	fillScreen(GREEN);
+	fillScreen(BLUE);
+	fillScreen(BLACK);
+	return HAL_GetTick() - start;
+}
 
-	for (i = 0; i < n; i += 5) {
-		drawTriangle(
-		cx    , cy - i, // peak
-		cx - i, cy + i, // bottom left
-		cx + i, cy + i, // bottom right
-		color565(0, 0, i));
+uint32_t TFTLIB_SPI::testText() {
+	fillScreen(BLACK);
+
+	unsigned long start = HAL_GetTick();
+	setFont(Font_7x10);
+	setTextColor(WHITE, BLACK);
+	writeString(0, 0, (char*)"Hello World!");
+
+	setFont(Font_11x18);
+	setTextColor(YELLOW, BLACK);
+	writeString(0, 10, (char*)"1234.56");
+
+	setTextColor(RED, BLACK);
+	writeString(0, 28, (char*)"0xDEADBEEF");
+
+	setFont(Font_16x26);
+	setTextColor(GREEN, BLACK);
+	writeString(0, 64, (char*)"Groop");
+
+	setFont(Font_11x18);
+	setTextColor(MAGENTA, BLACK);
+	writeString(0, 90, (char*)"I implore thee,");
+
+	setFont(Font_7x10);
+	setTextColor(LGRAY, BLACK);
+	writeString(0, 108, (char*)"And hooptiously drangle me");
+	writeString(0, 118, (char*)"with crinkly bindlewurdles,");
+	writeString(0, 128, (char*)"Or I will rend thee");
+	writeString(0, 138, (char*)"in the gobberwarts");
+	writeString(0, 148, (char*)"with my blurglecruncheon,");
+	writeString(0, 158, (char*)"see if I don't!");
+	return HAL_GetTick() - start;
+}
+
+uint32_t TFTLIB_SPI::testLines(uint16_t color) {
+	unsigned long start, t;
+	int           x1, y1, x2, y2,
+				w = _width,
+				h = _height;
+
+	fillScreen(BLACK);
+
+	x1 = y1 = 0;
+	y2    = h - 1;
+	start = HAL_GetTick();
+	for (x2 = 0; x2 < w; x2 += 6) drawLine(x1, y1, x2, y2, color);
+	x2    = w - 1;
+	for (y2 = 0; y2 < h; y2 += 6) drawLine(x1, y1, x2, y2, color);
+	t     = HAL_GetTick() - start; // fillScreen doesn't count against timing
+
+	fillScreen(BLACK);
+
+	x1    = w - 1;
+	y1    = 0;
+	y2    = h - 1;
+	start = HAL_GetTick();
+	for (x2 = 0; x2 < w; x2 += 6) drawLine(x1, y1, x2, y2, color);
+	x2    = 0;
+	for (y2 = 0; y2 < h; y2 += 6) drawLine(x1, y1, x2, y2, color);
+	t    += HAL_GetTick() - start;
+
+	fillScreen(BLACK);
+
+	x1    = 0;
+	y1    = h - 1;
+	y2    = 0;
+	start = HAL_GetTick();
+	for (x2 = 0; x2 < w; x2 += 6) drawLine(x1, y1, x2, y2, color);
+	x2    = w - 1;
+	for (y2 = 0; y2 < h; y2 += 6) drawLine(x1, y1, x2, y2, color);
+	t    += HAL_GetTick() - start;
+
+	fillScreen(BLACK);
+
+	x1    = w - 1;
+	y1    = h - 1;
+	y2    = 0;
+	start = HAL_GetTick();
+	for (x2 = 0; x2 < w; x2 += 6) drawLine(x1, y1, x2, y2, color);
+	x2    = 0;
+	for (y2 = 0; y2 < h; y2 += 6) drawLine(x1, y1, x2, y2, color);
+
+	return HAL_GetTick() - start;
+}
+
+uint32_t TFTLIB_SPI::testFastLines(uint16_t color1, uint16_t color2) {
+	unsigned long start;
+	int           x, y, w = _width, h = _height;
+
+	fillScreen(BLACK);
+	start = HAL_GetTick();
+	for (y = 0; y < h; y += 5) drawFastHLine(0, y, w, color1);
+	for (x = 0; x < w; x += 5) drawFastVLine(x, 0, h, color2);
+
+	return HAL_GetTick() - start;
+}
+
+uint32_t TFTLIB_SPI::testRects(uint16_t color) {
+	unsigned long start;
+	int           n, i, i2,
+				cx = _width  / 2,
+				cy = _height / 2;
+
+	fillScreen(BLACK);
+	n     = min(_width, _height);
+	start = HAL_GetTick();
+	for (i = 2; i < n; i += 6) {
+		i2 = i / 2;
+		drawRect(cx - i2, cy - i2, i, i, color);
+	}
+
+	return HAL_GetTick() - start;
+}
+
+uint32_t TFTLIB_SPI::testFilledRects(uint16_t color1, uint16_t color2) {
+	unsigned long start, t = 0;
+	int           n, i, i2,
+				cx = _width  / 2 - 1,
+				cy = _height / 2 - 1;
+
+	fillScreen(BLACK);
+	n = min(_width, _height);
+	for (i = n - 1; i > 0; i -= 6) {
+		i2    = i / 2;
+		start = HAL_GetTick();
+		fillRect(cx - i2, cy - i2, i, i, color1);
+		t    += HAL_GetTick() - start;
+		// Outlines are not included in timing results
+		drawRect(cx - i2, cy - i2, i, i, color2);
+	}
+	return t;
+}
+
+uint32_t TFTLIB_SPI::testFilledCircles(uint8_t radius, uint16_t color) {
+	unsigned long start;
+	int x, y, w = _width, h = _height, r2 = radius * 2;
+
+	fillScreen(BLACK);
+	start = HAL_GetTick();
+	for (x = radius; x < w; x += r2) {
+		for (y = radius; y < h; y += r2) {
+			fillCircle(x, y, radius, color);
+		}
+	}
+	return HAL_GetTick() - start;
+}
+
+uint32_t TFTLIB_SPI::testCircles(uint8_t radius, uint16_t color) {
+	unsigned long start;
+	int           x, y, r2 = radius * 2,
+					  w = _width  + radius,
+					  h = _height + radius;
+
+	// Screen is not cleared for this one -- this is
+	// intentional and does not affect the reported time.
+	start = HAL_GetTick();
+	for (x = 0; x < w; x += r2) {
+		for (y = 0; y < h; y += r2) {
+			drawCircle(x, y, radius, color);
+		}
+	}
+
+	return HAL_GetTick() - start;
+}
+
+uint32_t TFTLIB_SPI::testTriangles() {
+	unsigned long start;
+	int           n, i, cx = _width  / 2 - 1,
+				  cy = _height / 2 - 1;
+
+	fillScreen(BLACK);
+	n     = min(cx, cy);
+	start = HAL_GetTick();
+
+	for (i = 0; i < n; i += 5) {
+		drawTriangle(
+		cx    , cy - i, // peak
+		cx - i, cy + i, // bottom left
+		cx + i, cy + i, // bottom right
+		color565(0, 0, i));
+	}
+
+	return HAL_GetTick() - start;
+}
+
+uint32_t TFTLIB_SPI::testFilledTriangles() {
+	unsigned long start, t = 0;
+	int           i, cx = _width  / 2 - 1,
+				   cy = _height / 2 - 1;
+
+	fillScreen(BLACK);
+	start = HAL_GetTick();
+	for (i = min(cx, cy); i > 10; i -= 5) {
+		start = HAL_GetTick();
+		fillTriangle(cx, cy - i, cx - i, cy + i, cx + i, cy + i, color565(0, i, i));
+		t += HAL_GetTick() - start;
+		drawTriangle(cx, cy - i, cx - i, cy + i, cx + i, cy + i, color565(i, i, 0));
+	}
+
+	return t;
+}
+
+uint32_t TFTLIB_SPI::testRoundRects() {
+	unsigned long start;
+	int           w, i, i2,
+				cx = _width  / 2 - 1,
+				cy = _height / 2 - 1;
+
+	fillScreen(BLACK);
+	w     = min(_height, _width);
+	start = HAL_GetTick();
+	for (i = 0; i < w; i += 6) {
+		i2 = i / 2;
+		drawRoundRect(cx - i2, cy - i2, i, i, i / 8, color565(i, 0, 0));
+	}
+
+	return HAL_GetTick() - start;
+}
+
+uint32_t TFTLIB_SPI::testFilledRoundRects() {
+	unsigned long start;
+	int           i, i2,
+				cx = _width  / 2 - 1,
+				cy = _height / 2 - 1;
+
+	fillScreen(BLACK);
+	start = HAL_GetTick();
+	for (i = min(_width , _height); i > 20; i -= 6) {
+		i2 = i / 2;
+		fillRoundRect(cx - i2, cy - i2, i, i, i / 8, color565(0, i, 0));
+	}
+
+	return HAL_GetTick() - start;
+}
+
+void TFTLIB_SPI::benchmark(void){
+	char buffer[32];
+	uint32_t t1 = testFillScreen();
+	uint32_t t2 = testText();
+
+	uint32_t t3 = testLines(CYAN);
+	uint32_t t4 = testFastLines(RED, BLUE);
+
+	uint32_t t5 = testRects(GREEN);
+	uint32_t t6 = testFilledRects(YELLOW, MAGENTA);
+
+	uint32_t t7 = testCircles(10, WHITE);
+	uint32_t t8 = testFilledCircles(10, MAGENTA);
+
+	uint32_t t9 = testTriangles();
+	uint32_t t10 = testFilledTriangles();
+
+	uint32_t t11 = testRoundRects();
+	uint32_t t12 = testFilledRoundRects();
+
+	uint32_t total = t1 + t2 + t3 + t4 + t5 + t6 + t7 + t8 + t9 + t10 + t11 + t12;
+
+	fillScreen(BLACK);
+
+	setFont(Font_11x18);
+	setTextColor(RED, BLACK);
+	sprintf(buffer, "Fillscreen:         %lums", t1);
+	writeString(0, 0, buffer);
+
+	sprintf(buffer, "Text:               %lums", t2);
+	writeString(0, 18, buffer);
+
+	sprintf(buffer, "Lines:              %lums", t3);
+	writeString(0, 36, buffer);
+
+	sprintf(buffer, "Hor/Vert Lines:     %lums", t4);
+	writeString(0, 54, buffer);
+
+	sprintf(buffer, "Rect(outline):      %lums", t5);
+	writeString(0, 72, buffer);
+
+	sprintf(buffer, "Rect(filled):       %lums", t6);
+	writeString(0, 90, buffer);
+
+	sprintf(buffer, "Circ(outline):      %lums", t7);
+	writeString(0, 108, buffer);
+
+	sprintf(buffer, "Circ(filled):       %lums", t8);
+	writeString(0, 126, buffer);
+
+	sprintf(buffer, "Tri(outline):       %lums", t9);
+	writeString(0, 144, buffer);
+
+	sprintf(buffer, "Tri(filled):        %lums", t10);
+	writeString(0, 162, buffer);
+
+	sprintf(buffer, "Round Rects:        %lums", t11);
+	writeString(0, 180, buffer);
+
+	sprintf(buffer, "Filled Round Rects: %lums", t12);
+	writeString(0, 198, buffer);
+
+	sprintf(buffer, "Time total:         %lums", total);
+	writeString(0, 216, buffer);
+
+	HAL_Delay(4000);
+}
+
+/***************************************************************************************
+** Function name:           Button
+** Description:             Constructor
+***************************************************************************************/
+Button::Button(void) {
+	__tft       = 0;
+	__xd        = 0;
+	__yd        = 5;
+}
+
+/***************************************************************************************
+** Function name:           ~Button
+** Description:             Destructor
+***************************************************************************************/
+Button::~Button(void) { }
+
+/***************************************************************************************
+** Function name:           initButton
+** Description:             Initialize centered button
+***************************************************************************************/
+void Button::initButton(
+	TFTLIB_SPI *tft, XPT2046_Touchscreen *ts, int16_t x, int16_t y, uint16_t w, uint16_t h,
+	uint16_t outline, uint16_t fill, uint16_t textcolor, char *label, FontDef* Font)
+{
+	initButtonUL(tft, ts, x - (w / 2), y - (h / 2), w, h, outline, fill, textcolor, label, Font);
+}
+
+/***************************************************************************************
+** Function name:           initButton
+** Description:             Classic initialize button
+***************************************************************************************/
+void Button::initButtonUL(
+	TFTLIB_SPI *tft, XPT2046_Touchscreen *ts, int16_t x1, int16_t y1, uint16_t w, uint16_t h,
+	uint16_t outline, uint16_t fill, uint16_t textcolor, char *label, FontDef* Font)
+{
+	__x1				= x1;
+	__y1				= y1;
+	__w					= w;
+	__h					= h;
+	__outlinecolor		= outline;
+	__fillcolor			= fill;
+	__textcolor			= textcolor;
+	__tft				= tft;
+	__ts				= ts;
+	__font = Font;
+	__text_w			= __font->width;
+	__text_h			= __font->height;
+	strncpy(__label, label, 19);
+}
+
+/***************************************************************************************
+** Function name:           setLabelOffset
+** Description:             Adjust text datum on x, y coordinates
+***************************************************************************************/
+void Button::setLabelOffset(int16_t x_delta, int16_t y_delta) {
+	__xd        = x_delta;
+	__yd        = y_delta;
+}
+
+/***************************************************************************************
+** Function name:           drawButton
+** Description:             Draw button with label
+***************************************************************************************/
+void Button::drawButton(bool inverted, char* long_name) {
+	uint16_t fill, outline, text;
+	uint16_t text_size = sizeof(long_name);
+
+	if(!inverted) {
+		fill    = __fillcolor;
+		outline = __outlinecolor;
+		text    = __textcolor;
+	}
+
+	else {
+		fill    = __textcolor;
+		outline = __outlinecolor;
+		text    = __fillcolor;
+		}
+
+	uint8_t r = min(__w, __h) / 2; // Corner radius
+	__tft->fillRoundRect(__x1, __y1, __w, __h, r, fill);
+	__tft->drawRoundRect(__x1, __y1, __w, __h, r, outline);
+	__tft->setTextColor(text, fill);
+	__tft->setFont(*__font);
+	if (strcmp(long_name, "") == 0) __tft->writeString(__x1 + (__w/2) + __xd - ((text_size*__text_w)/2), __y1 + (__h/2) - 4 + __yd - (__text_h/2), __label/*, *_font, text, fill*/);
+	else  __tft->writeString(__x1 + (__w/2) + __xd - ((text_size*__text_w)/2), __y1 + (__h/2) - 4 + __yd - (__text_h/2), long_name/*, *_font, text, fill*/);
+}
+
+/***************************************************************************************
+** Function name:           contains
+** Description:             Check if button is pressed in correct coordinates
+***************************************************************************************/
+bool Button::contains(int16_t x, int16_t y) {
+	return ((x >= __x1) && (x < (__x1 + __w)) && (y >= __y1) && (y < (__y1 + __h)));
+}
+
+/***************************************************************************************
+** Function name:           getBounds
+** Description:             Top-left corner and size of button
+***************************************************************************************/
+void Button::getBounds(int16_t &x, int16_t &y, uint16_t &w, uint16_t &h) {
+	x = __x1;
+	y = __y1;
+	w = __w;
+	h = __h;
+}
+
+/***************************************************************************************
+** Function name:           process
+** Description:             New process function with callbacks to set task our button
+***************************************************************************************/
+void Button::process(char* label_pressed, char* label_release, Callback btn_func, Callback end_func, XPT2046_Touchscreen &ts){
+	int32_t x = 0, y = 0;
+	ts.getTouch(&x, &y);
+	bool pressed_btn;
+
+	char info[32];
+	sprintf(info, "X = %ld, Y = %ld, RAM:%d    ", x, y, __tft->FreeRAM());
+	__tft->setTextColor(RED, WHITE);
+	__tft->writeString(0, 0, info/*, Font_11x18, YELLOW, BLUE*/);
+
+	if (ts.pressed() && contains(x, y)){
+		press(true);
+		pressed_btn = 1;
+		if (wasPressed()) drawButton(true, label_pressed);
+	}
+
+	else{
+		press(false);
+		drawButton(false, label_release);
+	}
+
+
+	if (wasReleased() && pressed_btn){
+		btn_func();
+		end_func();
+		pressed_btn = 0;
+	}
+}
+
+/***************************************************************************************
+** Function name:           press
+** Description:             Change actually button state
+***************************************************************************************/
+void Button::press(bool p) {
+	last_state = curr_state;
+	curr_state = p;
+}
+
+bool Button::isPressed()    { return curr_state; }
+bool Button::wasPressed()  { return (curr_state && !last_state); }
+bool Button::wasReleased() { return (!curr_state && last_state); }
+
+/* Natural order index of zigzag ordered coefficients */
+static const uint8_t JpegZigZag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/* Reduced size IDCT, 8 point IDCT averaged over 2 or 4 pixels, C(k)/2 * avg(cos) * cos((2m+1)k*pi/2N) in Q13 */
+static const int16_t JpegIdct4[4][8] = {
+	{ 2896,  3711,  2676,  1303, 0,  -871, -1108,  -738 },
+	{ 2896,  1537, -2676, -3146, 0,  2102,  1108,  -306 },
+	{ 2896, -1537, -2676,  3146, 0, -2102,  1108,   306 },
+	{ 2896, -3711,  2676, -1303, 0,   871, -1108,   738 },
+};
+
+static const int16_t JpegIdct2[2][8] = {
+	{ 2896,  2624, 0,  -922, 0,  616, 0, -522 },
+	{ 2896, -2624, 0,   922, 0, -616, 0,  522 },
+};
+
+/***************************************************************************************
+** Function name:           open
+** Description:             Start decoding of JPEG held in memory, reads headers
+***************************************************************************************/
+bool JPEG_Decoder::open(const uint8_t *data, uint32_t len) {
+	__in = data;
+	__in_end = data + len;
+	__reader = nullptr;
+	return parseHeaders();
+}
+
+/***************************************************************************************
+** Function name:           open
+** Description:             Start decoding of JPEG streamed by reader callback, reads headers
+***************************************************************************************/
+bool JPEG_Decoder::open(Reader reader, void *user) {
+	__in = __in_end = __in_buf;
+	__reader = reader;
+	__user = user;
+	return parseHeaders();
+}
+
+/***************************************************************************************
+** Function name:           setScale
+** Description:             Select output scale, 1/8 scale uses DC coefficients only
+***************************************************************************************/
+void JPEG_Decoder::setScale(JPEG_SCALE scale) {
+	__shift = (uint8_t)scale;
+}
+
+/***************************************************************************************
+** Function name:           width / height / failed
+** Description:             Image size at selected scale, failed is set by corrupt or
+**                          truncated data
+***************************************************************************************/
+uint16_t JPEG_Decoder::width(void) {
+	return (__width + (1 << __shift) - 1) >> __shift;
+}
+
+uint16_t JPEG_Decoder::height(void) {
+	return (__height + (1 << __shift) - 1) >> __shift;
+}
+
+bool JPEG_Decoder::failed(void) {
+	return __error || __eof;
+}
+
+/***************************************************************************************
+** Function name:           getByte
+** Description:             Next input byte, refilled from reader when streaming
+***************************************************************************************/
+inline uint8_t JPEG_Decoder::getByte(void) {
+	if (__in == __in_end) {
+		uint32_t n = __reader ? __reader(__user, __in_buf, JpegInputSize) : 0;
+		if (n == 0) {
+			__eof = true;
+			return 0;
+		}
+		__in = __in_buf;
+		__in_end = __in_buf + n;
+	}
+	return *__in++;
+}
+
+inline uint16_t JPEG_Decoder::getWord(void) {
+	uint16_t w = getByte() << 8;
+	return w | getByte();
+}
+
+/***************************************************************************************
+** Function name:           fillBits
+** Description:             Load entropy coded bytes into bit buffer, removes stuffed zero after
+**                          0xFF and stops at marker by feeding zero bits
+***************************************************************************************/
+inline void JPEG_Decoder::fillBits(void) {
+	while (__nbits <= 24) {
+		uint32_t b = 0;
+		if (!__marker && !__eof) {
+			b = getByte();
+			if (b == 0xFF) {
+				uint8_t m = getByte();
+				while (m == 0xFF) m = getByte();
+				if (m != 0) {
+					__marker = m;
+					b = 0;
+				}
+			}
+		}
+		__bits |= b << (24 - __nbits);
+		__nbits += 8;
+	}
+}
+
+/***************************************************************************************
+** Function name:           getBits
+** Description:             Read n bits and extend them to signed coefficient value
+***************************************************************************************/
+inline int32_t JPEG_Decoder::getBits(int32_t n) {
+	if (n == 0) return 0;
+	if (__nbits < n) fillBits();
+
+	int32_t v = __bits >> (32 - n);
+	__bits <<= n;
+	__nbits -= n;
+
+	if (v < (1 << (n - 1))) v += 1 - (1 << n);
+	return v;
+}
+
+/***************************************************************************************
+** Function name:           decodeHuffman
+** Description:             Decode one huffman symbol, 8 bit lookahead first
+***************************************************************************************/
+inline uint8_t JPEG_Decoder::decodeHuffman(const JpegHuffman &t) {
+	if (__nbits < 16) fillBits();
+
+	uint16_t look = t.look[__bits >> 24];
+	if (look) {
+		__bits <<= look >> 8;
+		__nbits -= look >> 8;
+		return look & 0xFF;
+	}
+
+	for (int32_t l = 9; l <= 16; l++) {
+		int32_t code = __bits >> (32 - l);
+		if (code <= t.maxcode[l]) {
+			__bits <<= l;
+			__nbits -= l;
+			return t.val[(code + t.delta[l]) & 0xFF];
+		}
+	}
+
+	__error = true;
+	return 0;
+}
+
+/***************************************************************************************
+** Function name:           buildHuffman
+** Description:             Build lookup and canonical code limits from DHT counts & symbols
+***************************************************************************************/
+bool JPEG_Decoder::buildHuffman(JpegHuffman &t, const uint8_t *counts, const uint8_t *val) {
+	int32_t code = 0, k = 0;
+
+	fill_n(t.look, 256, 0);
+	for (int32_t l = 1; l <= 16; l++) {
+		t.delta[l] = k - code;
+		for (int32_t i = 0; i < counts[l - 1]; i++, k++, code++) {
+			if (k > 255 || code >= (1 << l)) return false;
+			t.val[k] = val[k];
+			if (l <= 8) fill_n(t.look + (code << (8 - l)), 1 << (8 - l), (uint16_t)((l << 8) | val[k]));
+		}
+		t.maxcode[l] = counts[l - 1] ? code - 1 : -1;
+		code <<= 1;
+	}
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           parseHeaders
+** Description:             Read markers up to start of scan, baseline huffman frames only
+***************************************************************************************/
+bool JPEG_Decoder::parseHeaders(void) {
+	__bits = __nbits = 0;
+	__marker = 0;
+	__eof = __error = false;
+	__ncomp = 0;
+	__mcu = 0;
+	__restart_interval = 0;
+
+	if (getByte() != 0xFF || getByte() != 0xD8) return false;
+
+	while (!__eof) {
+		if (getByte() != 0xFF) return false;
+		uint8_t m = getByte();
+		while (m == 0xFF) m = getByte();
+		int32_t len = getWord() - 2;
+		if (len < 0) return false;
+
+		switch (m) {
+		case 0xC0:	// Baseline and extended sequential DCT
+		case 0xC1: {
+			if (getByte() != 8) return false;
+			__height = getWord();
+			__width = getWord();
+			__ncomp = getByte();
+			if ((__ncomp != 1 && __ncomp != 3) || __width == 0 || __height == 0) return false;
+
+			__hmax = __vmax = 1;
+			for (uint8_t i = 0; i < __ncomp; i++) {
+				JpegComponent &c = __comp[i];
+				c.id = getByte();
+				uint8_t hv = getByte();
+				c.tq = getByte() & 3;
+				c.h = (__ncomp == 1) ? 1 : hv >> 4;
+				c.v = (__ncomp == 1) ? 1 : hv & 15;
+				if (c.h < 1 || c.h > 2 || c.v < 1 || c.v > 2) return false;
+				__hmax = max(__hmax, c.h);
+				__vmax = max(__vmax, c.v);
+			}
+			if (__ncomp == 3 && (__comp[1].h != 1 || __comp[1].v != 1 || __comp[2].h != 1 || __comp[2].v != 1)) return false;
+			__mcus_x = (__width + 8 * __hmax - 1) / (8 * __hmax);
+			__mcus_y = (__height + 8 * __vmax - 1) / (8 * __vmax);
+			break;
+		}
+
+		case 0xC4: {	// Huffman tables
+			while (len > 17) {
+				uint8_t tc = getByte(), counts[16], val[256];
+				int32_t total = 0;
+				for (int32_t i = 0; i < 16; i++) total += counts[i] = getByte();
+				if (total > 256 || (tc & 0x0F) > 1 || len < 17 + total) return false;
+				for (int32_t i = 0; i < total; i++) val[i] = getByte();
+				if (!buildHuffman((tc >> 4) ? __ac[tc & 1] : __dc[tc & 1], counts, val)) return false;
+				len -= 17 + total;
+			}
+			if (len) return false;
+			break;
+		}
+
+		case 0xDB: {	// Quantization tables, kept in zigzag order
+			while (len >= 65) {
+				uint8_t pq = getByte();
+				for (int32_t i = 0; i < 64; i++) __qt[pq & 3][i] = (pq >> 4) ? getWord() : getByte();
+				len -= (pq >> 4) ? 129 : 65;
+			}
+			if (len) return false;
+			break;
+		}
+
+		case 0xDD:	// Restart interval
+			__restart_interval = getWord();
+			break;
+
+		case 0xDA: {	// Start of scan, all components interleaved
+			uint8_t ns = getByte();
+			if (__ncomp == 0 || ns != __ncomp) return false;
+			for (uint8_t i = 0; i < ns; i++) {
+				uint8_t id = getByte(), t = getByte(), j = 0;
+				while (j < __ncomp && __comp[j].id != id) j++;
+				if (j == __ncomp) return false;
+				__comp[j].td = (t >> 4) & 1;
+				__comp[j].ta = t & 1;
+				__comp[j].pred = 0;
+				__scan[i] = j;
+			}
+			getByte();
+			getByte();
+			getByte();
+			__restarts_left = __restart_interval;
+			return !__eof;
+		}
+
+		case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+		case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+		case 0xD9:	// Progressive, lossless, arithmetic coding or no image
+			return false;
+
+		default:	// APPn, COM and others
+			while (len-- > 0 && !__eof) getByte();
+			break;
+		}
+	}
+	return false;
+}
+
+/***************************************************************************************
+** Function name:           restart
+** Description:             Skip to next RSTn marker and reset DC predictors
+***************************************************************************************/
+void JPEG_Decoder::restart(void) {
+	__bits = __nbits = 0;
+
+	while (!__marker && !__eof) {
+		if (getByte() != 0xFF) continue;
+		uint8_t m = getByte();
+		while (m == 0xFF) m = getByte();
+		if (m != 0) __marker = m;
+	}
+	__marker = 0;
+
+	for (uint8_t i = 0; i < __ncomp; i++) __comp[i].pred = 0;
+}
+
+/***************************************************************************************
+** Function name:           decodeBlock
+** Description:             Huffman decode and dequantize one 8x8 block into __coef
+***************************************************************************************/
+bool JPEG_Decoder::decodeBlock(JpegComponent &c) {
+	const uint16_t *q = __qt[c.tq];
+
+	fill_n(__coef, 64, 0);
+	c.pred += getBits(decodeHuffman(__dc[c.td]) & 15);
+	__coef[0] = c.pred * q[0];
+
+	for (int32_t k = 1; k < 64; k++) {
+		uint8_t rs = decodeHuffman(__ac[c.ta]);
+		int32_t r = rs >> 4, s = rs & 15;
+		if (s == 0) {
+			if (r != 15) break;
+			k += 15;
+			continue;
+		}
+		k += r;
+		if (k > 63) return false;
+		__coef[JpegZigZag[k]] = getBits(s) * q[k];
+	}
+	return !__error;
+}
+
+/***************************************************************************************
+** Function name:           idctBlock
+** Description:             Inverse DCT of __coef to (8 >> scale)^2 pixels. Full size uses the
+**                          integer LLM algorithm, reduced sizes give box filtered pixels
+***************************************************************************************/
+void JPEG_Decoder::idctBlock(uint8_t *dst, int32_t stride) {
+	int32_t *in = __coef, *ws = __ws;
+
+	if (__shift == 3) {
+		*dst = (uint8_t)max(0, min(255, ((in[0] + 4) >> 3) + 128));
+		return;
+	}
+
+	if (__shift) {
+		int32_t n = 8 >> __shift;
+		const int16_t *t = (n == 4) ? &JpegIdct4[0][0] : &JpegIdct2[0][0];
+
+		// Columns to workspace with 2 extra fraction bits, then rows to pixels
+		for (int32_t u = 0; u < 8; u++) {
+			for (int32_t m = 0; m < n; m++) {
+				int32_t sum = 0;
+				for (int32_t k = 0; k < 8; k++) sum += t[m * 8 + k] * in[k * 8 + u];
+				ws[m * 8 + u] = (sum + (1 << 10)) >> 11;
+			}
+		}
+		for (int32_t m = 0; m < n; m++) {
+			for (int32_t u = 0; u < n; u++) {
+				int32_t sum = 0;
+				for (int32_t k = 0; k < 8; k++) sum += t[u * 8 + k] * ws[m * 8 + k];
+				dst[m * stride + u] = (uint8_t)max(0, min(255, ((sum + (1 << 14)) >> 15) + 128));
+			}
+		}
+		return;
+	}
+
+	const int32_t c0298 = 2446, c0390 = 3196, c0541 = 4433, c0765 = 6270, c0899 = 7373, c1175 = 9633;
+	const int32_t c1501 = 12299, c1847 = 15137, c1961 = 16069, c2053 = 16819, c2562 = 20995, c3072 = 25172;
+
+	for (int32_t pass = 0; pass < 2; pass++) {
+		for (int32_t i = 0; i < 8; i++) {
+			// Pass 1 works on columns of coefficients, pass 2 on rows of workspace
+			int32_t *p = pass ? ws + i * 8 : in + i;
+			int32_t st = pass ? 1 : 8;
+
+			if (!pass && !p[8] && !p[16] && !p[24] && !p[32] && !p[40] && !p[48] && !p[56]) {
+				int32_t dc = p[0] << 2;
+				for (int32_t j = 0; j < 8; j++) ws[j * 8 + i] = dc;
+				continue;
+			}
+
+			int32_t z1, z2, z3, z4, z5, t0, t1, t2, t3, t10, t11, t12, t13;
+
+			z2 = p[2 * st];
+			z3 = p[6 * st];
+			z1 = (z2 + z3) * c0541;
+			t2 = z1 - z3 * c1847;
+			t3 = z1 + z2 * c0765;
+			t0 = (p[0] + p[4 * st]) << 13;
+			t1 = (p[0] - p[4 * st]) << 13;
+			t10 = t0 + t3;
+			t13 = t0 - t3;
+			t11 = t1 + t2;
+			t12 = t1 - t2;
+
+			t0 = p[7 * st];
+			t1 = p[5 * st];
+			t2 = p[3 * st];
+			t3 = p[1 * st];
+			z1 = t0 + t3;
+			z2 = t1 + t2;
+			z3 = t0 + t2;
+			z4 = t1 + t3;
+			z5 = (z3 + z4) * c1175;
+			t0 *= c0298;
+			t1 *= c2053;
+			t2 *= c3072;
+			t3 *= c1501;
+			z1 *= -c0899;
+			z2 *= -c2562;
+			z3 = z3 * -c1961 + z5;
+			z4 = z4 * -c0390 + z5;
+			t0 += z1 + z3;
+			t1 += z2 + z4;
+			t2 += z2 + z3;
+			t3 += z1 + z4;
+
+			int32_t o[8] = { t10 + t3, t11 + t2, t12 + t1, t13 + t0, t13 - t0, t12 - t1, t11 - t2, t10 - t3 };
+			if (!pass) {
+				for (int32_t j = 0; j < 8; j++) ws[j * 8 + i] = (o[j] + (1 << 10)) >> 11;
+			}
+			else {
+				for (int32_t j = 0; j < 8; j++) dst[i * stride + j] = (uint8_t)max(0, min(255, ((o[j] + (1 << 17)) >> 18) + 128));
+			}
+		}
+	}
+}
+
+/***************************************************************************************
+** Function name:           nextMCU
+** Description:             Position and size of next MCU at selected scale, cut to image
+***************************************************************************************/
+bool JPEG_Decoder::nextMCU(uint16_t &x, uint16_t &y, uint16_t &w, uint16_t &h) {
+	if (__error || __mcu >= (uint32_t)__mcus_x * __mcus_y) return false;
+
+	uint16_t mw = (8 * __hmax) >> __shift, mh = (8 * __vmax) >> __shift;
+	x = (__mcu % __mcus_x) * mw;
+	y = (__mcu / __mcus_x) * mh;
+	w = min(mw, (uint16_t)(width() - x));
+	h = min(mh, (uint16_t)(height() - y));
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           decodeMCU
+** Description:             Decode next MCU into out as w*h swapped RGB565 (size from nextMCU),
+**                          out = nullptr only skips entropy coded data of MCU
+***************************************************************************************/
+bool JPEG_Decoder::decodeMCU(uint16_t *out) {
+	uint16_t x, y, w, h;
+	if (!nextMCU(x, y, w, h)) return false;
+
+	if (__restart_interval) {
+		if (__restarts_left == 0) {
+			restart();
+			__restarts_left = __restart_interval;
+		}
+		__restarts_left--;
+	}
+
+	int32_t n = 8 >> __shift;
+	for (uint8_t i = 0; i < __ncomp; i++) {
+		JpegComponent &c = __comp[__scan[i]];
+		for (int32_t by = 0; by < c.v; by++) {
+			for (int32_t bx = 0; bx < c.h; bx++) {
+				if (!decodeBlock(c)) {
+					__error = true;
+					return false;
+				}
+				if (out) idctBlock(&__plane[__scan[i]][by * n * c.h * n + bx * n], c.h * n);
+			}
+		}
+	}
+	__mcu++;
+	if (!out) return true;
+
+	// Colour conversion, chroma of subsampled components is repeated
+	const uint8_t *py = __plane[0], *pb = __plane[1], *pr = __plane[2];
+	int32_t sy = n * __comp[0].h, sc = n * __comp[1].h;
+	int32_t hs = (__comp[1].h < __hmax), vs = (__comp[1].v < __vmax);
+
+	for (int32_t j = 0; j < h; j++) {
+		for (int32_t i = 0; i < w; i++) {
+			int32_t Y = py[j * sy + i];
+			uint16_t c;
+			if (__ncomp == 1) {
+				c = ((Y & 0xF8) << 8) | ((Y & 0xFC) << 3) | (Y >> 3);
+			}
+			else {
+				int32_t k = (j >> vs) * sc + (i >> hs);
+				int32_t cb = pb[k] - 128, cr = pr[k] - 128;
+				int32_t r = max(0, min(255, Y + ((91881 * cr + 32768) >> 16)));
+				int32_t g = max(0, min(255, Y - ((22554 * cb + 46802 * cr + 32768) >> 16)));
+				int32_t b = max(0, min(255, Y + ((116130 * cb + 32768) >> 16)));
+				c = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+			}
+			*out++ = (c >> 8) | (c << 8);
+		}
+	}
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           setBackground
+** Description:             Set callback that restores background under sprites
+***************************************************************************************/
+void SpriteLayer::setBackground(Background bg, void *user) {
+	__bg = bg;
+	__bg_user = user;
+}
+
+/***************************************************************************************
+** Function name:           setBackground
+** Description:             Set solid background colour under sprites
+***************************************************************************************/
+void SpriteLayer::setBackground(uint16_t color) {
+	__bg = nullptr;
+	__bg_color = (color >> 8) | (color << 8);
+}
+
+/***************************************************************************************
+** Function name:           insert
+** Description:             Put sprite in list after all sprites of same or lower z
+***************************************************************************************/
+void SpriteLayer::insert(Sprite &s) {
+	uint8_t i = __count++;
+	for (; i > 0 && __sprites[i - 1]->z > s.z; i--) __sprites[i] = __sprites[i - 1];
+	__sprites[i] = &s;
+}
+
+/***************************************************************************************
+** Function name:           add
+** Description:             Add sprite to layer and draw it when visible, false when full
+***************************************************************************************/
+bool SpriteLayer::add(Sprite &s) {
+	if (find(__sprites, __sprites + __count, &s) != __sprites + __count) return true;
+	if (__count == SpriteMax) return false;
+
+	insert(s);
+	if (s.visible) redraw(s.x, s.y, s.w, s.h);
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           remove
+** Description:             Remove sprite from layer, area under it is restored
+***************************************************************************************/
+uint32_t SpriteLayer::remove(Sprite &s) {
+	Sprite **end = __sprites + __count;
+	Sprite **it = find(__sprites, end, &s);
+	if (it == end) return 0;
+
+	copy(it + 1, end, it);
+	__count--;
+	return s.visible ? redraw(s.x, s.y, s.w, s.h) : 0;
+}
+
+/***************************************************************************************
+** Function name:           show
+** Description:             Show or hide sprite
+***************************************************************************************/
+uint32_t SpriteLayer::show(Sprite &s, bool visible) {
+	if (s.visible == visible) return 0;
+	s.visible = visible;
+	return redraw(s.x, s.y, s.w, s.h);
+}
+
+/***************************************************************************************
+** Function name:           setZ
+** Description:             Change drawing order of sprite
+***************************************************************************************/
+uint32_t SpriteLayer::setZ(Sprite &s, uint8_t z) {
+	Sprite **end = __sprites + __count;
+	Sprite **it = find(__sprites, end, &s);
+	if (it == end || s.z == z) {
+		s.z = z;
+		return 0;
+	}
+
+	copy(it + 1, end, it);
+	__count--;
+	s.z = z;
+	insert(s);
+	return s.visible ? redraw(s.x, s.y, s.w, s.h) : 0;
+}
+
+/***************************************************************************************
+** Function name:           setImage
+** Description:             Change image of sprite (animation frame), same size
+***************************************************************************************/
+uint32_t SpriteLayer::setImage(Sprite &s, const uint16_t *data) {
+	if (s.data == data) return 0;
+	s.data = data;
+	return s.visible ? redraw(s.x, s.y, s.w, s.h) : 0;
+}
+
+/***************************************************************************************
+** Function name:           moveSprite
+** Description:             Move sprite to x&y, union of old and new area is sent in one
+**                          window. Distant moves send both areas separately
+***************************************************************************************/
+uint32_t SpriteLayer::moveSprite(Sprite &s, int32_t x, int32_t y) {
+	int32_t ox = s.x, oy = s.y;
+	s.x = x;
+	s.y = y;
+	if (!s.visible || (ox == x && oy == y)) return 0;
+
+	int32_t ux = min(ox, x), uy = min(oy, y);
+	int32_t uw = max(ox, x) + s.w - ux, uh = max(oy, y) + s.h - uy;
+
+	if ((int64_t)uw * uh > 2 * (int64_t)s.w * s.h) return redraw(ox, oy, s.w, s.h) + redraw(x, y, s.w, s.h);
+	return redraw(ux, uy, uw, uh);
+}
+
+/***************************************************************************************
+** Function name:           redraw
+** Description:             Redraw background and sprites of area, returns bytes sent
+***************************************************************************************/
+uint32_t SpriteLayer::redraw(int32_t x, int32_t y, int32_t w, int32_t h) {
+	__nhit = 0;
+	for (uint8_t i = 0; i < __count; i++) {
+		Sprite *s = __sprites[i];
+		if (s->visible && s->x < x + w && s->x + s->w > x && s->y < y + h && s->y + s->h > y) __hit[__nhit++] = s;
+	}
+
+	uint32_t n = __tft->drawRows(x, y, w, h, composeRow, this);
+	__bytes += n;
+	return n;
+}
+
+/***************************************************************************************
+** Function name:           composeRow
+** Description:             Row source of redraw(), background with sprites from low to high z
+***************************************************************************************/
+void SpriteLayer::composeRow(void *user, int32_t x, int32_t y, int32_t w, uint16_t *dst) {
+	SpriteLayer *l = (SpriteLayer*)user;
+
+	if (l->__bg) l->__bg(l->__bg_user, x, y, w, dst);
+	else fill_n(dst, w, l->__bg_color);
+
+	for (uint8_t i = 0; i < l->__nhit; i++) {
+		const Sprite &s = *l->__hit[i];
+		if (y < s.y || y >= s.y + s.h) continue;
+
+		int32_t x0 = max(x, s.x), x1 = min(x + w, s.x + (int32_t)s.w);
+		if (x0 >= x1) continue;
+
+		const uint16_t *p = s.data + (y - s.y) * s.w + (x0 - s.x);
+		uint16_t *d = dst + (x0 - x);
+		if (!s.keyed) {
+			copy_n(p, x1 - x0, d);
+			continue;
+		}
+
+		uint16_t key = (s.key >> 8) | (s.key << 8);
+		for (int32_t n = x1 - x0; n > 0; n--, p++, d++) {
+			if (*p != key) *d = *p;
+		}
+	}
+}
+
+/***************************************************************************************
+** Function name:           bytesSent / resetStats
+** Description:             Pixel bytes sent by all updates since last reset
+***************************************************************************************/
+uint32_t SpriteLayer::bytesSent(void) { return __bytes; }
+void SpriteLayer::resetStats(void) { __bytes = 0; }
+
+/***************************************************************************************
+** Function name:           init
+** Description:             Set gauge position, size and angles of minimum and maximum
+***************************************************************************************/
+void ArcGauge::init(TFTLIB_SPI *tft, float x, float y, float r, float thickness, float start_angle, float end_angle) {
+	__tft = tft;
+	__x = x;
+	__y = y;
+	__r = r;
+	__ir = max(r - thickness, 0.0f);
+	__start = start_angle;
+	__end = end_angle;
+}
+
+void ArcGauge::setRange(float min, float max) {
+	__min = min;
+	__max = max;
+	__value = std::max(min, std::min(max, __value));
+}
+
+void ArcGauge::setColors(uint16_t color, uint16_t track, uint16_t bg) {
+	__color = color;
+	__track = track;
+	__bg = bg;
+}
+
+/***************************************************************************************
+** Function name:           setZones
+** Description:             Colour zones sorted by value, values above last zone use colour
+**                          from setColors
+***************************************************************************************/
+void ArcGauge::setZones(const GaugeZone *zones, uint8_t count) {
+	__zones = zones;
+	__zone_count = count;
+}
+
+/***************************************************************************************
+** Function name:           setNeedle
+** Description:             Draw needle inside ring, width 0 = no needle
+***************************************************************************************/
+void ArcGauge::setNeedle(uint16_t color, float width) {
+	__needle = color;
+	__needle_w = width;
+}
+
+/***************************************************************************************
+** Function name:           setLabel
+** Description:             Print value in centre of gauge with printf format, font = nullptr
+**                          hides label. Label drawing changes font and text colour of display
+***************************************************************************************/
+void ArcGauge::setLabel(FontDef *font, uint16_t color, const char *format) {
+	__font = font;
+	__text_color = color;
+	__format = format;
+}
+
+float ArcGauge::value(void) {
+	return __value;
+}
+
+/***************************************************************************************
+** Function name:           valueAngle
+** Description:             Angle of value on gauge
+***************************************************************************************/
+float ArcGauge::valueAngle(float value) {
+	if (__max <= __min) return __start;
+	return __start + (value - __min) * (__end - __start) / (__max - __min);
+}
+
+/***************************************************************************************
+** Function name:           drawSector
+** Description:             Draw ring between two values. Ends inside gauge are hard so
+**                          sectors drawn later join without seam, gauge ends are smooth
+***************************************************************************************/
+void ArcGauge::drawSector(float from, float to, uint16_t color) {
+	if (to <= from) return;
+
+	float a0 = valueAngle(from), a1 = valueAngle(to);
+	bool smooth_start = (from <= __min), smooth_end = (to >= __max);
+	if (a1 < a0) {
+		swap(a0, a1);
+		swap(smooth_start, smooth_end);
+	}
+	__tft->drawArcAA(__x, __y, __r, __ir, a0, a1, color, __bg, smooth_start, smooth_end);
+}
+
+/***************************************************************************************
+** Function name:           drawValueArc
+** Description:             Draw value part of ring between two values, split at zone ends
+***************************************************************************************/
+void ArcGauge::drawValueArc(float from, float to) {
+	uint8_t i = 0;
+	while (from < to) {
+		while (i < __zone_count && __zones[i].to <= from) i++;
+
+		float end = (i < __zone_count) ? min(to, __zones[i].to) : to;
+		drawSector(from, end, (i < __zone_count) ? __zones[i].color : __color);
+		from = end;
+	}
+}
+
+/***************************************************************************************
+** Function name:           drawNeedle
+** Description:             Draw needle pointing at value, bg colour erases it
+***************************************************************************************/
+void ArcGauge::drawNeedle(float value, uint16_t color) {
+	int32_t s, c;
+	sinCosDeg(valueAngle(value), s, c);
+
+	float dx = s / 65536.0f, dy = -c / 65536.0f;
+	float r0 = __ir * 0.3f, r1 = max(__ir - 3.0f, r0);
+	__tft->drawWedgeLine(__x + dx * r0, __y + dy * r0, __x + dx * r1, __y + dy * r1, __needle_w / 2, 0.5f, color, __bg);
+}
+
+/***************************************************************************************
+** Function name:           drawLabel
+** Description:             Print value centred in gauge, rest of previous label is cleared
+***************************************************************************************/
+void ArcGauge::drawLabel(void) {
+	char text[16];
+	snprintf(text, sizeof(text), __format, __value);
+
+	int32_t w = strlen(text) * __font->width, h = __font->height;
+	int32_t x = (int32_t)__x - w / 2, y = (int32_t)__y - h / 2;
+
+	if (__label_w > w) {
+		int32_t xo = (int32_t)__x - __label_w / 2;
+		__tft->fillRect(xo, y, x - xo, h, __bg);
+		__tft->fillRect(x + w, y, xo + __label_w - x - w, h, __bg);
+	}
+	__label_w = w;
+
+	__tft->setFont(*__font);
+	__tft->setTextColor(__text_color, __bg);
+	__tft->writeString(x, y, text);
+}
+
+/***************************************************************************************
+** Function name:           draw
+** Description:             Draw whole gauge
+***************************************************************************************/
+void ArcGauge::draw(void) {
+	if (__tft == nullptr) return;
+
+	drawValueArc(__min, __value);
+	drawSector(__value, __max, __track);
+	if (__font) drawLabel();
+	if (__needle_w > 0) drawNeedle(__value, __needle);
+}
+
+/***************************************************************************************
+** Function name:           setValue
+** Description:             Change value and redraw only changed part of ring, needle and label
+***************************************************************************************/
+void ArcGauge::setValue(float value) {
+	value = max(__min, min(__max, value));
+	float old = __value;
+	if (value == old) return;
+	__value = value;
+	if (__tft == nullptr) return;
+
+	if (__needle_w > 0) drawNeedle(old, __bg);
+
+	if (value > old) drawValueArc(old, value);
+	else drawSector(value, old, __track);
+
+	if (__font) drawLabel();
+	if (__needle_w > 0) drawNeedle(value, __needle);
+}
+
+/***************************************************************************************
+** Function name:           ~StripChart
+** Description:             Destructor
+***************************************************************************************/
+StripChart::~StripChart(void) {
+	delete[] __hist;
+	delete[] __column;
+}
+
+/***************************************************************************************
+** Function name:           init
+** Description:             Set chart area, number of traces and samples per column. Returns
+**                          false when hardware scroll is not possible, ring is used then
+***************************************************************************************/
+bool StripChart::init(TFTLIB_SPI *tft, int32_t x, int32_t y, int16_t w, int16_t h, uint8_t traces, uint16_t samples_per_column, CHART_SCROLL mode) {
+	if (w <= 0 || h <= 0) return false;
+
+	delete[] __hist;
+	delete[] __column;
+
+	__tft = tft;
+	__x = x;
+	__y = y;
+	__w = w;
+	__h = h;
+	__traces = max((uint8_t)1, min(traces, ChartTraces));
+	__spc = max(samples_per_column, (uint16_t)1);
+	__hist = new float[w * __traces * 2];
+	__column = new uint16_t[h];
+	__samples = __head = __filled = 0;
+	__columns = 0;
+
+	// Panel rows run along screen x in rotation 1 (ascending) and 3 (descending)
+	__mode = CHART_SCROLL::RING;
+	uint8_t rot = tft->getRotation();
+	int32_t rows = tft->width();
+	if (mode == CHART_SCROLL::HARDWARE && (rot & 1) && y == 0 && h == tft->height() && x >= 0 && x + w <= rows) {
+		__mode = CHART_SCROLL::HARDWARE;
+		__reverse = (rot == 3);
+		__tfa = __reverse ? rows - x - w : x;
+		tft->setScrollArea(__tfa, w, rows - __tfa - w);
+	}
+	return __mode == mode;
+}
+
+void StripChart::setTraceColor(uint8_t trace, uint16_t color) {
+	if (trace < ChartTraces) __colors[trace] = color;
+}
+
+void StripChart::setColors(uint16_t bg, uint16_t grid) {
+	__bg = bg;
+	__grid = grid;
+}
+
+/***************************************************************************************
+** Function name:           setGrid
+** Description:             Horizontal grid of rows divisions, vertical line every columns,
+**                          0 = none
+***************************************************************************************/
+void StripChart::setGrid(uint8_t rows, uint16_t columns) {
+	__grid_rows = rows;
+	__grid_cols = columns;
+}
+
+void StripChart::setRange(float min, float max) {
+	__min = min;
+	__max = max;
+}
+
+void StripChart::setAutoscale(bool autoscale) {
+	__autoscale = autoscale;
+}
+
+/***************************************************************************************
+** Function name:           addSample
+** Description:             Add sample to all traces, for single trace charts
+***************************************************************************************/
+void StripChart::addSample(float value) {
+	float values[ChartTraces];
+	fill_n(values, ChartTraces, value);
+	addSamples(values);
+}
+
+/***************************************************************************************
+** Function name:           addSamples
+** Description:             Add one sample of every trace, column is drawn when complete
+***************************************************************************************/
+void StripChart::addSamples(const float *values) {
+	if (__tft == nullptr) return;
+
+	for (uint8_t t = 0; t < __traces; t++) {
+		if (__samples == 0 || values[t] < __lo[t]) __lo[t] = values[t];
+		if (__samples == 0 || values[t] > __hi[t]) __hi[t] = values[t];
+	}
+	if (++__samples >= __spc) addColumn();
+}
+
+/***************************************************************************************
+** Function name:           addColumn
+** Description:             Store min/max envelope of finished column and draw it
+***************************************************************************************/
+void StripChart::addColumn(void) {
+	uint16_t slot = __head;
+	float *p = __hist + slot * __traces * 2;
+	for (uint8_t t = 0; t < __traces; t++) {
+		p[2 * t] = __lo[t];
+		p[2 * t + 1] = __hi[t];
+	}
+
+	__samples = 0;
+	__head = (slot + 1) % __w;
+	__columns++;
+	if (__filled < __w) __filled++;
+
+	// Range check of new column only, shrinking is checked once per chart width
+	if (__autoscale && rescale(__columns % __w == 0)) {
+		draw();
+		return;
+	}
+
+	drawColumn(slot);
+	if (__mode == CHART_SCROLL::RING) drawColumn(__head);
+	else scroll();
+}
+
+/***************************************************************************************
+** Function name:           rescale
+** Description:             Fit range to history with 10% margin when new column is out of
+**                          range or (shrink) data uses less than half of range
+***************************************************************************************/
+bool StripChart::rescale(bool shrink) {
+	bool grow = false;
+	for (uint8_t t = 0; t < __traces; t++) {
+		if (__lo[t] < __min || __hi[t] > __max) grow = true;
+	}
+	if (!grow && !shrink) return false;
+
+	float lo = __lo[0], hi = __hi[0];
+	for (uint16_t age = 0; age < __filled; age++) {
+		const float *p = __hist + ((__head + __w - 1 - age) % __w) * __traces * 2;
+		for (uint8_t t = 0; t < 2 * __traces; t++) {
+			lo = min(lo, p[t]);
+			hi = max(hi, p[t]);
+		}
+	}
+	if (!grow && (hi - lo) * 2 > __max - __min) return false;
+
+	float margin = (hi > lo) ? (hi - lo) * 0.1f : max(fabsf(hi) * 0.1f, 1.0f);
+	__min = lo - margin;
+	__max = hi + margin;
+	return true;
+}
+
+/***************************************************************************************
+** Function name:           valueY
+** Description:             Row of value inside chart
+***************************************************************************************/
+int32_t StripChart::valueY(float value) {
+	if (__max <= __min) return __h - 1;
+	int32_t y = (int32_t)lroundf((__max - value) * (__h - 1) / (__max - __min));
+	return max((int32_t)0, min(y, (int32_t)__h - 1));
+}
+
+/***************************************************************************************
+** Function name:           drawColumn
+** Description:             Compose column of background, grid and trace envelopes and send
+**                          it as one vertical span. Envelope is stretched to meet previous
+**                          column so steep traces stay connected
+***************************************************************************************/
+void StripChart::drawColumn(uint16_t slot) {
+	uint16_t bg = (__bg >> 8) | (__bg << 8), grid = (__grid >> 8) | (__grid << 8);
+	int32_t age = (__head + __w - 1 - slot) % __w;
+
+	// Ring keeps oldest slot empty as gap in front of newest column
+	auto visible = [&](int32_t a) { return a < __filled && !(__mode == CHART_SCROLL::RING && a == __w - 1); };
+
+	fill_n(__column, __h, bg);
+
+	// Vertical grid stays on screen for ring, moves with data for hardware scroll
+	int64_t n = (__mode == CHART_SCROLL::RING) ? slot : (int64_t)__columns - 1 - age;
+	if (__grid_cols && n % __grid_cols == 0) fill_n(__column, __h, grid);
+	for (int32_t r = 0; __grid_rows && r <= __grid_rows; r++) __column[r * (__h - 1) / __grid_rows] = grid;
+
+	if (visible(age)) {
+		const float *p = __hist + slot * __traces * 2;
+		const float *q = __hist + ((slot + __w - 1) % __w) * __traces * 2;
+		bool joined = visible(age + 1);
+
+		for (uint8_t t = 0; t < __traces; t++) {
+			int32_t y0 = valueY(p[2 * t + 1]), y1 = valueY(p[2 * t]);
+			if (joined) {
+				y0 = min(y0, valueY(q[2 * t]));
+				y1 = max(y1, valueY(q[2 * t + 1]));
+			}
+			fill_n(__column + y0, y1 - y0 + 1, (uint16_t)((__colors[t] >> 8) | (__colors[t] << 8)));
+		}
+	}
+
+	__tft->drawImage(__x + slot, __y, 1, __h, __column);
+}
+
+/***************************************************************************************
+** Function name:           scroll
+** Description:             Scroll panel so newest column is at right edge of chart
+***************************************************************************************/
+void StripChart::scroll(void) {
+	__tft->scrollTo(__tfa + (__reverse ? (__w - __head) % __w : __head));
+}
+
+/***************************************************************************************
+** Function name:           draw
+** Description:             Draw whole chart from history
+***************************************************************************************/
+void StripChart::draw(void) {
+	if (__tft == nullptr) return;
+
+	for (uint16_t s = 0; s < __w; s++) drawColumn(s);
+	if (__mode == CHART_SCROLL::HARDWARE) scroll();
+}
+
+/***************************************************************************************
+** Function name:           end
+** Description:             Switch hardware scroll off, screen has to be redrawn after
+***************************************************************************************/
+void StripChart::end(void) {
+	if (__tft == nullptr || __mode != CHART_SCROLL::HARDWARE) return;
+
+	__tft->setScrollArea(0, __tft->width(), 0);
+	__tft->scrollTo(0);
+}
+
+/***************************************************************************************
+** Function name:           ~WidgetManager
+** Description:             Destructor
+***************************************************************************************/
+WidgetManager::~WidgetManager(void) {
+	delete[] __cell_start;
+	delete[] __cell_items;
+}
+
+/***************************************************************************************
+** Function name:           add
+** Description:             Add widget, returns its id or -1 when full. Widget is drawn on
+**                          next update()
+***************************************************************************************/
+int16_t WidgetManager::add(int16_t x, int16_t y, int16_t w, int16_t h, WidgetDraw draw, WidgetHandler handler, void *user) {
+	if (draw == nullptr || w <= 0 || h <= 0) return -1;
+
+	uint8_t id = 0;
+	while (id < __count && __widgets[id].draw != nullptr) id++;
+	if (id == WidgetMax) return -1;
+	if (id == __count) __count++;
+
+	// Slot may still be queued for redraw from before it was removed
+	__widgets[id] = { x, y, w, h, draw, handler, user, nullptr, WIDGET_STATE::NORMAL, true, __widgets[id].dirty };
+	__grid_valid = false;
+	mark(id);
+	return id;
+}
+
+/***************************************************************************************
+** Function name:           add
+** Description:             Add Button, it is drawn inverted while pressed
+***************************************************************************************/
+int16_t WidgetManager::add(Button &btn, WidgetHandler handler, void *user) {
+	int16_t x, y;
+	uint16_t w, h;
+	btn.getBounds(x, y, w, h);
+
+	int16_t id = add(x, y, w, h, drawButton, handler, user);
+	if (id >= 0) __widgets[id].data = &btn;
+	return id;
+}
+
+/***************************************************************************************
+** Function name:           drawButton
+** Description:             Draw callback of Button widgets
+***************************************************************************************/
+void WidgetManager::drawButton(TFTLIB_SPI *, const Widget &w) {
+	((Button*)w.data)->drawButton(w.state == WIDGET_STATE::PRESSED);
+}
+
+/***************************************************************************************
+** Function name:           remove
+** Description:             Remove widget, area under it is not cleared
+***************************************************************************************/
+void WidgetManager::remove(uint8_t id) {
+	if (id >= __count) return;
+
+	__widgets[id].draw = nullptr;
+	while (__count && __widgets[__count - 1].draw == nullptr) __count--;
+	if (__active == id) __active = -1;
+	__grid_valid = false;
+}
+
+/***************************************************************************************
+** Function name:           get
+** Description:             Widget of id, nullptr when not in use
+***************************************************************************************/
+Widget *WidgetManager::get(uint8_t id) {
+	return (id < __count && __widgets[id].draw) ? &__widgets[id] : nullptr;
+}
+
+/***************************************************************************************
+** Function name:           setState
+** Description:             Set state by application, widget is redrawn if it changed
+***************************************************************************************/
+void WidgetManager::setState(uint8_t id, WIDGET_STATE state) {
+	Widget *w = get(id);
+	if (w == nullptr || w->state == state) return;
+
+	w->state = state;
+	if (state == WIDGET_STATE::DISABLED && __active == id) __active = -1;
+	mark(id);
+}
+
+/***************************************************************************************
+** Function name:           setVisible
+** Description:             Hidden widgets are not drawn nor hit, area is not cleared
+***************************************************************************************/
+void WidgetManager::setVisible(uint8_t id, bool visible) {
+	Widget *w = get(id);
+	if (w == nullptr || w->visible == visible) return;
+
+	w->visible = visible;
+	if (!visible && __active == id) __active = -1;
+	__grid_valid = false;
+	mark(id);
+}
+
+/***************************************************************************************
+** Function name:           invalidate
+** Description:             Redraw widget on next update(), e.g. after its content changed
+***************************************************************************************/
+void WidgetManager::invalidate(uint8_t id) {
+	if (get(id)) mark(id);
+}
+
+/***************************************************************************************
+** Function name:           layoutChanged
+** Description:             Rebuild hit grid after widgets were moved or display rotated
+***************************************************************************************/
+void WidgetManager::layoutChanged(void) {
+	__grid_valid = false;
+}
+
+/***************************************************************************************
+** Function name:           mark
+** Description:             Queue widget for redraw once
+***************************************************************************************/
+void WidgetManager::mark(uint8_t id) {
+	if (__widgets[id].dirty) return;
+	__widgets[id].dirty = true;
+	__dirty[__dirty_n++] = id;
+}
+
+/***************************************************************************************
+** Function name:           buildGrid
+** Description:             Bucket visible widgets into every grid cell they overlap
+***************************************************************************************/
+void WidgetManager::buildGrid(void) {
+	__cols = (__tft->width() + (1 << WidgetGridShift) - 1) >> WidgetGridShift;
+	__rows = (__tft->height() + (1 << WidgetGridShift) - 1) >> WidgetGridShift;
+	uint16_t cells = __cols * __rows;
+
+	// Cell range of widget clipped to screen, false when fully outside
+	auto range = [&](const Widget &w, int32_t &c0, int32_t &r0, int32_t &c1, int32_t &r1) {
+		c0 = max((int32_t)0, (int32_t)w.x >> WidgetGridShift);
+		r0 = max((int32_t)0, (int32_t)w.y >> WidgetGridShift);
+		c1 = min((int32_t)__cols - 1, (int32_t)(w.x + w.w - 1) >> WidgetGridShift);
+		r1 = min((int32_t)__rows - 1, (int32_t)(w.y + w.h - 1) >> WidgetGridShift);
+		return w.draw && w.visible && c0 <= c1 && r0 <= r1;
+	};
+
+	delete[] __cell_start;
+	__cell_start = new uint16_t[cells + 1]();
+
+	int32_t c0, r0, c1, r1;
+	for (uint8_t i = 0; i < __count; i++) {
+		if (!range(__widgets[i], c0, r0, c1, r1)) continue;
+		for (int32_t r = r0; r <= r1; r++)
+			for (int32_t c = c0; c <= c1; c++) __cell_start[r * __cols + c + 1]++;
+	}
+	for (uint16_t c = 0; c < cells; c++) __cell_start[c + 1] += __cell_start[c];
+
+	delete[] __cell_items;
+	__cell_items = new uint8_t[max((uint16_t)1, __cell_start[cells])];
+
+	// Fill in id order, later widgets are on top
+	uint16_t *fill = new uint16_t[cells];
+	copy_n(__cell_start, cells, fill);
+	for (uint8_t i = 0; i < __count; i++) {
+		if (!range(__widgets[i], c0, r0, c1, r1)) continue;
+		for (int32_t r = r0; r <= r1; r++)
+			for (int32_t c = c0; c <= c1; c++) __cell_items[fill[r * __cols + c]++] = i;
+	}
+	delete[] fill;
+
+	__grid_valid = true;
+}
+
+/***************************************************************************************
+** Function name:           hit
+** Description:             Topmost enabled widget at screen point, -1 for none
+***************************************************************************************/
+int16_t WidgetManager::hit(int32_t x, int32_t y) {
+	if (!__grid_valid) buildGrid();
+
+	int32_t c = x >> WidgetGridShift, r = y >> WidgetGridShift;
+	if (x < 0 || y < 0 || c >= __cols || r >= __rows) return -1;
+
+	uint16_t cell = r * __cols + c;
+	for (int32_t k = __cell_start[cell + 1] - 1; k >= (int32_t)__cell_start[cell]; k--) {
+		const Widget &w = __widgets[__cell_items[k]];
+		if (w.state != WIDGET_STATE::DISABLED && x >= w.x && x < w.x + w.w && y >= w.y && y < w.y + w.h) return __cell_items[k];
+	}
+	return -1;
+}
+
+/***************************************************************************************
+** Function name:           touch
+** Description:             Track pen over widget pressed at DOWN and send its events
+***************************************************************************************/
+void WidgetManager::touch(TOUCH_EVENT type, int32_t x, int32_t y) {
+	if (type == TOUCH_EVENT::DOWN) {
+		__active = hit(x, y);
+		if (__active < 0) return;
+
+		setState(__active, WIDGET_STATE::PRESSED);
+		Widget &w = __widgets[__active];
+		if (w.handler) w.handler(__active, WIDGET_EVENT::PRESS, w.user);
+		return;
 	}
 
-	return HAL_GetTick() - start;
+	if (__active < 0) return;
+	Widget &w = __widgets[__active];
+	bool inside = x >= w.x && x < w.x + w.w && y >= w.y && y < w.y + w.h;
+
+	if (type == TOUCH_EVENT::MOVE) {
+		// Sliding off shows widget released, sliding back presses it again
+		setState(__active, inside ? WIDGET_STATE::PRESSED : WIDGET_STATE::NORMAL);
+		return;
+	}
+
+	uint8_t id = __active;
+	__active = -1;
+	setState(id, WIDGET_STATE::NORMAL);
+	if (w.handler) w.handler(id, inside ? WIDGET_EVENT::CLICK : WIDGET_EVENT::CANCEL, w.user);
 }
 
-uint32_t TFTLIB_SPI::testFilledTriangles() {
-	unsigned long start, t = 0;
-	int           i, cx = _width  / 2 - 1,
-				   cy = _height / 2 - 1;
+/***************************************************************************************
+** Function name:           drawAll
+** Description:             Draw every visible widget
+***************************************************************************************/
+void WidgetManager::drawAll(void) {
+	for (uint8_t i = 0; i < __count; i++) {
+		Widget &w = __widgets[i];
+		w.dirty = false;
+		if (w.draw && w.visible) w.draw(__tft, w);
+	}
+	__dirty_n = 0;
+}
 
-	fillScreen(BLACK);
-	start = HAL_GetTick();
-	for (i = min(cx, cy); i > 10; i -= 5) {
-		start = HAL_GetTick();
-		fillTriangle(cx, cy - i, cx - i, cy + i, cx + i, cy + i, color565(0, i, i));
-		t += HAL_GetTick() - start;
-		drawTriangle(cx, cy - i, cx - i, cy + i, cx + i, cy + i, color565(i, i, 0));
+/***************************************************************************************
+** Function name:           update
+** Description:             One tick: read touch once (queued events when touch runs
+**                          async), dispatch to widget under pen and redraw changed widgets
+***************************************************************************************/
+void WidgetManager::update(void) {
+	if (__ts != nullptr) {
+		if (__ts->isAsync()) {
+			TouchEvent e;
+			while (__ts->pollEvent(e)) touch(e.type, e.x, e.y);
+		}
+		else {
+			int32_t x, y;
+			bool down = __ts->getTouch(&x, &y);
+
+			if (down && !__down) touch(TOUCH_EVENT::DOWN, x, y);
+			else if (down && (x != __last_x || y != __last_y)) touch(TOUCH_EVENT::MOVE, x, y);
+			else if (!down && __down) touch(TOUCH_EVENT::UP, __last_x, __last_y);
+
+			__down = down;
+			if (down) {
+				__last_x = x;
+				__last_y = y;
+			}
+		}
 	}
 
-	return t;
+	// Handlers may have changed widgets, draw in order of change
+	for (uint8_t i = 0; i < __dirty_n; i++) {
+		Widget &w = __widgets[__dirty[i]];
+		w.dirty = false;
+		if (w.draw && w.visible) w.draw(__tft, w);
+	}
+	__dirty_n = 0;
 }
 
-uint32_t TFTLIB_SPI::testRoundRects() {
-	unsigned long start;
-	int           w, i, i2,
-				cx = _width  / 2 - 1,
-				cy = _height / 2 - 1;
+/***************************************************************************************
+** Function name:           RenderQueue
+** Description:             Constructor, slot i waits for ticket i
+***************************************************************************************/
+RenderQueue::RenderQueue(TFTLIB_SPI *tft) : __tft(tft), __tail(0), __drops(0), __producers(0) {
+	for (uint8_t i = 0; i < RenderQueueSize; i++) __slots[i].seq.store(i, memory_order_relaxed);
+	for (uint8_t i = 0; i < RenderMaxProducers; i++) __text[i] = { &Font_11x18, RED, BLACK, 0, 0 };
+}
 
-	fillScreen(BLACK);
-	w     = min(_height, _width);
-	start = HAL_GetTick();
-	for (i = 0; i < w; i += 6) {
-		i2 = i / 2;
-		drawRoundRect(cx - i2, cy - i2, i, i, i / 8, color565(i, 0, 0));
-	}
+/***************************************************************************************
+** Function name:           addProducer
+** Description:             Id for text commands of one task, -1 when all are taken
+***************************************************************************************/
+int8_t RenderQueue::addProducer(void) {
+	uint8_t id = __producers.load(memory_order_relaxed);
+	do {
+		if (id == RenderMaxProducers) return -1;
+	} while (!__producers.compare_exchange_weak(id, id + 1, memory_order_relaxed));
+	return id;
+}
 
-	return HAL_GetTick() - start;
+/***************************************************************************************
+** Function name:           setNotify
+** Description:             Called after every queued command, e.g. to wake render task.
+**                          Set before producers start
+***************************************************************************************/
+void RenderQueue::setNotify(RenderNotify notify, void *user) {
+	__notify = notify;
+	__notify_user = user;
 }
 
-uint32_t TFTLIB_SPI::testFilledRoundRects() {
-	unsigned long start;
-	int           i, i2,
-				cx = _width  / 2 - 1,
-				cy = _height / 2 - 1;
+uint32_t RenderQueue::drops(void) {
+	return __drops.load(memory_order_relaxed);
+}
 
-	fillScreen(BLACK);
-	start = HAL_GetTick();
-	for (i = min(_width , _height); i > 20; i -= 6) {
-		i2 = i / 2;
-		fillRoundRect(cx - i2, cy - i2, i, i, i / 8, color565(0, i, 0));
+/***************************************************************************************
+** Function name:           push
+** Description:             Claim ticket of free slot by CAS on tail, copy command and
+**                          publish it with ticket + 1
+***************************************************************************************/
+bool RenderQueue::push(const RenderCmd &cmd) {
+	uint32_t pos = __tail.load(memory_order_relaxed);
+	RenderSlot *slot;
+
+	for (;;) {
+		slot = &__slots[pos % RenderQueueSize];
+		int32_t diff = (int32_t)(slot->seq.load(memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (__tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+		}
+		else if (diff < 0) {
+			// Slot not yet drained by render task
+			__drops.fetch_add(1, memory_order_relaxed);
+			return false;
+		}
+		else pos = __tail.load(memory_order_relaxed);
 	}
 
-	return HAL_GetTick() - start;
+	slot->cmd = cmd;
+	slot->seq.store(pos + 1, memory_order_release);
+	if (__notify) __notify(__notify_user);
+	return true;
 }
 
-void TFTLIB_SPI::benchmark(void){
-	char buffer[32];
-	uint32_t t1 = testFillScreen();
-	uint32_t t2 = testText();
+bool RenderQueue::shape(RENDER_OP op, int16_t a0, int16_t a1, int16_t a2, int16_t a3, int16_t a4, int16_t a5, uint16_t color) {
+	RenderCmd cmd;
+	cmd.op = op;
+	cmd.color = color;
+	cmd.a[0] = a0; cmd.a[1] = a1; cmd.a[2] = a2;
+	cmd.a[3] = a3; cmd.a[4] = a4; cmd.a[5] = a5;
+	return push(cmd);
+}
 
-	uint32_t t3 = testLines(CYAN);
-	uint32_t t4 = testFastLines(RED, BLUE);
+bool RenderQueue::text(RENDER_OP op, uint8_t producer, const char *str) {
+	if (producer >= RenderMaxProducers) return false;
 
-	uint32_t t5 = testRects(GREEN);
-	uint32_t t6 = testFilledRects(YELLOW, MAGENTA);
+	RenderCmd cmd;
+	cmd.op = op;
+	cmd.producer = producer;
+	strncpy(cmd.text, str, RenderTextMax - 1);
+	cmd.text[RenderTextMax - 1] = 0;
+	return push(cmd);
+}
 
-	uint32_t t7 = testCircles(10, WHITE);
-	uint32_t t8 = testFilledCircles(10, MAGENTA);
+bool RenderQueue::fillScreen(uint16_t color) {
+	return shape(RENDER_OP::FILL_SCREEN, 0, 0, 0, 0, 0, 0, color);
+}
 
-	uint32_t t9 = testTriangles();
-	uint32_t t10 = testFilledTriangles();
+bool RenderQueue::drawPixel(int16_t x, int16_t y, uint16_t color) {
+	return shape(RENDER_OP::DRAW_PIXEL, x, y, 0, 0, 0, 0, color);
+}
 
-	uint32_t t11 = testRoundRects();
-	uint32_t t12 = testFilledRoundRects();
+bool RenderQueue::drawLine(int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t color) {
+	return shape(RENDER_OP::DRAW_LINE, x1, y1, x2, y2, 0, 0, color);
+}
 
-	uint32_t total = t1 + t2 + t3 + t4 + t5 + t6 + t7 + t8 + t9 + t10 + t11 + t12;
+bool RenderQueue::drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
+	return shape(RENDER_OP::DRAW_HLINE, x, y, w, 0, 0, 0, color);
+}
 
-	fillScreen(BLACK);
+bool RenderQueue::drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
+	return shape(RENDER_OP::DRAW_VLINE, x, y, h, 0, 0, 0, color);
+}
 
-	setFont(Font_11x18);
-	setTextColor(RED, BLACK);
-	sprintf(buffer, "Fillscreen:         %lums", t1);
-	writeString(0, 0, buffer);
+bool RenderQueue::drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+	return shape(RENDER_OP::DRAW_RECT, x, y, w, h, 0, 0, color);
+}
 
-	sprintf(buffer, "Text:               %lums", t2);
-	writeString(0, 18, buffer);
+bool RenderQueue::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+	return shape(RENDER_OP::FILL_RECT, x, y, w, h, 0, 0, color);
+}
 
-	sprintf(buffer, "Lines:              %lums", t3);
-	writeString(0, 36, buffer);
+bool RenderQueue::drawRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t color) {
+	return shape(RENDER_OP::DRAW_ROUND_RECT, x, y, w, h, r, 0, color);
+}
 
-	sprintf(buffer, "Hor/Vert Lines:     %lums", t4);
-	writeString(0, 54, buffer);
+bool RenderQueue::fillRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t color) {
+	return shape(RENDER_OP::FILL_ROUND_RECT, x, y, w, h, r, 0, color);
+}
 
-	sprintf(buffer, "Rect(outline):      %lums", t5);
-	writeString(0, 72, buffer);
+bool RenderQueue::drawCircle(int16_t x, int16_t y, int16_t r, uint16_t color) {
+	return shape(RENDER_OP::DRAW_CIRCLE, x, y, r, 0, 0, 0, color);
+}
 
-	sprintf(buffer, "Rect(filled):       %lums", t6);
-	writeString(0, 90, buffer);
+bool RenderQueue::fillCircle(int16_t x, int16_t y, int16_t r, uint16_t color) {
+	return shape(RENDER_OP::FILL_CIRCLE, x, y, r, 0, 0, 0, color);
+}
 
-	sprintf(buffer, "Circ(outline):      %lums", t7);
-	writeString(0, 108, buffer);
+bool RenderQueue::drawTriangle(int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t x3, int16_t y3, uint16_t color) {
+	return shape(RENDER_OP::DRAW_TRIANGLE, x1, y1, x2, y2, x3, y3, color);
+}
 
-	sprintf(buffer, "Circ(filled):       %lums", t8);
-	writeString(0, 126, buffer);
+bool RenderQueue::fillTriangle(int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t x3, int16_t y3, uint16_t color) {
+	return shape(RENDER_OP::FILL_TRIANGLE, x1, y1, x2, y2, x3, y3, color);
+}
 
-	sprintf(buffer, "Tri(outline):       %lums", t9);
-	writeString(0, 144, buffer);
+bool RenderQueue::setCursor(uint8_t producer, int16_t x, int16_t y) {
+	if (producer >= RenderMaxProducers) return false;
 
-	sprintf(buffer, "Tri(filled):        %lums", t10);
-	writeString(0, 162, buffer);
+	RenderCmd cmd;
+	cmd.op = RENDER_OP::SET_CURSOR;
+	cmd.producer = producer;
+	cmd.a[0] = x;
+	cmd.a[1] = y;
+	return push(cmd);
+}
 
-	sprintf(buffer, "Round Rects:        %lums", t11);
-	writeString(0, 180, buffer);
+bool RenderQueue::setTextColor(uint8_t producer, uint16_t fg, uint16_t bg) {
+	if (producer >= RenderMaxProducers) return false;
 
-	sprintf(buffer, "Filled Round Rects: %lums", t12);
-	writeString(0, 198, buffer);
+	RenderCmd cmd;
+	cmd.op = RENDER_OP::SET_TEXT_COLOR;
+	cmd.producer = producer;
+	cmd.color = fg;
+	cmd.bg = bg;
+	return push(cmd);
+}
 
-	sprintf(buffer, "Time total:         %lums", total);
-	writeString(0, 216, buffer);
+bool RenderQueue::setFont(uint8_t producer, FontDef &font) {
+	if (producer >= RenderMaxProducers) return false;
 
-	HAL_Delay(4000);
+	RenderCmd cmd;
+	cmd.op = RENDER_OP::SET_FONT;
+	cmd.producer = producer;
+	cmd.font = &font;
+	return push(cmd);
 }
 
-/***************************************************************************************
-** Function name:           Button
-** Description:             Constructor
-***************************************************************************************/
-Button::Button(void) {
-	__tft       = 0;
-	__xd        = 0;
-	__yd        = 5;
+bool RenderQueue::print(uint8_t producer, const char *str) {
+	return text(RENDER_OP::PRINT, producer, str);
 }
 
-/***************************************************************************************
-** Function name:           ~Button
-** Description:             Destructor
-***************************************************************************************/
-Button::~Button(void) { }
+bool RenderQueue::println(uint8_t producer, const char *str) {
+	return text(RENDER_OP::PRINTLN, producer, str);
+}
 
 /***************************************************************************************
-** Function name:           initButton
-** Description:             Initialize centered button
+** Function name:           call
+** Description:             Queue callback for drawing without own command, user data has
+**                          to stay valid until it ran
 ***************************************************************************************/
-void Button::initButton(
-	TFTLIB_SPI *tft, XPT2046_Touchscreen *ts, int16_t x, int16_t y, uint16_t w, uint16_t h,
-	uint16_t outline, uint16_t fill, uint16_t textcolor, char *label, FontDef* Font)
-{
-	initButtonUL(tft, ts, x - (w / 2), y - (h / 2), w, h, outline, fill, textcolor, label, Font);
+bool RenderQueue::call(RenderCall fn, void *user) {
+	RenderCmd cmd;
+	cmd.op = RENDER_OP::CALL;
+	cmd.call = fn;
+	cmd.user = user;
+	return push(cmd);
 }
 
 /***************************************************************************************
-** Function name:           initButton
-** Description:             Classic initialize button
+** Function name:           execute
+** Description:             Run one command on display, text uses state of its producer
 ***************************************************************************************/
-void Button::initButtonUL(
-	TFTLIB_SPI *tft, XPT2046_Touchscreen *ts, int16_t x1, int16_t y1, uint16_t w, uint16_t h,
-	uint16_t outline, uint16_t fill, uint16_t textcolor, char *label, FontDef* Font)
-{
-	__x1				= x1;
-	__y1				= y1;
-	__w					= w;
-	__h					= h;
-	__outlinecolor		= outline;
-	__fillcolor			= fill;
-	__textcolor			= textcolor;
-	__tft				= tft;
-	__ts				= ts;
-	__font = Font;
-	__text_w			= __font->width;
-	__text_h			= __font->height;
-	strncpy(__label, label, 19);
+void RenderQueue::execute(RenderCmd &cmd) {
+	const int16_t *a = cmd.a;
+
+	switch (cmd.op) {
+		case RENDER_OP::FILL_SCREEN:		__tft->fillScreen(cmd.color); break;
+		case RENDER_OP::DRAW_PIXEL:			__tft->drawPixel(a[0], a[1], cmd.color); break;
+		case RENDER_OP::DRAW_LINE:			__tft->drawLine(a[0], a[1], a[2], a[3], cmd.color); break;
+		case RENDER_OP::DRAW_HLINE:			__tft->drawFastHLine(a[0], a[1], a[2], cmd.color); break;
+		case RENDER_OP::DRAW_VLINE:			__tft->drawFastVLine(a[0], a[1], a[2], cmd.color); break;
+		case RENDER_OP::DRAW_RECT:			__tft->drawRect(a[0], a[1], a[2], a[3], cmd.color); break;
+		case RENDER_OP::FILL_RECT:			__tft->fillRect(a[0], a[1], a[2], a[3], cmd.color); break;
+		case RENDER_OP::DRAW_ROUND_RECT:	__tft->drawRoundRect(a[0], a[1], a[2], a[3], a[4], cmd.color); break;
+		case RENDER_OP::FILL_ROUND_RECT:	__tft->fillRoundRect(a[0], a[1], a[2], a[3], a[4], cmd.color); break;
+		case RENDER_OP::DRAW_CIRCLE:		__tft->drawCircle(a[0], a[1], a[2], cmd.color); break;
+		case RENDER_OP::FILL_CIRCLE:		__tft->fillCircle(a[0], a[1], a[2], cmd.color); break;
+		case RENDER_OP::DRAW_TRIANGLE:		__tft->drawTriangle(a[0], a[1], a[2], a[3], a[4], a[5], cmd.color); break;
+		case RENDER_OP::FILL_TRIANGLE:		__tft->fillTriangle(a[0], a[1], a[2], a[3], a[4], a[5], cmd.color); break;
+		case RENDER_OP::SET_CURSOR:
+			__text[cmd.producer].x = a[0];
+			__text[cmd.producer].y = a[1];
+		break;
+		case RENDER_OP::SET_TEXT_COLOR:
+			__text[cmd.producer].fg = cmd.color;
+			__text[cmd.producer].bg = cmd.bg;
+		break;
+		case RENDER_OP::SET_FONT:			__text[cmd.producer].font = cmd.font; break;
+		case RENDER_OP::PRINT:
+		case RENDER_OP::PRINTLN: {
+			RenderText &t = __text[cmd.producer];
+			__tft->setFont(*t.font);
+			__tft->setTextColor(t.fg, t.bg);
+			__tft->setCursor(t.x, t.y);
+			if (cmd.op == RENDER_OP::PRINT) __tft->print(cmd.text);
+			else __tft->println(cmd.text);
+			__tft->getCursor(t.x, t.y);
+		}
+		break;
+		case RENDER_OP::CALL:				cmd.call(__tft, cmd.user); break;
+	}
 }
 
 /***************************************************************************************
-** Function name:           setLabelOffset
-** Description:             Adjust text datum on x, y coordinates
+** Function name:           process
+** Description:             Render task: run up to max queued commands (0 = all ready),
+**                          returns number run. Stops at slot claimed but not yet written
 ***************************************************************************************/
-void Button::setLabelOffset(int16_t x_delta, int16_t y_delta) {
-	__xd        = x_delta;
-	__yd        = y_delta;
+uint16_t RenderQueue::process(uint16_t max) {
+	uint16_t n = 0;
+
+	while (max == 0 || n < max) {
+		RenderSlot &slot = __slots[__head % RenderQueueSize];
+		if ((int32_t)(slot.seq.load(memory_order_acquire) - (__head + 1)) < 0) break;
+
+		// Command runs in place, slot is handed back to producers afterwards
+		execute(slot.cmd);
+		slot.seq.store(__head + RenderQueueSize, memory_order_release);
+		__head++;
+		n++;
+	}
+	return n;
 }
 
 /***************************************************************************************
-** Function name:           drawButton
-** Description:             Draw button with label
+** Function name:           addPanel
+** Description:             Add display placed at x&y of canvas, returns index or -1 when
+**                          full or SPI is already used by a panel of group. Jobs of all
+**                          panels run at once, on shared SPI the second one would wait for
+**                          chip select of the first forever. Call setBus() before
 ***************************************************************************************/
-void Button::drawButton(bool inverted, char* long_name) {
-	uint16_t fill, outline, text;
-	uint16_t text_size = sizeof(long_name);
-
-	if(!inverted) {
-		fill    = __fillcolor;
-		outline = __outlinecolor;
-		text    = __textcolor;
+int8_t DisplayGroup::addPanel(TFTLIB_SPI &tft, int32_t x, int32_t y) {
+	if (__n == GroupMaxPanels) return -1;
+	for (uint8_t i = 0; i < __n; i++) {
+		if (__panels[i]->handle() == tft.handle()) return -1;
 	}
 
-	else {
-		fill    = __textcolor;
-		outline = __outlinecolor;
-		text    = __fillcolor;
-		}
-
-	uint8_t r = min(__w, __h) / 2; // Corner radius
-	__tft->fillRoundRect(__x1, __y1, __w, __h, r, fill);
-	__tft->drawRoundRect(__x1, __y1, __w, __h, r, outline);
-	__tft->setTextColor(text, fill);
-	__tft->setFont(*__font);
-	if (strcmp(long_name, "") == 0) __tft->writeString(__x1 + (__w/2) + __xd - ((text_size*__text_w)/2), __y1 + (__h/2) - 4 + __yd - (__text_h/2), __label/*, *_font, text, fill*/);
-	else  __tft->writeString(__x1 + (__w/2) + __xd - ((text_size*__text_w)/2), __y1 + (__h/2) - 4 + __yd - (__text_h/2), long_name/*, *_font, text, fill*/);
+	__panels[__n] = &tft;
+	__px[__n] = x;
+	__py[__n] = y;
+	return __n++;
 }
 
 /***************************************************************************************
-** Function name:           contains
-** Description:             Check if button is pressed in correct coordinates
+** Function name:           width
+** Description:             Width of canvas, bounding box of panels
 ***************************************************************************************/
-bool Button::contains(int16_t x, int16_t y) {
-	return ((x >= __x1) && (x < (__x1 + __w)) && (y >= __y1) && (y < (__y1 + __h)));
+int32_t DisplayGroup::width(void) {
+	int32_t w = 0;
+	for (uint8_t i = 0; i < __n; i++) w = max(w, __px[i] + __panels[i]->width());
+	return w;
 }
 
 /***************************************************************************************
-** Function name:           process
-** Description:             New process function with callbacks to set task our button
+** Function name:           height
+** Description:             Height of canvas, bounding box of panels
 ***************************************************************************************/
-void Button::process(char* label_pressed, char* label_release, Callback btn_func, Callback end_func, XPT2046_Touchscreen &ts){
-	int32_t x = 0, y = 0;
-	ts.getTouch(&x, &y);
-	bool pressed_btn;
-
-	char info[32];
-	sprintf(info, "X = %ld, Y = %ld, RAM:%d    ", x, y, __tft->FreeRAM());
-	__tft->setTextColor(RED, WHITE);
-	__tft->writeString(0, 0, info/*, Font_11x18, YELLOW, BLUE*/);
-
-	if (ts.pressed() && contains(x, y)){
-		press(true);
-		pressed_btn = 1;
-		if (wasPressed()) drawButton(true, label_pressed);
-	}
+int32_t DisplayGroup::height(void) {
+	int32_t h = 0;
+	for (uint8_t i = 0; i < __n; i++) h = max(h, __py[i] + __panels[i]->height());
+	return h;
+}
 
-	else{
-		press(false);
-		drawButton(false, label_release);
-	}
+/***************************************************************************************
+** Function name:           run
+** Description:             Poll jobs of all panels round robin, next chunk of one panel is
+**                          started or prepared while the others transfer
+***************************************************************************************/
+void DisplayGroup::run(void) {
+	bool busy;
+	do {
+		busy = false;
+		for (uint8_t i = 0; i < __n; i++) busy |= __panels[i]->poll();
+	} while (busy);
+}
 
+void DisplayGroup::fillScreen(uint16_t color) {
+	for (uint8_t i = 0; i < __n; i++) __panels[i]->startFill(0, 0, __panels[i]->width(), __panels[i]->height(), color);
+	run();
+}
 
-	if (wasReleased() && pressed_btn){
-		btn_func();
-		end_func();
-		pressed_btn = 0;
-	}
+/***************************************************************************************
+** Function name:           fillRect
+** Description:             Fill rectangle in canvas coordinates, may span panels
+***************************************************************************************/
+void DisplayGroup::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+	for (uint8_t i = 0; i < __n; i++) __panels[i]->startFill(x - __px[i], y - __py[i], w, h, color);
+	run();
 }
 
 /***************************************************************************************
-** Function name:           press
-** Description:             Change actually button state
+** Function name:           drawImage
+** Description:             Draw image in canvas coordinates, each panel gets its part
 ***************************************************************************************/
-void Button::press(bool p) {
-	last_state = curr_state;
-	curr_state = p;
+void DisplayGroup::drawImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data) {
+	for (uint8_t i = 0; i < __n; i++) __panels[i]->startImage(x - __px[i], y - __py[i], w, h, data);
+	run();
 }
 
-bool Button::isPressed()    { return curr_state; }
-bool Button::wasPressed()  { return (curr_state && !last_state); }
-bool Button::wasReleased() { return (!curr_state && last_state); }
+/***************************************************************************************
+** Function name:           draw
+** Description:             Run drawing on every panel in turn, for everything else than
+**                          fills and images. Drawing at (x - ox, y - oy) lands at canvas x&y
+***************************************************************************************/
+void DisplayGroup::draw(GroupDraw fn, void *user) {
+	for (uint8_t i = 0; i < __n; i++) fn(__panels[i], __px[i], __py[i], user);
+}
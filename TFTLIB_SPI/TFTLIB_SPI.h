@@ -15,6 +15,8 @@
 #include "spi.h"
 #include "stm32f4xx_hal.h"
 #include "algorithm"
+#include <atomic>
+#include <new>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -130,12 +132,404 @@ constexpr float PixelAlphaGain   = 255.0;
 constexpr float LoAlphaTheshold  = 64.0/255.0;
 constexpr float HiAlphaTheshold  = 1.0 - LoAlphaTheshold;
 
+constexpr uint16_t PlotBatchSize = 128;
+
+typedef struct {
+	int16_t x;
+	int16_t y;
+} Point;
+
+typedef struct {
+	float x;
+	float y;
+} PointF;
+
+/* Fixed point (Q16) distance field of anti-aliased wedge line */
+typedef struct {
+	int32_t ax, ay;					// Start point
+	int32_t ux, uy;					// Unit vector along line (Q30)
+	int32_t len;					// Line length
+	int32_t ar, dr, k;				// Start radius (+0.5), radius delta, radius delta per length
+	int64_t cap_in[2], cap_out[2];	// Squared solid/empty distance limits of start and end cap
+} WedgeSDF;
+
+/* Fixed point (Q16) description of anti-aliased circle, ring, arc or pie */
+typedef struct {
+	int32_t cx, cy;					// Centre
+	int32_t ro, ri;					// Outer radius (+0.5), inner radius (-0.5)
+	int64_t rov2, ros2, riv2, ris2;	// Squared visible/solid limits of outer and inner edge
+	int32_t sx, sy, ex, ey;			// Unit vectors of start and end angle
+	bool inner, full, wide;			// Has hole, full 360 deg, sweep over 180 deg
+	bool hard_start, hard_end;		// End ray not anti-aliased, pixel centre decides
+} ArcSDF;
+
+/* Fixed point (Q16) polygon edge of anti-aliased scanline rasterizer */
+typedef struct {
+	int32_t x0, y0;					// Top end point
+	int32_t y1;						// Bottom Y
+	int64_t dxdy;					// X step per unit of Y
+	int32_t dydx;					// Coverage per column of flat edge, 1/|dxdy|
+	int32_t dir;					// Winding direction, +1 down, -1 up
+} PolyEdge;
+
+typedef struct {
+	uint8_t pos;					// Position along gradient, 0 - 255
+	uint16_t color;
+} GradientStop;
+
+enum class GRADIENT : uint8_t
+{
+	LINEAR				= 0x00,
+	RADIAL				= 0x01,
+};
+
+/* Gradient fill, coordinates are relative to viewport like other drawing functions */
+typedef struct {
+	GRADIENT type;
+	float x0, y0;					// Linear start point or radial centre
+	float x1, y1;					// Linear end point
+	float r;						// Radial radius
+	const GradientStop *stops;		// Stops sorted by position
+	uint8_t count;
+	bool dither;					// Ordered dither to hide RGB565 banding
+} Gradient;
+
+/* Fixed point stepping state of gradient fill in screen space */
+typedef struct {
+	int64_t t0, tx, ty;				// Linear: ramp index at origin, per column and per row (Q16)
+	int32_t cx, cy, k;				// Radial: centre and ramp index per pixel (Q8)
+	bool radial, dither;
+	uint32_t lut[256];				// Colour ramp, swapped RGB565 or RGB888 when dithered
+} GradientDDA;
+
+/* Q565 compressed image, QOI style byte stream of RGB565 pixels. Header is "Q565" and
+ * width, height as little endian uint16, followed by ops:
+ *   00iiiiii            INDEX   colour from 64 entry table of recent colours
+ *   01rrggbb            DIFF    r, g, b change by -2..1
+ *   10gggggg rrrrbbbb   LUMA    g changes by -32..31, r and b by g/2 + -8..7
+ *   11nnnnnn            RUN     previous colour n + 1 times (1..62)
+ *   11111110 hi lo      COLOR   raw RGB565 colour
+ * Every decoded colour is stored in table at Q565Hash. Encoder: tools/q565enc.py */
+constexpr uint8_t Q565HeaderSize = 8;
+constexpr uint8_t Q565OpDiff     = 0x40;
+constexpr uint8_t Q565OpLuma     = 0x80;
+constexpr uint8_t Q565OpRun      = 0xC0;
+constexpr uint8_t Q565OpColor    = 0xFE;
+
+inline uint8_t Q565Hash(uint16_t c) { return ((c >> 11) * 3 + ((c >> 5) & 0x3F) * 5 + (c & 0x1F) * 7) & 0x3F; }
+
+typedef struct {
+	const uint8_t *p, *end;			// Read position and end of data
+	uint16_t px;					// Previous colour
+	uint16_t run;					// Pending repeats of previous colour
+	uint16_t index[64];				// Recently seen colours
+} Q565Decoder;
+
+constexpr uint8_t SpriteMax = 64;
+
+/* Sprite of SpriteLayer, image is w*h pixels in panel byte order like drawImage() data */
+typedef struct {
+	int32_t x, y;					// Position relative to viewport
+	int16_t w, h;
+	const uint16_t *data;
+	uint16_t key;					// Transparent colour, RGB565
+	bool keyed;						// Pixels of key colour are not drawn
+	bool visible;
+	uint8_t z;						// Higher z is drawn on top
+} Sprite;
+
+/* Colour zone of ArcGauge, value arc is drawn in colour of zone up to value "to" */
+typedef struct {
+	float to;
+	uint16_t color;
+} GaugeZone;
+
+constexpr uint8_t BusMaxDevices		= 4;
+constexpr uint8_t BusQueueLength	= 4;
+
+/* Queued bus transfer finished, ok is false when HAL refused to start it */
+typedef void (*BusCallback)(void *user, bool ok);
+
+typedef struct {
+	uint32_t cr1;					// Prescaler, polarity and phase bits of SPI CR1
+	GPIO_TypeDef *cs_port;
+	uint16_t cs_pin;
+} BusDevice;
+
+typedef struct {
+	uint8_t dev;
+	uint8_t *tx, *rx;				// rx nullptr for transmit only
+	uint16_t len;
+	BusCallback done;
+	void *user;
+} BusTransfer;
+
+constexpr uint8_t TouchEventQueue	= 16;		// Power of 2
+constexpr uint8_t TouchMaxSamples	= 16;
+constexpr uint8_t TouchReadZ1		= 0xB0;
+constexpr uint8_t TouchReadZ2		= 0xC0;
+constexpr int32_t TouchPressureMin	= 400;		// Z1 + 4095 - Z2 of pressed pen
+constexpr int32_t TouchMaxSpread	= 800;		// Middle half of samples in raw units (12 bit << 3)
+constexpr int32_t TouchJitter		= 24;		// Raw moves ignored while pen is down
+constexpr uint8_t TouchIIRShift		= 1;		// Filter weight of new position 1/2^n
+constexpr uint8_t TouchCalShift		= 20;		// Fixed point of calibration matrix
+constexpr uint32_t TouchCalMagic	= 0x54434131;
+constexpr int32_t TouchCalMaxError	= 10;		// Pixels, calibration point farther is mistouch
+
+enum class TOUCH_EVENT : uint8_t
+{
+	DOWN				= 0x00,
+	MOVE				= 0x01,
+	UP					= 0x02,
+};
+
+/* Touch event of interrupt driven XPT2046 sampling, screen coordinates */
+typedef struct {
+	TOUCH_EVENT type;
+	int16_t x, y;
+	uint16_t z;						// Pressure, see getPressure()
+	uint32_t time;					// HAL_GetTick() of sample
+} TouchEvent;
+
+/* Affine touch calibration: x = (ax * raw_x + bx * raw_y + cx) >> TouchCalShift, same for y */
+typedef struct {
+	uint32_t magic;					// TouchCalMagic when valid
+	int32_t ax, bx, cx;
+	int32_t ay, by, cy;
+	uint8_t rotation;				// Rotation the matrix was made in
+} TouchCalibration;
+
+/* Read (save = false) or write calibration from/to flash, EEPROM or file, true on success */
+typedef bool (*TouchStorage)(TouchCalibration &cal, bool save, void *user);
+
+constexpr uint8_t WidgetMax		= 128;
+constexpr uint8_t WidgetGridShift	= 5;		// Hit test grid cells of 32x32 pixels
+
+enum class WIDGET_STATE : uint8_t
+{
+	NORMAL				= 0x00,
+	PRESSED				= 0x01,
+	DISABLED			= 0x02,
+};
+
+enum class WIDGET_EVENT : uint8_t
+{
+	PRESS				= 0x00,
+	CLICK				= 0x01,		// Released inside widget
+	CANCEL				= 0x02,		// Released outside
+};
+
+constexpr uint8_t RenderQueueSize	= 32;		// Power of 2
+constexpr uint8_t RenderMaxProducers	= 8;
+constexpr uint8_t RenderTextMax		= 24;		// Longer text is cut
+
+enum class RENDER_OP : uint8_t
+{
+	FILL_SCREEN			= 0x00,
+	DRAW_PIXEL			= 0x01,
+	DRAW_LINE			= 0x02,
+	DRAW_HLINE			= 0x03,
+	DRAW_VLINE			= 0x04,
+	DRAW_RECT			= 0x05,
+	FILL_RECT			= 0x06,
+	DRAW_ROUND_RECT		= 0x07,
+	FILL_ROUND_RECT		= 0x08,
+	DRAW_CIRCLE			= 0x09,
+	FILL_CIRCLE			= 0x0A,
+	DRAW_TRIANGLE		= 0x0B,
+	FILL_TRIANGLE		= 0x0C,
+	SET_CURSOR			= 0x0D,
+	SET_TEXT_COLOR		= 0x0E,
+	SET_FONT			= 0x0F,
+	PRINT				= 0x10,
+	PRINTLN				= 0x11,
+	CALL				= 0x12,
+};
+
+class TFTLIB_SPI;
+
+/* Runs on render task with exclusive access to display */
+typedef void (*RenderCall)(TFTLIB_SPI *tft, void *user);
+typedef void (*RenderNotify)(void *user);
+
+/* Draw command copied by value into queue, a[] holds coordinates in argument order of the call */
+typedef struct {
+	RENDER_OP op;
+	uint8_t producer;
+	uint16_t color, bg;
+	int16_t a[6];
+	FontDef *font;
+	RenderCall call;
+	void *user;
+	char text[RenderTextMax];
+} RenderCmd;
+
+/* Text state of one producer, applied to display before its text commands */
+typedef struct {
+	FontDef *font;
+	uint16_t fg, bg;
+	int32_t x, y;
+} RenderText;
+
+constexpr uint8_t ChartTraces = 4;
+
+enum class CHART_SCROLL : uint8_t
+{
+	RING				= 0x00,
+	HARDWARE			= 0x01,
+};
+
+enum class FILL_RULE : uint8_t
+{
+	NONZERO				= 0x00,
+	EVENODD				= 0x01,
+};
+
+constexpr float MiterLimit = 4.0;
+
+constexpr float BezierTolerance = 0.25;		// Max distance of flattened segments from curve
+constexpr uint16_t BezierMaxSegments = 128;
+
+enum class LINE_JOIN : uint8_t
+{
+	MITER				= 0x00,
+	ROUND				= 0x01,
+	BEVEL				= 0x02,
+};
+
+enum class LINE_CAP : uint8_t
+{
+	BUTT				= 0x00,
+	ROUND				= 0x01,
+	SQUARE				= 0x02,
+};
+
+enum class IMAGE_FILTER : uint8_t
+{
+	NEAREST				= 0x00,
+	BILINEAR			= 0x01,
+};
+
+enum class JPEG_SCALE : uint8_t
+{
+	FULL				= 0x00,
+	HALF				= 0x01,
+	QUARTER				= 0x02,
+	EIGHTH				= 0x03,
+};
+
+constexpr uint16_t JpegInputSize = 512;
+
+/* Huffman table of JPEG decoder, 8 bit lookahead and canonical limits of longer codes */
+typedef struct {
+	uint16_t look[256];				// (length << 8) | symbol of codes up to 8 bits, 0 = longer code
+	int32_t maxcode[17];			// Largest code of each length, -1 = none
+	int32_t delta[17];				// Symbol index minus code of each length
+	uint8_t val[256];				// Symbols in code order
+} JpegHuffman;
+
+typedef struct {
+	uint8_t id;
+	uint8_t h, v;					// Sampling factors
+	uint8_t tq, td, ta;				// Quantization, DC and AC table
+	int32_t pred;					// DC predictor
+} JpegComponent;
+
+/* Baseline JPEG decoder, huffman coded 8 bit YCbCr 4:4:4, 4:2:2, 4:2:0 or grayscale.
+ * Decodes one MCU at a time into swapped RGB565, optionally scaled by 1/2, 1/4 or 1/8. */
+class JPEG_Decoder {
+	public:
+		using Reader = uint32_t (*) (void *user, uint8_t *buf, uint32_t len);
+
+	private:
+		const uint8_t *__in = nullptr, *__in_end = nullptr;
+		Reader __reader = nullptr;
+		void *__user = nullptr;
+		uint8_t __in_buf[JpegInputSize];
+
+		uint32_t __bits = 0;
+		int32_t __nbits = 0;
+		uint8_t __marker = 0;
+		bool __eof = false, __error = false;
+
+		uint16_t __qt[4][64];
+		JpegHuffman __dc[2], __ac[2];
+		JpegComponent __comp[3];
+		uint8_t __ncomp = 0, __scan[3];
+		uint8_t __hmax = 1, __vmax = 1;
+		uint16_t __width = 0, __height = 0;
+		uint16_t __mcus_x = 0, __mcus_y = 0;
+		uint32_t __mcu = 0;
+		uint16_t __restart_interval = 0, __restarts_left = 0;
+		uint8_t __shift = 0;
+
+		int32_t __coef[64], __ws[64];
+		uint8_t __plane[3][256];
+
+		inline uint8_t getByte(void);
+		inline uint16_t getWord(void);
+		inline void fillBits(void);
+		inline int32_t getBits(int32_t n);
+		inline uint8_t decodeHuffman(const JpegHuffman &t);
+		bool buildHuffman(JpegHuffman &t, const uint8_t *counts, const uint8_t *val);
+		bool parseHeaders(void);
+		void restart(void);
+		bool decodeBlock(JpegComponent &c);
+		void idctBlock(uint8_t *dst, int32_t stride);
+
+	public:
+		JPEG_Decoder(void) {}
+
+		bool open(const uint8_t *data, uint32_t len);
+		bool open(Reader reader, void *user);
+		void setScale(JPEG_SCALE scale);
+
+		uint16_t width(void);
+		uint16_t height(void);
+		bool failed(void);
+
+		bool nextMCU(uint16_t &x, uint16_t &y, uint16_t &w, uint16_t &h);
+		bool decodeMCU(uint16_t *out);
+};
+
 enum class TFT_DRIVER : uint8_t
 {
 	ST7789				= 0x01,
 	ILI9341				= 0x02,
 };
 
+/* Owner of SPI shared by display and touch: blocking users hold the bus between acquire() and
+   release(), queued DMA transfers run only while nobody holds it. Every device gets its own clock
+   prescaler and mode. Application forwards HAL_SPI_TxRxCpltCallback and HAL_SPI_TxCpltCallback
+   to spiHandler() */
+class SPI_Bus {
+	private:
+		SPI_HandleTypeDef *__hspi;
+		BusDevice __devices[BusMaxDevices];
+		uint8_t __n = 0;
+		int8_t __configured = -1;
+
+		volatile int8_t __owner = -1;	// Device holding bus, -1 when free
+		volatile bool __running = false;	// Queued transfer in flight
+		BusTransfer __queue[BusQueueLength];
+		volatile uint8_t __q_head = 0, __q_tail = 0;
+		BusTransfer __current;
+
+		void configure(uint8_t dev);
+		void startNext(void);
+
+	public:
+		SPI_Bus(SPI_HandleTypeDef &hspi) : __hspi(&hspi) {}
+
+		int8_t addDevice(GPIO_TypeDef *cs_port, uint16_t cs_pin, uint32_t prescaler, uint32_t polarity = SPI_POLARITY_LOW, uint32_t phase = SPI_PHASE_1EDGE);
+		SPI_HandleTypeDef *handle(void);
+		bool tryAcquire(uint8_t dev);
+		void acquire(uint8_t dev);
+		void release(uint8_t dev);
+		bool submit(uint8_t dev, uint8_t *tx, uint8_t *rx, uint16_t len, BusCallback done, void *user);
+		void spiHandler(SPI_HandleTypeDef *hspi);
+};
+
 class TFTLIB_SPI {
 	private:
 		uint8_t __rotation;
@@ -151,8 +545,14 @@ class TFTLIB_SPI {
 		uint8_t _type;
 		uint16_t __buffer_size = 1024;
 		uint16_t *__buffer = new uint16_t[__buffer_size];
+		int32_t *__cover = nullptr;
+		uint64_t *__scratch = nullptr;
+		uint32_t __scratch_size = 0;
+		JPEG_Decoder *__jpeg = nullptr;
 		FontDef *__font = &Font_11x18;
 		uint16_t __text_fg = RED, __text_bg = BLACK;
+		uint32_t __plot[PlotBatchSize];
+		uint16_t __plot_len = 0, __plot_color = 0;
 		uint16_t SWAP_UINT16(uint16_t x) {x = (x >> 8) | (x << 8); return x;}
 
 		int32_t _display_width  = 240;
@@ -160,14 +560,45 @@ class TFTLIB_SPI {
 		int32_t _width  = 240;
 		int32_t _height = 320;
 
-		void CS_L(void) { CS_PORT->BSRR = CS_PIN << 16U; }
-		void CS_H(void) {  CS_PORT->BSRR = CS_PIN; }
+		int32_t __vp_x = 0, __vp_y = 0, __vp_w = 240, __vp_h = 320;
+		int32_t __clip_x0 = 0, __clip_y0 = 0, __clip_x1 = 239, __clip_y1 = 319;
+
+		SPI_Bus *__arb = nullptr;
+		uint8_t __arb_dev = 0;
+
+		// Chip select holds shared bus from first CS_L() until CS_H()
+		void CS_L(void) { if (__arb) __arb->acquire(__arb_dev); CS_PORT->BSRR = (uint32_t)CS_PIN << 16U; }
+		void CS_H(void) { CS_PORT->BSRR = (uint32_t)CS_PIN; if (__arb) __arb->release(__arb_dev); }
 
 		void DC_L(void) {  DC_PORT->BSRR = DC_PIN << 16U; }
 		void DC_H(void) {  DC_PORT->BSRR = DC_PIN; }
+
+		inline bool clipRect(int32_t &x, int32_t &y, int32_t &w, int32_t &h);
+		inline void pushPixel(int32_t x, int32_t y, uint16_t color);
+		inline void pushHLine(int32_t x, int32_t y, int32_t w, uint16_t color);
+		inline void pushVLine(int32_t x, int32_t y, int32_t h, uint16_t color);
+		inline void pushLine(int32_t x, int32_t y, int32_t w);
+		inline void pushLineKeyed(int32_t x, int32_t y, int32_t w, int32_t transparent);
+		inline void plotPixel(int32_t x, int32_t y, uint16_t color);
+		void flushPixels(void);
+		void *scratch(uint32_t size);
+
+		// Non-blocking job of startFill()/startImage(), pixels not yet prepared and prepared in
+		// buffer half __job_sel. Copied images keep source position in __job_src/__job_col
+		const uint16_t *__job_src = nullptr;
+		uint32_t __job_left = 0;
+		uint16_t __job_ready = 0;
+		int32_t __job_w = 0, __job_stride = 0, __job_col = 0;
+		uint8_t __job_sel = 0;
+		bool __job_active = false, __job_copy = false;
+
+		void jobPrepare(void);
+		void jobNext(void);
 	public:
 		TFTLIB_SPI(SPI_HandleTypeDef &bus, TFT_DRIVER drv, GPIO_TypeDef *GPIO_DC_PORT, uint16_t GPIO_DC_PIN, GPIO_TypeDef *GPIO_CS_PORT, uint16_t GPIO_CS_PIN, GPIO_TypeDef *GPIO_RST_PORT, uint16_t GPIO_RST_PIN);
 		~TFTLIB_SPI();
+		void setBus(SPI_Bus *bus, uint8_t dev);
+		SPI_HandleTypeDef *handle(void);
 
 		inline void writeCommand(uint8_t cmd);
 
@@ -180,14 +611,40 @@ class TFTLIB_SPI {
 		void pushPixels(const void* data_in, uint32_t len);
 		void pushBlock(uint16_t color, uint32_t len);
 
+		/* Source of pixels for drawRows(), fills w pixels of row y from x in panel byte order */
+		using RowSource = void (*) (void *user, int32_t x, int32_t y, int32_t w, uint16_t *dst);
+		uint32_t drawRows(int32_t x, int32_t y, int32_t w, int32_t h, RowSource src, void *user);
+
+		/* Non-blocking fill and image push: start, then poll() until false. Other drawing on this
+		   display first waits for the end with finish(), see DisplayGroup */
+		bool startFill(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color);
+		bool startImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data);
+		bool poll(void);
+		void finish(void);
+
+		/* Viewport functions. Drawing coordinates are relative to viewport origin. */
+		void setViewport(int32_t x, int32_t y, int32_t w, int32_t h);
+		void resetViewport(void);
+		void setClipRect(int32_t x, int32_t y, int32_t w, int32_t h);
+		void resetClipRect(void);
+
 		void setRotation(uint8_t m);
+		uint8_t getRotation(void);
 		void invertColors(uint8_t invert);
 		void tearEffect(uint8_t tear);
+		void setScrollArea(uint16_t tfa, uint16_t vsa, uint16_t bfa);
+		void scrollTo(uint16_t vsp);
 		uint16_t color565(uint8_t r, uint8_t g, uint8_t b);
 		uint16_t color16to8(uint16_t c);
 		uint16_t color8to16(uint8_t color);
 		uint16_t alphaBlend(uint8_t alpha, uint16_t fgc, uint16_t bgc);
 
+		/* Span blending of RGB565 pixels (not swapped), alpha 255 = full src/color. */
+		void blendSpan(uint16_t *dst, const uint16_t *src, const uint8_t *alpha, uint32_t n);
+		void blendSpan(uint16_t *dst, uint16_t color, const uint8_t *alpha, uint32_t n);
+		void blendSpan(uint16_t *dst, const uint16_t *src, uint8_t alpha, uint32_t n);
+		void blendSpan(uint16_t *dst, uint16_t color, uint8_t alpha, uint32_t n);
+
 		void init(void);
 
 		void ARTtoggle();
@@ -196,11 +653,28 @@ class TFTLIB_SPI {
 		void fillScreen(uint16_t color);
 
 		void drawPixel(int32_t x, int32_t y, uint16_t color);
-
-		inline float wedgeLineDistance(float xpax, float ypay, float bax, float bay, float dr);
+		void plotPixels(const Point *points, uint32_t n, uint16_t color);
+
+		inline void wedgeSetup(WedgeSDF &sdf, float ax, float ay, float bx, float by, float ar, float br);
+		inline uint32_t fixedSqrt(uint64_t x);
+		inline int32_t wedgeCoverage(const WedgeSDF &sdf, int32_t u, int32_t v);
+		inline void drawWedgeSpan(int32_t yp, int32_t &xs, int32_t x1, const WedgeSDF &sdf, uint16_t fg_color, uint16_t bg_color);
+		void fillArcHelperAA(float x, float y, float r, float ir, float start_angle, float end_angle, uint16_t fg_color, uint16_t bg_color, bool smooth_start = true, bool smooth_end = true);
+		inline int32_t arcCoverage(const ArcSDF &arc, int32_t dx, int32_t dy, int64_t dy2, bool solid);
+		inline void fillArcSpan(int32_t ya, int32_t ym, int32_t xa, int32_t xb, int32_t sl, int32_t sr, int32_t hl, int32_t hr, int32_t dy, int64_t dy2, const ArcSDF &arc, uint16_t fg_color, uint16_t bg_color);
 		inline void drawCircleHelper( int32_t x0, int32_t y0, int32_t rr, uint8_t cornername, uint16_t color);
 		inline void fillCircleHelper(int32_t x0, int32_t y0, int32_t r, uint8_t cornername, int32_t delta, uint16_t color);
-		inline void fillCircleHelperAA(int32_t x0, int32_t y0, int32_t r, uint8_t cornername, int32_t delta, uint16_t color);
+		inline void coverEdge(const PolyEdge &e, int32_t yt, int32_t yb, int32_t cx0, int32_t cx1, int32_t &xmin, int32_t &xmax);
+		void gradientSetup(const Gradient &g, GradientDDA &d);
+		inline void gradientSpan(const GradientDDA &d, int32_t x, int32_t y, int32_t w, uint16_t *p);
+		inline bool decodeQ565(Q565Decoder &d, uint16_t *out, int32_t n);
+		bool drawJpegHelper(int32_t x, int32_t y, JPEG_Decoder &jpg, JPEG_SCALE scale);
+		inline uint16_t sampleBilinear(const uint16_t *data, int32_t w, int32_t h, int32_t u, int32_t v, int32_t transparent);
+		void fillPolyHelper(const Point *points, uint16_t n, uint16_t color, FILL_RULE rule, uint32_t skip = 0);
+		void fillPolyHelperAA(const PointF *points, const uint16_t *ends, uint16_t contours, uint16_t fg_color, FILL_RULE rule, uint16_t bg_color, uint32_t skip = 0);
+		static uint16_t bezierSegments(const PointF *ctrl, uint8_t degree, float tolerance);
+		static void flattenBezier(const PointF *ctrl, uint8_t degree, uint16_t n, PointF *out);
+		PointF *flattenShape(const PointF *points, const uint8_t *degrees, uint16_t segments, float tolerance, uint16_t &n);
 
 		void drawFastHLine(int32_t x, int32_t y, int32_t w, uint16_t color);
 		void drawFastVLine(int32_t x, int32_t y, int32_t w, uint16_t color);
@@ -210,6 +684,7 @@ class TFTLIB_SPI {
 		void drawWideLine(float ax, float ay, float bx, float by, float wd, uint16_t fg_color, uint16_t bg_color);
 		void drawWedgeLine(float ax, float ay, float bx, float by, float aw, float bw, uint16_t fg_color);
 		void drawWedgeLine(float ax, float ay, float bx, float by, float aw, float bw, uint16_t fg_color, uint16_t bg_color);
+		void drawPolyline(const PointF *points, uint16_t n, float width, LINE_JOIN join, LINE_CAP cap, uint16_t color, uint16_t bg_color = 0xFFFF);
 
 		void drawTriangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, uint16_t color);
 		void drawTriangleAA(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, int32_t thickness, uint16_t color);
@@ -225,6 +700,7 @@ class TFTLIB_SPI {
 
 		/* Text functions. */
 		void setCursor(int32_t x, int32_t y);
+		void getCursor(int32_t &x, int32_t &y);
 		void setTextColor(int32_t fg, int32_t bg);
 		void setFont(FontDef &Font);
 		void writeChar(int32_t x, int32_t y, char ch);
@@ -235,21 +711,44 @@ class TFTLIB_SPI {
 
 		/* Extented Graphical functions. */
 		void fillTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color);
-		void fillTriangleAA( int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color);
+		void fillTriangleAA( int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t color, uint16_t bg_color = 0xFFFF);
 
 		void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color);
 		void fillRectAA(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color);
 
 		void fillRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color);
-		void fillRoundRectAA(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color);
+		void fillRoundRectAA(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color, uint16_t bg_color = 0xFFFF);
+
+		void fillPolygon(const Point *points, uint16_t n, uint16_t color, FILL_RULE rule = FILL_RULE::NONZERO);
+		void fillPolygonAA(const PointF *points, uint16_t n, uint16_t color, FILL_RULE rule = FILL_RULE::NONZERO, uint16_t bg_color = 0xFFFF);
+		void fillPathAA(const PointF *points, const uint16_t *ends, uint16_t contours, uint16_t color, FILL_RULE rule = FILL_RULE::NONZERO, uint16_t bg_color = 0xFFFF);
+
+		void drawBezier(const PointF *ctrl, uint8_t degree, uint16_t color, float tolerance = BezierTolerance);
+		void drawBezierAA(const PointF *ctrl, uint8_t degree, float width, uint16_t color, uint16_t bg_color = 0xFFFF, float tolerance = BezierTolerance);
+		void fillBezierShape(const PointF *points, const uint8_t *degrees, uint16_t segments, uint16_t color, float tolerance = BezierTolerance);
+		void fillBezierShapeAA(const PointF *points, const uint8_t *degrees, uint16_t segments, uint16_t color, uint16_t bg_color = 0xFFFF, float tolerance = BezierTolerance);
 
 		void fillCircle(int32_t x, int32_t y, int32_t r, uint16_t color);
 		void fillCircleAA(float x, float y, float r, uint16_t color);
+		void fillCircleAA(float x, float y, float r, uint16_t color, uint16_t bg_color);
+		void drawRingAA(float x, float y, float r, float ir, uint16_t color, uint16_t bg_color = 0xFFFF);
+		void drawArcAA(float x, float y, float r, float ir, float start_angle, float end_angle, uint16_t color, uint16_t bg_color = 0xFFFF, bool smooth_start = true, bool smooth_end = true);
+		void fillPieAA(float x, float y, float r, float start_angle, float end_angle, uint16_t color, uint16_t bg_color = 0xFFFF);
+
+		void fillRectGradient(int32_t x, int32_t y, int32_t w, int32_t h, const Gradient &g);
+		void fillRoundRectGradient(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, const Gradient &g);
+		void fillCircleGradient(int32_t x, int32_t y, int32_t r, const Gradient &g);
 
 		void fillEllipse(int16_t x0, int16_t y0, int32_t rx, int32_t ry, uint16_t color);
 
 		void drawImage(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data);
+		void drawImageScaled(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data, int32_t dw, int32_t dh, IMAGE_FILTER filter = IMAGE_FILTER::NEAREST, int32_t transparent = -1);
+		void drawImageRotated(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data, float angle, float scale = 1.0f, IMAGE_FILTER filter = IMAGE_FILTER::NEAREST, int32_t transparent = -1);
+		void drawImageQ565(int32_t x, int32_t y, const uint8_t *data, uint32_t len);
+		bool drawJpeg(int32_t x, int32_t y, const uint8_t *data, uint32_t len, JPEG_SCALE scale = JPEG_SCALE::FULL);
+		bool drawJpeg(int32_t x, int32_t y, JPEG_Decoder::Reader reader, void *user, JPEG_SCALE scale = JPEG_SCALE::FULL);
 		void drawBitmap(int16_t x, int16_t y, int16_t w, int16_t h, const uint8_t *bitmap, uint16_t color);
+		void drawBitmap(int16_t x, int16_t y, int16_t w, int16_t h, const uint8_t *bitmap, uint16_t color, uint16_t bg);
 
 		uint32_t testFillScreen();
 		uint32_t testText();
@@ -276,7 +775,7 @@ class XPT2046_Touchscreen {
 
 		uint8_t		__read_x=0xD0,
 					__read_y=0x90,
-					__no_samples=16;
+					__no_samples=5;
 
 		int32_t		__min_x = 1600,
 					__max_x = 29600,
@@ -284,6 +783,8 @@ class XPT2046_Touchscreen {
 					__max_y = 30700;
 
 		SPI_HandleTypeDef* __bus;
+		SPI_Bus *__arb = nullptr;
+		uint8_t __arb_dev = 0;
 
 		GPIO_TypeDef* CS_PORT;
 		GPIO_TypeDef* IRQ_PORT;
@@ -291,16 +792,56 @@ class XPT2046_Touchscreen {
 		uint16_t CS_PIN;
 		uint16_t IRQ_PIN;
 
+		// Pipelined stream of 2 + 2 * samples conversions, 2 bytes each plus last readout
+		uint8_t __tx[TouchMaxSamples * 4 + 5];
+		uint8_t __rx[TouchMaxSamples * 4 + 5];
+		uint8_t __frame_len = 0;
+		uint16_t __z = 0;
+		int32_t __fx = 0, __fy = 0;
+		TouchCalibration __cal;
+
+		// Interrupt driven sampling, ring is written by handlers and read by pollEvent()
+		TouchEvent __events[TouchEventQueue];
+		volatile uint8_t __ev_head = 0, __ev_tail = 0;
+		volatile bool __async = false, __armed = false, __busy = false;
+		bool __down = false;
+		int16_t __last_x = 0, __last_y = 0;
+		uint32_t __overruns = 0;
+
+		void rawToScreen(int32_t raw_x, int32_t raw_y, int32_t* x, int32_t* y);
+		void defaultCalibration(void);
+		void buildFrame(void);
+		bool readFrame(int32_t &x, int32_t &y, int32_t &z);
+		bool parseFrame(int32_t &x, int32_t &y, int32_t &z);
+		bool pushEvent(TOUCH_EVENT type, int16_t x, int16_t y, uint32_t time);
+		void frameDone(void);
+		static void busDone(void *user, bool ok);
+
 	public:
 		XPT2046_Touchscreen(SPI_HandleTypeDef &bus, GPIO_TypeDef &GPIO_CS_PORT, uint16_t GPIO_CS_PIN, GPIO_TypeDef &GPIO_IRQ_PORT, uint16_t GPIO_IRQ_PIN);
 		~XPT2046_Touchscreen();
+		void setBus(SPI_Bus *bus, uint8_t dev);
 
 		bool pressed(void);
 		void setRotation(uint8_t rotation);
 		void setSamplesNumber(uint8_t number_of_samples);
 		bool getTouch(int32_t* x, int32_t* y);
 		bool getRaw(int32_t* x, int32_t* y);
-		void calibrateTouch(TFTLIB_SPI *tft);
+		uint16_t getPressure(void);
+		bool calibrateTouch(TFTLIB_SPI *tft);
+		bool calibrateTouch(TFTLIB_SPI *tft, TouchStorage storage, void *user, bool force = false);
+		void getCalibration(TouchCalibration &cal);
+		bool setCalibration(const TouchCalibration &cal);
+
+		/* Interrupt driven sampling, handlers are called from HAL callbacks of application */
+		void beginAsync(void);
+		void endAsync(void);
+		void irqHandler(uint16_t pin);
+		void timerHandler(void);
+		void spiHandler(SPI_HandleTypeDef *hspi);
+		bool pollEvent(TouchEvent &event);
+		bool isAsync(void);
+		uint32_t overruns(void);
 };
 
 class Button {
@@ -333,6 +874,7 @@ class Button {
 		void setLabelOffset(int16_t x_delta, int16_t y_delta);
 		void drawButton(bool inverted = false, char* long_name = (char*)"");
 		bool contains(int16_t x, int16_t y);
+		void getBounds(int16_t &x, int16_t &y, uint16_t &w, uint16_t &h);
 		void process(char* label_pressed, char* label_release, Callback btn_func, Callback end_func, XPT2046_Touchscreen &ts);
 
 		void press(bool p);
@@ -341,6 +883,282 @@ class Button {
 		bool wasReleased();
 };
 
+/* Sprites over a background that is restored by callback (or solid colour), the panel
+ * can not be read back. Every change redraws only the affected area, composited in
+ * display buffer and sent in one window. Sprites are owned by caller. */
+class SpriteLayer {
+	public:
+		/* Fills w background pixels of row y from x in panel byte order */
+		using Background = void (*) (void *user, int32_t x, int32_t y, int32_t w, uint16_t *dst);
+
+	private:
+		TFTLIB_SPI *__tft;
+		Sprite *__sprites[SpriteMax];	// Sorted by z
+		uint8_t __count = 0;
+		Sprite *__hit[SpriteMax];		// Visible sprites in area being redrawn
+		uint8_t __nhit = 0;
+		Background __bg = nullptr;
+		void *__bg_user = nullptr;
+		uint16_t __bg_color = 0;
+		uint32_t __bytes = 0;
+
+		static void composeRow(void *user, int32_t x, int32_t y, int32_t w, uint16_t *dst);
+		void insert(Sprite &s);
+
+	public:
+		SpriteLayer(TFTLIB_SPI *tft) : __tft(tft) {}
+
+		void setBackground(Background bg, void *user);
+		void setBackground(uint16_t color);
+
+		bool add(Sprite &s);
+		uint32_t remove(Sprite &s);
+		uint32_t show(Sprite &s, bool visible);
+		uint32_t setZ(Sprite &s, uint8_t z);
+		uint32_t setImage(Sprite &s, const uint16_t *data);
+		uint32_t moveSprite(Sprite &s, int32_t x, int32_t y);
+		uint32_t redraw(int32_t x, int32_t y, int32_t w, int32_t h);
+
+		uint32_t bytesSent(void);
+		void resetStats(void);
+};
+
+/* Ring gauge keeping its last value. Value changes redraw only the arc sector between old
+ * and new value, the needle and the label. Angles in degrees clockwise from 12 o'clock. */
+class ArcGauge {
+	private:
+		TFTLIB_SPI *__tft = nullptr;
+		float __x = 0, __y = 0, __r = 0, __ir = 0;
+		float __start = -120, __end = 120;
+		float __min = 0, __max = 100, __value = 0;
+		const GaugeZone *__zones = nullptr;
+		uint8_t __zone_count = 0;
+		uint16_t __color = GREEN, __track = DARKGREY, __bg = BLACK;
+		uint16_t __needle = WHITE;
+		float __needle_w = 0;
+		FontDef *__font = nullptr;
+		uint16_t __text_color = WHITE;
+		const char *__format = "%.0f";
+		int32_t __label_w = 0;
+
+		float valueAngle(float value);
+		void drawSector(float from, float to, uint16_t color);
+		void drawValueArc(float from, float to);
+		void drawNeedle(float value, uint16_t color);
+		void drawLabel(void);
+
+	public:
+		ArcGauge(void) {}
+
+		void init(TFTLIB_SPI *tft, float x, float y, float r, float thickness, float start_angle = -120, float end_angle = 120);
+		void setRange(float min, float max);
+		void setColors(uint16_t color, uint16_t track, uint16_t bg);
+		void setZones(const GaugeZone *zones, uint8_t count);
+		void setNeedle(uint16_t color, float width = 3.0f);
+		void setLabel(FontDef *font, uint16_t color, const char *format = "%.0f");
+
+		void draw(void);
+		void setValue(float value);
+		float value(void);
+};
+
+/* Strip chart of up to ChartTraces traces. Samples are decimated to min/max envelope of
+ * every column, each new column is sent as one vertical span. History moves either as
+ * column ring with moving gap, or by hardware vertical scroll of the panel (rotation 1
+ * or 3, chart of full screen height, no viewport). */
+class StripChart {
+	private:
+		TFTLIB_SPI *__tft = nullptr;
+		int32_t __x = 0, __y = 0;
+		int16_t __w = 0, __h = 0;
+		uint8_t __traces = 1;
+		uint16_t __spc = 1;				// Samples per column
+		CHART_SCROLL __mode = CHART_SCROLL::RING;
+		uint16_t __tfa = 0;				// Top fixed area of hardware scroll
+		bool __reverse = false;			// Rotation 3, scroll runs against panel rows
+
+		uint16_t __colors[ChartTraces] = { YELLOW, CYAN, MAGENTA, GREEN };
+		uint16_t __bg = BLACK, __grid = DARKGREY;
+		uint8_t __grid_rows = 0;
+		uint16_t __grid_cols = 0;
+		float __min = 0, __max = 1;
+		bool __autoscale = false;
+
+		float *__hist = nullptr;		// Low and high of every trace for each column slot
+		uint16_t *__column = nullptr;	// Pixels of one column, panel byte order
+		float __lo[ChartTraces], __hi[ChartTraces];
+		uint16_t __samples = 0;
+		uint16_t __head = 0, __filled = 0;
+		uint32_t __columns = 0;
+
+		int32_t valueY(float value);
+		void drawColumn(uint16_t slot);
+		void scroll(void);
+		bool rescale(bool shrink);
+		void addColumn(void);
+
+	public:
+		StripChart(void) {}
+		~StripChart(void);
+
+		bool init(TFTLIB_SPI *tft, int32_t x, int32_t y, int16_t w, int16_t h, uint8_t traces = 1, uint16_t samples_per_column = 1, CHART_SCROLL mode = CHART_SCROLL::RING);
+		void setTraceColor(uint8_t trace, uint16_t color);
+		void setColors(uint16_t bg, uint16_t grid);
+		void setGrid(uint8_t rows, uint16_t columns);
+		void setRange(float min, float max);
+		void setAutoscale(bool autoscale);
+
+		void addSample(float value);
+		void addSamples(const float *values);
+		void draw(void);
+		void end(void);
+};
+
+/* Retained widget, draw callback paints it for its state, handler gets touch events */
+struct Widget;
+typedef void (*WidgetDraw)(TFTLIB_SPI *tft, const Widget &w);
+typedef void (*WidgetHandler)(uint8_t id, WIDGET_EVENT event, void *user);
+
+typedef struct Widget {
+	int16_t x, y, w, h;
+	WidgetDraw draw;				// nullptr marks free slot
+	WidgetHandler handler;
+	void *user;						// Passed to handler
+	void *data;						// For draw callback, Button of add(Button &)
+	WIDGET_STATE state;
+	bool visible;
+	bool dirty;
+} Widget;
+
+/* Owns widgets, samples touch once per update() and finds touched widget through grid of
+ * 32x32 cells. Widgets are redrawn only when their state changes or on invalidate(). */
+class WidgetManager {
+	private:
+		TFTLIB_SPI *__tft;
+		XPT2046_Touchscreen *__ts;
+		Widget __widgets[WidgetMax];
+		uint8_t __count = 0;				// Slots in use, end of used range
+
+		uint8_t __dirty[WidgetMax];
+		uint8_t __dirty_n = 0;
+
+		// Grid in compressed rows: items of cell c are __cell_items[__cell_start[c] .. __cell_start[c + 1]]
+		uint16_t *__cell_start = nullptr;
+		uint8_t *__cell_items = nullptr;
+		uint16_t __cols = 0, __rows = 0;
+		bool __grid_valid = false;
+
+		int16_t __active = -1;				// Widget under pen since DOWN
+		bool __down = false;
+		int32_t __last_x = 0, __last_y = 0;
+
+		void buildGrid(void);
+		void mark(uint8_t id);
+		void touch(TOUCH_EVENT type, int32_t x, int32_t y);
+		static void drawButton(TFTLIB_SPI *tft, const Widget &w);
+
+	public:
+		WidgetManager(TFTLIB_SPI *tft, XPT2046_Touchscreen *ts) : __tft(tft), __ts(ts), __widgets() {}
+		~WidgetManager(void);
+
+		int16_t add(int16_t x, int16_t y, int16_t w, int16_t h, WidgetDraw draw, WidgetHandler handler, void *user = nullptr);
+		int16_t add(Button &btn, WidgetHandler handler, void *user = nullptr);
+		void remove(uint8_t id);
+		Widget *get(uint8_t id);
+		void setState(uint8_t id, WIDGET_STATE state);
+		void setVisible(uint8_t id, bool visible);
+		void invalidate(uint8_t id);
+		void layoutChanged(void);
+
+		int16_t hit(int32_t x, int32_t y);
+		void drawAll(void);
+		void update(void);
+};
+
+/* Multi producer, single consumer queue of draw commands for RTOS use. Producers on any task or
+   interrupt push without locks and never block, full queue drops the command. Only the render
+   task calls process() and touches the display */
+class RenderQueue {
+	private:
+		typedef struct {
+			std::atomic<uint32_t> seq;	// Ticket of producer allowed to write, + 1 once written
+			RenderCmd cmd;
+		} RenderSlot;
+
+		TFTLIB_SPI *__tft;
+		RenderSlot __slots[RenderQueueSize];
+		std::atomic<uint32_t> __tail;
+		uint32_t __head = 0;
+		std::atomic<uint32_t> __drops;
+		std::atomic<uint8_t> __producers;
+		RenderText __text[RenderMaxProducers];
+		RenderNotify __notify = nullptr;
+		void *__notify_user = nullptr;
+
+		bool push(const RenderCmd &cmd);
+		bool shape(RENDER_OP op, int16_t a0, int16_t a1, int16_t a2, int16_t a3, int16_t a4, int16_t a5, uint16_t color);
+		bool text(RENDER_OP op, uint8_t producer, const char *str);
+		void execute(RenderCmd &cmd);
+
+	public:
+		RenderQueue(TFTLIB_SPI *tft);
+
+		int8_t addProducer(void);
+		void setNotify(RenderNotify notify, void *user);
+		uint32_t drops(void);
+
+		/* Producer side, false when queue is full */
+		bool fillScreen(uint16_t color);
+		bool drawPixel(int16_t x, int16_t y, uint16_t color);
+		bool drawLine(int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t color);
+		bool drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color);
+		bool drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color);
+		bool drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+		bool fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+		bool drawRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t color);
+		bool fillRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t color);
+		bool drawCircle(int16_t x, int16_t y, int16_t r, uint16_t color);
+		bool fillCircle(int16_t x, int16_t y, int16_t r, uint16_t color);
+		bool drawTriangle(int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t x3, int16_t y3, uint16_t color);
+		bool fillTriangle(int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t x3, int16_t y3, uint16_t color);
+		bool setCursor(uint8_t producer, int16_t x, int16_t y);
+		bool setTextColor(uint8_t producer, uint16_t fg, uint16_t bg);
+		bool setFont(uint8_t producer, FontDef &font);
+		bool print(uint8_t producer, const char *str);
+		bool println(uint8_t producer, const char *str);
+		bool call(RenderCall fn, void *user);
+
+		/* Render task side */
+		uint16_t process(uint16_t max = 0);
+};
+
+constexpr uint8_t GroupMaxPanels = 4;
+
+/* Drawing of DisplayGroup::draw(), ox and oy are panel origin in canvas coordinates */
+typedef void (*GroupDraw)(TFTLIB_SPI *tft, int32_t ox, int32_t oy, void *user);
+
+/* Panels on own SPI buses drawn as one canvas. Fills and images are started on every panel and
+   their DMA transfers run side by side, so update takes about as long as on the slowest panel.
+   Panels sharing SPI (also through SPI_Bus) are refused by addPanel() */
+class DisplayGroup {
+	private:
+		TFTLIB_SPI *__panels[GroupMaxPanels];
+		int32_t __px[GroupMaxPanels], __py[GroupMaxPanels];
+		uint8_t __n = 0;
+
+		void run(void);
+
+	public:
+		int8_t addPanel(TFTLIB_SPI &tft, int32_t x = 0, int32_t y = 0);
+		int32_t width(void);
+		int32_t height(void);
+
+		void fillScreen(uint16_t color);
+		void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color);
+		void drawImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data);
+		void draw(GroupDraw fn, void *user);
+};
+
 #pragma GCC pop_options
 
 #endif
@@ -0,0 +1,33 @@
+/*
+ * arm_neon.h
+ *
+ * Host stand-in for the NEON intrinsics used by TFTLIB_SPI, lane by lane and bit exact.
+ * Lets host builds run the NEON paths, see test_blend_neon in Makefile.
+ */
+
+#ifndef TEST_ARM_NEON_H_
+#define TEST_ARM_NEON_H_
+
+#include <stdint.h>
+
+typedef struct { uint8_t  v[8]; } uint8x8_t;
+typedef struct { uint16_t v[8]; } uint16x8_t;
+
+#define NEON_LANES(expr) { uint16x8_t r; for (int i = 0; i < 8; i++) r.v[i] = (uint16_t)(expr); return r; }
+
+static inline uint8x8_t vld1_u8(const uint8_t *p) { uint8x8_t r; for (int i = 0; i < 8; i++) r.v[i] = p[i]; return r; }
+static inline uint16x8_t vld1q_u16(const uint16_t *p) NEON_LANES(p[i])
+static inline void vst1q_u16(uint16_t *p, uint16x8_t a) { for (int i = 0; i < 8; i++) p[i] = a.v[i]; }
+static inline uint16x8_t vmovl_u8(uint8x8_t a) NEON_LANES(a.v[i])
+static inline uint16x8_t vdupq_n_u16(uint16_t a) NEON_LANES(a)
+static inline uint16x8_t vandq_u16(uint16x8_t a, uint16x8_t b) NEON_LANES(a.v[i] & b.v[i])
+static inline uint16x8_t vorrq_u16(uint16x8_t a, uint16x8_t b) NEON_LANES(a.v[i] | b.v[i])
+static inline uint16x8_t vsubq_u16(uint16x8_t a, uint16x8_t b) NEON_LANES(a.v[i] - b.v[i])
+static inline uint16x8_t vmulq_u16(uint16x8_t a, uint16x8_t b) NEON_LANES(a.v[i] * b.v[i])
+static inline uint16x8_t vmlaq_u16(uint16x8_t a, uint16x8_t b, uint16x8_t c) NEON_LANES(a.v[i] + b.v[i] * c.v[i])
+static inline uint16x8_t vshrq_n_u16(uint16x8_t a, int n) NEON_LANES(a.v[i] >> n)
+static inline uint16x8_t vshlq_n_u16(uint16x8_t a, int n) NEON_LANES(a.v[i] << n)
+
+#undef NEON_LANES
+
+#endif /* TEST_ARM_NEON_H_ */
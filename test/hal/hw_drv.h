@@ -0,0 +1,15 @@
+/*
+ * hw_drv.h
+ *
+ * Host stand-in of register level helpers, blocking transmit goes to simulated panel
+ */
+
+#ifndef INC_HW_DRV_H_
+#define INC_HW_DRV_H_
+
+static inline HAL_StatusTypeDef SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	return HAL_SPI_Transmit(hspi, pData, Size, Timeout);
+}
+
+#endif /* INC_HW_DRV_H_ */
@@ -0,0 +1,12 @@
+/*
+ * spi.h
+ *
+ * Host stand-in of CubeMX spi.h
+ */
+
+#ifndef TEST_SPI_H_
+#define TEST_SPI_H_
+
+#include "stm32f4xx_hal.h"
+
+#endif /* TEST_SPI_H_ */
@@ -0,0 +1,111 @@
+/*
+ * stm32f4xx_hal.h
+ *
+ * Host stand-in for the parts of STM32 HAL and CMSIS used by TFTLIB_SPI.
+ * SPI transfers end in sim.cpp, which decodes them into a simulated panel.
+ */
+
+#ifndef TEST_STM32F4XX_HAL_H_
+#define TEST_STM32F4XX_HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __IO volatile
+
+typedef enum { HAL_OK = 0, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+typedef enum { HAL_SPI_STATE_RESET = 0, HAL_SPI_STATE_READY, HAL_SPI_STATE_BUSY, HAL_SPI_STATE_BUSY_TX } HAL_SPI_StateTypeDef;
+typedef enum { HAL_DMA_STATE_RESET = 0, HAL_DMA_STATE_READY, HAL_DMA_STATE_BUSY } HAL_DMA_StateTypeDef;
+typedef enum { GPIO_PIN_RESET = 0, GPIO_PIN_SET } GPIO_PinState;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+/* BSRR write sets low half and resets high half of output register */
+struct BSRRReg {
+	uint32_t odr = 0;
+	BSRRReg &operator=(uint32_t v) { odr |= (v & 0xFFFF); odr &= ~(v >> 16); return *this; }
+};
+
+typedef struct { BSRRReg BSRR; uint32_t IDR; } GPIO_TypeDef;
+typedef struct { uint32_t CR1; uint32_t CR2; uint32_t SR; uint32_t DR; } SPI_TypeDef;
+typedef struct { HAL_DMA_StateTypeDef State; } DMA_HandleTypeDef;
+typedef struct { uint32_t Mode; uint32_t BaudRatePrescaler; uint32_t CLKPolarity; uint32_t CLKPhase; uint32_t Direction; } SPI_InitTypeDef;
+typedef struct { uint32_t Pin, Mode, Pull, Speed; } GPIO_InitTypeDef;
+
+struct SimPanel;
+typedef struct __SPI_HandleTypeDef {
+	SPI_TypeDef *Instance;
+	SPI_InitTypeDef Init;
+	volatile HAL_SPI_StateTypeDef State;
+	DMA_HandleTypeDef *hdmatx;
+	DMA_HandleTypeDef *hdmarx;
+	SimPanel *sim;					// Panel receiving transmitted bytes
+} SPI_HandleTypeDef;
+
+#define GPIO_MODE_INPUT				0
+#define GPIO_MODE_OUTPUT_PP			1
+#define GPIO_MODE_ANALOG			3
+#define GPIO_PULLUP					1
+#define GPIO_NOPULL					0
+#define GPIO_SPEED_FREQ_HIGH		2
+
+#define SPI_CR1_SPE					(1u << 6)
+#define SPI_CR1_BR					(7u << 3)
+#define SPI_CR1_CPOL				(1u << 1)
+#define SPI_CR1_CPHA				(1u << 0)
+#define SPI_BAUDRATEPRESCALER_2		0x00u
+#define SPI_BAUDRATEPRESCALER_4		0x08u
+#define SPI_BAUDRATEPRESCALER_8		0x10u
+#define SPI_BAUDRATEPRESCALER_16	0x18u
+#define SPI_BAUDRATEPRESCALER_32	0x20u
+#define SPI_BAUDRATEPRESCALER_64	0x28u
+#define SPI_BAUDRATEPRESCALER_128	0x30u
+#define SPI_BAUDRATEPRESCALER_256	0x38u
+#define SPI_POLARITY_LOW			0
+#define SPI_POLARITY_HIGH			SPI_CR1_CPOL
+#define SPI_PHASE_1EDGE				0
+#define SPI_PHASE_2EDGE				SPI_CR1_CPHA
+#define __HAL_SPI_DISABLE(h)		((h)->Instance->CR1 &= ~SPI_CR1_SPE)
+#define __HAL_SPI_ENABLE(h)			((h)->Instance->CR1 |= SPI_CR1_SPE)
+
+typedef struct { uint32_t ACR; } FLASH_TypeDef;
+extern FLASH_TypeDef *FLASH;
+#define FLASH_ACR_ICEN				1
+#define FLASH_ACR_DCEN				2
+#define FLASH_ACR_PRFTEN			4
+
+extern uint32_t SystemCoreClock;
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size);
+HAL_DMA_StateTypeDef HAL_DMA_GetState(DMA_HandleTypeDef *hdma);
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t delay);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin);
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init);
+uint32_t HAL_RCC_GetHCLKFreq(void);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+uint32_t HAL_RCC_GetSysClockFreq(void);
+
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t) {}
+static inline void __DMB(void) { __asm__ volatile ("" ::: "memory"); }
+
+#if defined(__ARM_FEATURE_DSP)
+/* Cortex-M4 SIMD intrinsics emulated bit exact, lets host builds run the DSP paths */
+static inline uint32_t __PKHBT(uint32_t a, uint32_t b, uint32_t shift) {
+	return (a & 0x0000FFFF) | ((b << shift) & 0xFFFF0000);
+}
+static inline uint32_t __SMUAD(uint32_t a, uint32_t b) {
+	return (uint32_t)((int16_t)a * (int16_t)b + (int16_t)(a >> 16) * (int16_t)(b >> 16));
+}
+#endif
+
+#endif /* TEST_STM32F4XX_HAL_H_ */
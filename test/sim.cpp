@@ -0,0 +1,115 @@
+/*
+ * sim.cpp
+ *
+ * HAL functions of host build. Blocking and DMA transmits complete at once and feed
+ * the panel attached to the handle, receive returns zeros.
+ */
+
+#include "sim.h"
+
+FLASH_TypeDef g_flash;
+FLASH_TypeDef *FLASH = &g_flash;
+uint32_t SystemCoreClock = 168000000;
+int g_sim_failures = 0;
+
+static SPI_TypeDef g_spi_regs;
+static DMA_HandleTypeDef g_dma = { HAL_DMA_STATE_READY };
+static uint32_t g_tick = 0;
+
+void simAttach(SPI_HandleTypeDef &hspi, SimPanel &panel, GPIO_TypeDef *dc, uint16_t dc_pin) {
+	hspi.Instance = &g_spi_regs;
+	hspi.State = HAL_SPI_STATE_READY;
+	hspi.hdmatx = &g_dma;
+	hspi.hdmarx = &g_dma;
+	hspi.sim = &panel;
+	panel.dc = dc;
+	panel.dc_pin = dc_pin;
+}
+
+void SimPanel::byte(uint8_t b) {
+	bool data = dc && (dc->BSRR.odr & dc_pin);
+
+	if (!data) {
+		cmd = b;
+		args.clear();
+		half = -1;
+		ramwr = (b == 0x2C);
+		if (ramwr) {
+			cx = x0;
+			cy = y0;
+		}
+		return;
+	}
+
+	if (cmd == 0x2A || cmd == 0x2B) {
+		args.push_back(b);
+		if (args.size() == 4) {
+			int a = (args[0] << 8) | args[1], c = (args[2] << 8) | args[3];
+			if (cmd == 0x2A) { x0 = a; x1 = c; }
+			else { y0 = a; y1 = c; }
+		}
+		return;
+	}
+
+	if (!ramwr) return;
+	if (half < 0) {
+		half = b;
+		return;
+	}
+
+	uint16_t px = (half << 8) | b;
+	half = -1;
+	pixels++;
+	if (cx < W && cy < H) fb[cy * W + cx] = px;
+	if (record) log.push_back({ (int16_t)cx, (int16_t)cy, px });
+	if (++cx > x1) {
+		cx = x0;
+		if (++cy > y1) cy = y0;
+	}
+}
+
+static void sink(SPI_HandleTypeDef *hspi, const uint8_t *data, uint16_t size) {
+	if (hspi->sim == nullptr) return;
+	for (uint16_t i = 0; i < size; i++) hspi->sim->byte(data[i]);
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t) {
+	sink(hspi, data, size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size) {
+	sink(hspi, data, size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *, uint8_t *data, uint16_t size, uint32_t) {
+	for (uint16_t i = 0; i < size; i++) data[i] = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *, uint8_t *, uint8_t *rx, uint16_t size, uint32_t) {
+	for (uint16_t i = 0; i < size; i++) rx[i] = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *, uint8_t *, uint8_t *rx, uint16_t size) {
+	for (uint16_t i = 0; i < size; i++) rx[i] = 0;
+	return HAL_OK;
+}
+
+HAL_DMA_StateTypeDef HAL_DMA_GetState(DMA_HandleTypeDef *hdma) { return hdma->State; }
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi) { return hspi->State; }
+uint32_t HAL_GetTick(void) { return g_tick++; }
+void HAL_Delay(uint32_t) {}
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *, uint16_t) { return GPIO_PIN_SET; }
+void HAL_GPIO_Init(GPIO_TypeDef *, GPIO_InitTypeDef *) {}
+uint32_t HAL_RCC_GetHCLKFreq(void) { return 0; }
+uint32_t HAL_RCC_GetPCLK1Freq(void) { return 0; }
+uint32_t HAL_RCC_GetPCLK2Freq(void) { return 0; }
+uint32_t HAL_RCC_GetSysClockFreq(void) { return 0; }
+
+extern "C" char *sbrk(int) {
+	static char heap_end;
+	return &heap_end;
+}
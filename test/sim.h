@@ -0,0 +1,56 @@
+/*
+ * sim.h
+ *
+ * Host simulator for TFTLIB_SPI tests. SPI bytes are decoded like an ILI9341/ST7789 does
+ * (CASET, RASET, RAMWR with DC pin selecting command or data) into a frame buffer.
+ */
+
+#ifndef TEST_SIM_H_
+#define TEST_SIM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "stm32f4xx_hal.h"
+
+/* One pixel written to panel RAM */
+typedef struct {
+	int16_t x, y;
+	uint16_t color;
+} SimWrite;
+
+struct SimPanel {
+	int W = 320, H = 240;
+	std::vector<uint16_t> fb;				// Pixels in RGB565, not byte swapped
+	std::vector<SimWrite> log;				// Every pixel write while record is set
+	bool record = false;
+	long pixels = 0;
+
+	GPIO_TypeDef *dc = nullptr;
+	uint16_t dc_pin = 0;
+
+	SimPanel() { fb.assign(W * H, 0); }
+	uint16_t at(int x, int y) const { return fb[y * W + x]; }
+	void byte(uint8_t b);
+
+private:
+	uint8_t cmd = 0;
+	std::vector<uint8_t> args;
+	int x0 = 0, x1 = 0, y0 = 0, y1 = 0, cx = 0, cy = 0, half = -1;
+	bool ramwr = false;
+};
+
+/* Route SPI handle to panel, dc_pin of dc port high means data */
+void simAttach(SPI_HandleTypeDef &hspi, SimPanel &panel, GPIO_TypeDef *dc, uint16_t dc_pin);
+
+/* Minimal checks, failures are counted and printed, main() returns simResult() */
+extern int g_sim_failures;
+
+#define CHECK(cond) do { if (!(cond)) { g_sim_failures++; printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+static inline int simResult(const char *name) {
+	printf("%s: %s\n", name, g_sim_failures ? "FAILED" : "passed");
+	return g_sim_failures ? 1 : 0;
+}
+
+#endif /* TEST_SIM_H_ */
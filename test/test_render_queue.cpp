@@ -0,0 +1,81 @@
+/*
+ * test_render_queue.cpp
+ *
+ * RenderQueue with std::thread producers and a render thread draining it concurrently.
+ * Producer p fills pixel (p, 0) with its sequence number as colour, so the panel write
+ * log tells which accepted command ran and in what order. Run with SANITIZE=thread too.
+ */
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "sim.h"
+#include "TFTLIB_SPI.h"
+
+constexpr int Producers = 6;
+constexpr int Pushes = 20000;				// Sequence numbers 1..Pushes fit in colour
+
+static SimPanel panel;
+
+int main() {
+	SPI_HandleTypeDef hspi{};
+	GPIO_TypeDef dc{}, cs{}, rst{};
+	simAttach(hspi, panel, &dc, 1);
+
+	TFTLIB_SPI tft(hspi, TFT_DRIVER::ILI9341, &dc, 1, &cs, 2, &rst, 4);
+	tft.init();
+	tft.setRotation(1);
+
+	RenderQueue *queue = new RenderQueue(&tft);
+	std::vector<uint16_t> accepted[Producers];
+	uint32_t rejected[Producers] = {};
+	std::atomic<int> running(Producers);
+
+	panel.record = true;
+	std::thread render([&] {
+		while (running.load() > 0) {
+			if (queue->process() == 0) std::this_thread::yield();
+		}
+		queue->process();
+	});
+
+	std::vector<std::thread> producers;
+	for (int p = 0; p < Producers; p++) {
+		producers.emplace_back([&, p] {
+			for (int seq = 1; seq <= Pushes; seq++) {
+				if (queue->fillRect(p, 0, 1, 1, seq)) accepted[p].push_back(seq);
+				else {
+					rejected[p]++;
+					std::this_thread::yield();
+				}
+			}
+			running--;
+		});
+	}
+	for (auto &t : producers) t.join();
+	render.join();
+	panel.record = false;
+
+	// Nothing accepted is lost or run twice, every producer's commands keep their order
+	std::vector<uint16_t> ran[Producers];
+	for (const SimWrite &w : panel.log) {
+		CHECK(w.y == 0 && w.x >= 0 && w.x < Producers);
+		if (w.y == 0 && w.x >= 0 && w.x < Producers) ran[w.x].push_back(w.color);
+	}
+
+	uint32_t total_rejected = 0, total_accepted = 0;
+	for (int p = 0; p < Producers; p++) {
+		CHECK(ran[p] == accepted[p]);
+		CHECK(accepted[p].size() + rejected[p] == (size_t)Pushes);
+		total_rejected += rejected[p];
+		total_accepted += accepted[p].size();
+	}
+
+	// Every rejected push is counted as drop, nothing is left in queue
+	CHECK(queue->drops() == total_rejected);
+	CHECK(queue->process() == 0);
+
+	printf("accepted %u, dropped %u\n", total_accepted, total_rejected);
+	delete queue;
+	return simResult("test_render_queue");
+}
@@ -0,0 +1,116 @@
+/*
+ * test_wedge.cpp
+ *
+ * Fixed point wedge line coverage against the float distance field it replaced. Every
+ * pixel of the bounding box of random lines is stepped like drawWedgeSpan() does and the
+ * 8 bit alpha of both paths must agree within 1. Library source is included to reach
+ * internal helpers.
+ */
+
+#include "sim.h"
+#include "TFTLIB_SPI.cpp"
+
+constexpr int Lines = 400;
+
+static uint32_t lcg = 12345;
+
+static float randf(float lo, float hi) {
+	lcg = lcg * 1664525u + 1013904223u;
+	return lo + (hi - lo) * (float)(lcg >> 8) / (float)(1u << 24);
+}
+
+/* Float distance field of the original drawWedgeLine */
+static float wedgeLineDistance(float xpax, float ypay, float bax, float bay, float dr) {
+	float h = fmaxf(fminf((xpax * bax + ypay * bay) / (bax * bax + bay * bay), 1.0f), 0.0f);
+	float dx = xpax - bax * h, dy = ypay - bay * h;
+	return sqrtf(dx * dx + dy * dy) + h * dr;
+}
+
+/* 8 bit alpha as the span code uses it: 0 is skipped, 255 is solid */
+static int alpha8(float a) {
+	if (a <= LoAlphaTheshold) return 0;
+	if (a > HiAlphaTheshold) return 255;
+	return (uint8_t)(a * PixelAlphaGain);
+}
+
+static int alpha8(int32_t a) {
+	if (a <= (int32_t)(LoAlphaTheshold * 65536.0f)) return 0;
+	if (a > (int32_t)(HiAlphaTheshold * 65536.0f)) return 255;
+	return (a * 255) >> 16;
+}
+
+static void testFixedSqrt(TFTLIB_SPI &tft) {
+	int bad = 0;
+	for (uint64_t x = 0; x < 100000; x++) {
+		double r = sqrt((double)x);
+		if (fabs((double)tft.fixedSqrt(x) - r) > 1.0) bad++;
+	}
+	for (int i = 0; i < 200000; i++) {
+		lcg = lcg * 1664525u + 1013904223u;
+		uint64_t x = ((uint64_t)lcg << 32) ^ (lcg * 2654435761u);
+		x >>= 12 + lcg % 52;					// Below 2^52, squared Q16 distances up to 1024 pixels
+		long double r = sqrtl((long double)x);
+		if (fabsl((long double)tft.fixedSqrt(x) - r) > 1.0L) bad++;
+	}
+	CHECK(bad == 0);
+}
+
+static void testCoverage(TFTLIB_SPI &tft) {
+	const float step = 1.5f / 255.0f;			// Float alpha this close to a threshold may go either way
+	long pixels = 0, edge = 0, worst = 0;
+
+	for (int n = 0; n < Lines; n++) {
+		float ax = randf(-20, 340), ay = randf(-20, 260);
+		float bx = randf(-20, 340), by = randf(-20, 260);
+		if (n % 4 == 0) { bx = ax + randf(-3, 3); by = ay + randf(-3, 3); }		// Short, mostly caps
+		float ar = randf(0.5f, 20), br = randf(0.5f, 20);
+		if ((fabsf(ax - bx) < 0.01f) && (fabsf(ay - by) < 0.01f)) bx += 0.01f;
+
+		WedgeSDF sdf;
+		tft.wedgeSetup(sdf, ax, ay, bx, by, ar, br);
+
+		int32_t x0 = (int32_t)floorf(fminf(ax-ar, bx-br));
+		int32_t x1 = (int32_t) ceilf(fmaxf(ax+ar, bx+br));
+		int32_t y0 = (int32_t)floorf(fminf(ay-ar, by-br));
+		int32_t y1 = (int32_t) ceilf(fmaxf(ay+ar, by+br));
+		float bax = bx - ax, bay = by - ay;
+
+		for (int32_t yp = y0; yp <= y1; yp++) {
+			int64_t px = (int64_t)x0 * 65536 - sdf.ax, py = (int64_t)yp * 65536 - sdf.ay;
+			int64_t u = (px * sdf.ux + py * sdf.uy) >> 16;
+			int64_t v = (py * sdf.ux - px * sdf.uy) >> 16;
+
+			for (int32_t xp = x0; xp <= x1; xp++, u += sdf.ux, v -= sdf.uy) {
+				float a = (ar + 0.5f) - wedgeLineDistance(xp - ax, yp - ay, bax, bay, ar - br);
+				int want = alpha8(a);
+				int got = alpha8(tft.wedgeCoverage(sdf, (int32_t)(u >> 14), (int32_t)(v >> 14)));
+				pixels++;
+				if (abs(got - want) <= 1) continue;
+
+				// Either side of a threshold both results are right
+				if (fabsf(a - LoAlphaTheshold) < step || fabsf(a - HiAlphaTheshold) < step) {
+					if (abs(got - alpha8(a - step)) <= 1 || abs(got - alpha8(a + step)) <= 1) { edge++; continue; }
+				}
+				if (abs(got - want) > worst) {
+					worst = abs(got - want);
+					printf("line %d pixel %ld,%ld: float %d fixed %d\n", n, (long)xp, (long)yp, want, got);
+				}
+			}
+		}
+	}
+	printf("%ld pixels, %ld on threshold\n", pixels, edge);
+	CHECK(worst == 0);
+}
+
+int main() {
+	SimPanel panel;
+	SPI_HandleTypeDef hspi{};
+	GPIO_TypeDef dc{}, cs{}, rst{};
+	simAttach(hspi, panel, &dc, 1);
+
+	TFTLIB_SPI tft(hspi, TFT_DRIVER::ILI9341, &dc, 1, &cs, 2, &rst, 4);
+
+	testFixedSqrt(tft);
+	testCoverage(tft);
+	return simResult("test_wedge");
+}
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+#
+# q565enc.py
+#
+# Host side encoder of Q565 compressed images for TFTLIB_SPI::drawImageQ565().
+# Format is described in TFTLIB_SPI.h next to Q565Decoder.
+#
+# Usage:
+#   q565enc.py splash.png                    writes splash.h with const uint8_t splash[]
+#   q565enc.py splash.png -o splash.bin      writes raw stream
+#   q565enc.py dump.raw --size 320x240       input is raw little endian RGB565
+#
+# PNG/BMP/JPG input needs Pillow (pip install pillow).
+
+import argparse
+import os
+import re
+import sys
+
+OP_DIFF  = 0x40
+OP_LUMA  = 0x80
+OP_RUN   = 0xC0
+OP_COLOR = 0xFE
+
+
+def q565_hash(c):
+	return ((c >> 11) * 3 + ((c >> 5) & 0x3F) * 5 + (c & 0x1F) * 7) & 0x3F
+
+
+def wrap(v, bits):
+	m = 1 << bits
+	return (v + (m >> 1)) % m - (m >> 1)
+
+
+def encode(pixels, w, h):
+	out = bytearray(b"Q565")
+	out += bytes((w & 0xFF, w >> 8, h & 0xFF, h >> 8))
+
+	index = [0] * 64
+	prev = 0
+	run = 0
+
+	for i, px in enumerate(pixels):
+		if px == prev:
+			run += 1
+			if run == 62 or i == len(pixels) - 1:
+				out.append(OP_RUN | (run - 1))
+				run = 0
+			continue
+
+		if run:
+			out.append(OP_RUN | (run - 1))
+			run = 0
+
+		hs = q565_hash(px)
+		if index[hs] == px:
+			out.append(hs)
+		else:
+			index[hs] = px
+			dr = wrap((px >> 11) - (prev >> 11), 5)
+			dg = wrap(((px >> 5) & 0x3F) - ((prev >> 5) & 0x3F), 6)
+			db = wrap((px & 0x1F) - (prev & 0x1F), 5)
+			rg = wrap(dr - (dg >> 1), 5)
+			bg = wrap(db - (dg >> 1), 5)
+
+			if -2 <= dr <= 1 and -2 <= dg <= 1 and -2 <= db <= 1:
+				out.append(OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2))
+			elif -8 <= rg <= 7 and -8 <= bg <= 7:
+				out.append(OP_LUMA | (dg + 32))
+				out.append(((rg + 8) << 4) | (bg + 8))
+			else:
+				out += bytes((OP_COLOR, px >> 8, px & 0xFF))
+		prev = px
+
+	return bytes(out)
+
+
+def load(path, size):
+	if size:
+		w, h = (int(v) for v in size.lower().split("x"))
+		raw = open(path, "rb").read()
+		if len(raw) < w * h * 2:
+			sys.exit("raw input is shorter than %dx%d" % (w, h))
+		return [raw[2 * i] | (raw[2 * i + 1] << 8) for i in range(w * h)], w, h
+
+	try:
+		from PIL import Image
+	except ImportError:
+		sys.exit("Pillow is needed for image input, or pass raw RGB565 with --size")
+
+	img = Image.open(path).convert("RGB")
+	w, h = img.size
+	pixels = [((r * 31 + 127) // 255) << 11 | ((g * 63 + 127) // 255) << 5 | ((b * 31 + 127) // 255)
+		for r, g, b in img.getdata()]
+	return pixels, w, h
+
+
+def main():
+	ap = argparse.ArgumentParser(description="Encode image to Q565 stream for TFTLIB_SPI")
+	ap.add_argument("input")
+	ap.add_argument("-o", "--output", help="output .h (C array) or .bin (raw), default <input>.h")
+	ap.add_argument("-n", "--name", help="C array name, default from input file name")
+	ap.add_argument("--size", help="WxH of raw little endian RGB565 input")
+	args = ap.parse_args()
+
+	pixels, w, h = load(args.input, args.size)
+	if w > 0xFFFF or h > 0xFFFF:
+		sys.exit("image is too large")
+	data = encode(pixels, w, h)
+
+	base = os.path.splitext(args.input)[0]
+	output = args.output or base + ".h"
+	name = args.name or re.sub(r"\W", "_", os.path.basename(base))
+
+	if output.endswith(".bin"):
+		open(output, "wb").write(data)
+	else:
+		with open(output, "w") as f:
+			f.write("/* %s, %dx%d, Q565 %d bytes (raw %d) */\n" % (os.path.basename(args.input), w, h, len(data), w * h * 2))
+			f.write("const uint8_t %s[%d] = {\n" % (name, len(data)))
+			for i in range(0, len(data), 16):
+				f.write("\t" + ", ".join("0x%02X" % b for b in data[i:i + 16]) + ",\n")
+			f.write("};\n")
+
+	print("%s: %dx%d, %d -> %d bytes (%.1f%%)" % (output, w, h, w * h * 2, len(data), 100.0 * len(data) / (w * h * 2)))
+
+
+if __name__ == "__main__":
+	main()